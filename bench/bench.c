@@ -0,0 +1,510 @@
+#include <nn.h>
+#include <neat.h>
+
+/* Not part of the public API but speciation is too hot to leave out */
+#include "../src/neat/genome.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <time.h>
+
+/* Every benchmark runs at least this long to smooth out the timer */
+#define BENCH_MIN_SECONDS 0.2
+
+/* Allocations of everything linked into the benchmark, counted by the
+ * wrappers below which are enabled with --wrap in the Makefile
+ */
+static size_t bench_allocations = 0;
+/* Bytes requested by the same allocations, a realloc counts its new size */
+static size_t bench_allocated_bytes = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	#pragma omp atomic
+	bench_allocations++;
+	#pragma omp atomic
+	bench_allocated_bytes += size;
+
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	#pragma omp atomic
+	bench_allocations++;
+	#pragma omp atomic
+	bench_allocated_bytes += count * size;
+
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+	#pragma omp atomic
+	bench_allocations++;
+	#pragma omp atomic
+	bench_allocated_bytes += size;
+
+	return __real_realloc(pointer, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size)
+{
+	#pragma omp atomic
+	bench_allocations++;
+	#pragma omp atomic
+	bench_allocated_bytes += size;
+
+	return __real_aligned_alloc(alignment, size);
+}
+
+static double bench_now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/* A benchmark runs niterations operations on state from a single call */
+typedef void (*bench_fn)(void *state, size_t niterations);
+
+/* Print a tab separated line per benchmark, the columns are:
+ * name, parameters, ns per operation, operations per second and
+ * allocations per operation
+ */
+static void bench_run(const char *name,
+		      const char *parameters,
+		      bench_fn fn,
+		      void *state)
+{
+	/* Warm up the caches and find out how many iterations are needed */
+	size_t niterations = 1;
+	double elapsed = 0.0;
+	size_t allocations = 0;
+	for(;;){
+		size_t start_allocations = bench_allocations;
+		double start = bench_now();
+		fn(state, niterations);
+		elapsed = bench_now() - start;
+		allocations = bench_allocations - start_allocations;
+
+		if(elapsed >= BENCH_MIN_SECONDS){
+			break;
+		}
+		niterations *= 2;
+	}
+
+	double ns = elapsed * 1e9 / niterations;
+	printf("%s\t%s\t%.1f\t%.1f\t%.3f\n",
+	       name,
+	       parameters,
+	       ns,
+	       1e9 / ns,
+	       (double)allocations / niterations);
+	fflush(stdout);
+}
+
+struct bench_net{
+	struct nn_ffnet *net;
+	struct nn_program *program;
+	float *inputs;
+	float *outputs;
+	float *scratch;
+	size_t nsamples;
+};
+
+static const char *bench_activation_names[] = {
+	[NN_ACTIVATION_SIGMOID] = "sigmoid",
+	[NN_ACTIVATION_FAST_SIGMOID] = "fast_sigmoid",
+	[NN_ACTIVATION_RELU] = "relu"
+};
+
+static void bench_ffnet_run(void *state, size_t niterations)
+{
+	struct bench_net *b = state;
+
+	for(size_t i = 0; i < niterations; i++){
+		size_t sample = i % b->nsamples;
+		nn_ffnet_run(b->net, b->inputs + sample * b->net->ninputs);
+	}
+}
+
+static void bench_program_run(void *state, size_t niterations)
+{
+	struct bench_net *b = state;
+
+	for(size_t i = 0; i < niterations; i++){
+		size_t input = i % b->nsamples * b->net->ninputs;
+		nn_program_run(b->program, b->inputs + input);
+	}
+}
+
+/* An operation is a single sample so it compares with the other runs */
+static void bench_ffnet_run_batch(void *state, size_t niterations)
+{
+	struct bench_net *b = state;
+
+	for(size_t i = 0; i < niterations; i += b->nsamples){
+		nn_ffnet_run_batch(b->net,
+				   b->inputs,
+				   b->nsamples,
+				   b->outputs,
+				   b->scratch);
+	}
+}
+
+static void bench_ffnet_copy(void *state, size_t niterations)
+{
+	struct bench_net *b = state;
+
+	for(size_t i = 0; i < niterations; i++){
+		nn_ffnet_destroy(nn_ffnet_copy(b->net));
+	}
+}
+
+static void bench_nn(void)
+{
+	const size_t topologies[][4] = {
+		{2, 0, 1, 0},
+		{16, 16, 4, 2},
+		{64, 64, 8, 4},
+		{256, 256, 16, 2}
+	};
+	const size_t nsamples = 256;
+
+	for(size_t i = 0; i < sizeof(topologies) / sizeof(*topologies); i++){
+		const size_t *topology = topologies[i];
+
+		struct bench_net b;
+		b.net = nn_ffnet_create(topology[0],
+					topology[1],
+					topology[2],
+					topology[3]);
+		b.nsamples = nsamples;
+		b.inputs = malloc(sizeof(float) * nsamples * topology[0]);
+		b.outputs = malloc(sizeof(float) * nsamples * topology[2]);
+		b.scratch = malloc(sizeof(float) *
+				   nn_ffnet_batch_scratch_size(b.net));
+
+		struct nn_rng rng;
+		nn_rng_seed(&rng, i);
+		nn_ffnet_randomize_ex(b.net, &rng);
+		nn_rng_fill(&rng, b.inputs, nsamples * topology[0], -1.0, 1.0);
+
+		for(int j = 0; j <= NN_ACTIVATION_RELU; j++){
+			nn_ffnet_set_activations(b.net, j, j);
+			b.program = nn_program_from_ffnet(b.net);
+
+			char parameters[128];
+			snprintf(parameters, sizeof(parameters),
+				 "topology=%zux%zux%zux%zu activation=%s",
+				 topology[0], topology[1],
+				 topology[2], topology[3],
+				 bench_activation_names[j]);
+
+			bench_run("nn_ffnet_run", parameters,
+				  bench_ffnet_run, &b);
+			bench_run("nn_program_run", parameters,
+				  bench_program_run, &b);
+			bench_run("nn_ffnet_run_batch", parameters,
+				  bench_ffnet_run_batch, &b);
+
+			nn_program_destroy(b.program);
+		}
+
+		char parameters[128];
+		snprintf(parameters, sizeof(parameters),
+			 "topology=%zux%zux%zux%zu",
+			 topology[0], topology[1], topology[2], topology[3]);
+		bench_run("nn_ffnet_copy", parameters, bench_ffnet_copy, &b);
+
+		nn_ffnet_destroy(b.net);
+		free(b.inputs);
+		free(b.outputs);
+		free(b.scratch);
+	}
+}
+
+/* Cheap enough to not hide the cost of the population itself */
+static float bench_fitness(neat_t population, size_t genome_id, void *userdata)
+{
+	const float inputs[2] = {1.0, 0.5};
+
+	return 1.0f + neat_run(population, genome_id, inputs)[0];
+}
+
+struct bench_population{
+	neat_t neat;
+	size_t ngenomes;
+};
+
+static void bench_epoch(void *state, size_t niterations)
+{
+	struct bench_population *b = state;
+
+	for(size_t i = 0; i < niterations; i++){
+		/* Let every genome live long enough to be replaced again, this
+		 * is cheap compared to the epoch
+		 */
+		for(size_t j = 0; j < b->ngenomes; j++){
+			neat_increase_time_alive(b->neat, j);
+		}
+
+		neat_epoch(b->neat);
+	}
+}
+
+static void bench_evaluate(void *state, size_t niterations)
+{
+	struct bench_population *b = state;
+
+	for(size_t i = 0; i < niterations; i++){
+		neat_evaluate(b->neat, bench_fitness, NULL);
+	}
+}
+
+/* Nothing changes between the iterations so only the first one evaluates */
+static void bench_evaluate_cached(void *state, size_t niterations)
+{
+	struct bench_population *b = state;
+
+	for(size_t i = 0; i < niterations; i++){
+		neat_evaluate_cached(b->neat, bench_fitness, NULL, 1);
+	}
+}
+
+static void bench_speciate(void *state, size_t niterations)
+{
+	struct bench_population *b = state;
+
+	for(size_t i = 0; i < niterations; i++){
+		neat_speciate(b->neat);
+	}
+}
+
+static void bench_neat(void)
+{
+	const size_t population_sizes[] = {100, 1000, 10000, 100000};
+	const float fractions[] = {0.0, 0.2};
+
+	for(size_t i = 0; i < sizeof(population_sizes) / sizeof(size_t); i++){
+		for(size_t j = 0; j < sizeof(fractions) / sizeof(float); j++){
+			struct neat_config config = {
+				.network_inputs = 2,
+				.network_outputs = 1,
+				.population_size = population_sizes[i],
+				.random_seed = i,
+
+				.epoch_replacement_fraction = fractions[j],
+				.genome_minimum_ticks_alive = 0,
+				.genome_compatibility_treshold = 0.5
+			};
+			struct bench_population b = {
+				.neat = neat_create(config),
+				.ngenomes = config.population_size
+			};
+			neat_evaluate(b.neat, bench_fitness, NULL);
+
+			char parameters[128];
+			snprintf(parameters, sizeof(parameters),
+				 "population=%zu replacement=%g",
+				 population_sizes[i], fractions[j]);
+
+			bench_run("neat_epoch", parameters, bench_epoch, &b);
+			if(j == 0){
+				bench_run("neat_evaluate", parameters,
+					  bench_evaluate, &b);
+				bench_run("neat_evaluate_cached", parameters,
+					  bench_evaluate_cached, &b);
+				bench_run("neat_speciate", parameters,
+					  bench_speciate, &b);
+			}
+
+			neat_destroy(b.neat);
+		}
+	}
+}
+
+struct bench_batch{
+	neat_t neat;
+	size_t ngenomes, nsamples;
+	float *inputs, *outputs;
+};
+
+/* An operation is a single genome on a single sample */
+static void bench_run_batch(void *state, size_t niterations)
+{
+	struct bench_batch *b = state;
+
+	size_t nruns = b->ngenomes * b->nsamples;
+	for(size_t i = 0; i < niterations; i += nruns){
+		neat_run_batch(b->neat, b->inputs, b->nsamples, b->outputs);
+	}
+}
+
+static void bench_backends(void)
+{
+	const size_t population_sizes[] = {1000, 10000};
+	const char *backend_names[] = {
+		[NEAT_BACKEND_CPU] = "cpu",
+		[NEAT_BACKEND_PACKED] = "packed"
+	};
+
+	for(size_t i = 0; i < sizeof(population_sizes) / sizeof(size_t); i++){
+		for(int j = 0; j <= NEAT_BACKEND_PACKED; j++){
+			struct neat_config config = {
+				.network_inputs = 16,
+				.network_outputs = 4,
+				.population_size = population_sizes[i],
+				.backend = j
+			};
+			struct bench_batch b = {
+				.neat = neat_create(config),
+				.ngenomes = config.population_size,
+				.nsamples = 64
+			};
+			b.inputs = malloc(sizeof(float) * b.nsamples * 16);
+			b.outputs = malloc(sizeof(float) * b.ngenomes *
+					   b.nsamples * 4);
+
+			struct nn_rng rng;
+			nn_rng_seed(&rng, i);
+			nn_rng_fill(&rng, b.inputs, b.nsamples * 16, -1.0, 1.0);
+
+			char parameters[128];
+			snprintf(parameters, sizeof(parameters),
+				 "population=%zu samples=%zu backend=%s",
+				 population_sizes[i], b.nsamples,
+				 backend_names[j]);
+			bench_run("neat_run_batch", parameters,
+				  bench_run_batch, &b);
+
+			free(b.inputs);
+			free(b.outputs);
+			neat_destroy(b.neat);
+		}
+	}
+}
+
+struct bench_speciation{
+	struct neat_genome *genome, *other;
+};
+
+static void bench_distance(void *state, size_t niterations)
+{
+	struct bench_speciation *b = state;
+
+	/* Never stop early so the whole genome is compared */
+	volatile float distance = 0.0f;
+	for(size_t i = 0; i < niterations; i++){
+		distance += neat_genome_distance(b->genome, b->other, FLT_MAX);
+	}
+}
+
+static void bench_speciation(void)
+{
+	const size_t input_counts[] = {2, 64, 1024};
+
+	for(size_t i = 0; i < sizeof(input_counts) / sizeof(size_t); i++){
+		struct neat_config config = {
+			.network_inputs = input_counts[i],
+			.network_outputs = 4,
+			.population_size = 2
+		};
+		struct neat_genome_pool *pool =
+			neat_genome_pool_create(config, 2);
+
+		/* Two genomes with their own data and different weights */
+		struct bench_speciation b;
+		b.genome = neat_genome_create(pool, config, 1);
+		b.other = neat_genome_create(pool, config, 1);
+
+		struct nn_rng rng;
+		nn_rng_seed(&rng, i);
+		nn_ffnet_randomize_ex(b.genome->net, &rng);
+		nn_ffnet_randomize_ex(b.other->net, &rng);
+
+		char parameters[128];
+		snprintf(parameters, sizeof(parameters),
+			 "genes=%zu", b.genome->net->nweights);
+		bench_run("neat_genome_distance", parameters,
+			  bench_distance, &b);
+
+		neat_genome_destroy(pool, b.genome);
+		neat_genome_destroy(pool, b.other);
+		neat_genome_pool_destroy(pool);
+	}
+}
+
+static float bench_footprint_fitness(neat_t population,
+				     size_t genome_id,
+				     void *userdata)
+{
+	const float inputs[16] = {0.0};
+
+	return 1.0f + neat_run(population, genome_id, inputs)[0];
+}
+
+/* Print the memory of a genome for every weight precision as a second table
+ * with the bytes per genome after creating the population and the bytes the
+ * compiled programs add to them. Reduced weights are only stored in the rows
+ * of the pool, the programs run on them without a copy
+ */
+static void bench_footprint(void)
+{
+	const char *precision_names[] = {
+		[NN_PRECISION_FLOAT] = "float",
+		[NN_PRECISION_BF16] = "bf16",
+		[NN_PRECISION_INT8] = "int8"
+	};
+
+	printf("\nname\tparameters\tgenome_bytes\tprogram_bytes\n");
+
+	for(int i = 0; i <= NN_PRECISION_INT8; i++){
+		struct neat_config config = {
+			.network_inputs = 16,
+			.network_outputs = 4,
+			.network_hidden_nodes = 64,
+			.network_hidden_layers = 2,
+			.population_size = 1000,
+			.network_precision = i
+		};
+
+		size_t start = bench_allocated_bytes;
+		neat_t neat = neat_create(config);
+		size_t created = bench_allocated_bytes;
+		neat_evaluate(neat, bench_footprint_fitness, NULL);
+		size_t compiled = bench_allocated_bytes;
+
+		printf("neat_genome_footprint\tprecision=%s\t%.1f\t%.1f\n",
+		       precision_names[i],
+		       (double)(created - start) / config.population_size,
+		       (double)(compiled - created) / config.population_size);
+		fflush(stdout);
+
+		neat_destroy(neat);
+	}
+}
+
+int main(void)
+{
+	printf("name\tparameters\tns_per_op\tops_per_sec\t"
+	       "allocations_per_op\n");
+
+	bench_nn();
+	bench_speciation();
+	bench_neat();
+	bench_backends();
+
+	bench_footprint();
+
+	return 0;
+}
@@ -2,15 +2,54 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <nn.h>
 
 typedef void* neat_t;
 
+/* Calculate the fitness of a genome, called by neat_evaluate from multiple
+ * threads at the same time but never for the same genome twice at once
+ */
+typedef float (*neat_fitness_fn)(neat_t population,
+				 size_t genome_id,
+				 void *userdata);
+
+/* Where neat_run_batch runs the genomes */
+enum neat_backend{
+	/* Every genome runs from its own network */
+	NEAT_BACKEND_CPU,
+	/* All genomes run block by block from the tensor of packed_weights,
+	 * which this backend turns on. Only the rows of genomes that changed
+	 * since the last run are new, the way an accelerator would keep them
+	 * in its memory
+	 */
+	NEAT_BACKEND_PACKED
+};
+
 struct neat_config{
 	/* NEAT */
 	size_t population_size;
+	/* Every population with the same seed and config evolves the same way
+	 * as long as the fitness doesn't depend on the order of evaluation
+	 */
+	uint64_t random_seed;
+	/* Remove the species that died out after every epoch, this changes the
+	 * indices returned by neat_get_species. Otherwise the species keep
+	 * their indices and the ones that died out are used again by new
+	 * species
+	 */
 	bool reset_on_extinction;
+	/* Threads used by neat_evaluate, 0 uses the OpenMP default */
+	size_t evaluation_threads;
+	/* Fraction of the population culled and reproduced by neat_epoch,
+	 * 0 only replaces the worst genome every epoch
+	 */
+	float epoch_replacement_fraction;
+	/* Results reported with neat_report_fitness before an epoch runs by
+	 * itself, 0 runs one after every result
+	 */
+	size_t epoch_reports;
 
 	/* Species */
 	double species_crossover_probability;
@@ -22,15 +61,226 @@ struct neat_config{
 	/* Neural Networks */
 	size_t network_inputs, network_outputs;
 	size_t network_hidden_nodes, network_hidden_layers;
+	/* Precision the genomes store and evolve their weights in, every
+	 * change of them is rounded to it again. Reduced weights are only kept
+	 * in the rows of packed_weights, which a reduced precision turns on,
+	 * and the compiled programs run on those rows without a copy, see
+	 * neat_genome_footprint in the benchmark
+	 */
+	enum nn_precision network_precision;
+	/* Keep the weights of all genomes in one aligned tensor with a row for
+	 * every genome, so passes over the whole population read them in order
+	 */
+	bool packed_weights;
+	enum neat_backend backend;
 };
 
+/* Counters of where the time of a population goes, only kept when the library
+ * is built with NEAT_STATS. The cycles are read from the time stamp counter
+ * when there is one and are nanoseconds otherwise
+ */
+struct neat_stats{
+	/* neat_epoch and the phases inside of it, the replacement of genomes
+	 * consists of copying the genitor and speciating the child
+	 */
+	uint64_t nepochs, epoch_cycles;
+	uint64_t selection_cycles, removal_cycles;
+	uint64_t reproduction_cycles, speciation_cycles;
+
+	/* neat_evaluate, genomes that kept their cached fitness aren't
+	 * evaluated
+	 */
+	uint64_t nevaluations, ncache_hits, evaluation_cycles;
+	double evaluation_seconds, evaluations_per_second;
+
+	/* Rows of the weights tensor that changed between the runs of
+	 * NEAT_BACKEND_PACKED, the ones an accelerator would copy again
+	 */
+	uint64_t nuploads;
+
+	/* Networks run by neat_run & neat_run_batch and the multiplications
+	 * and additions of their weights
+	 */
+	uint64_t nruns, nflops;
+
+	/* Allocations by the population after it's created, its backend and
+	 * neat_save included, and programs compiled for the genomes which
+	 * allocate as well
+	 */
+	uint64_t nallocations, ncompilations;
+
+	/* Genomes sent by neat_migrate and the ones the transport dropped */
+	uint64_t nmigrants, ndropped_migrants;
+
+	/* The current species that aren't empty */
+	size_t nspecies, smallest_species, largest_species;
+};
+
+/* Returned by neat_acquire_genome when every genome is handed out */
+#define NEAT_NO_GENOME SIZE_MAX
+
 neat_t neat_create(struct neat_config config);
 void neat_destroy(neat_t population);
 
+/* Write the whole population to a file so it can be continued later
+ *
+ * return false when the file couldn't be written
+ */
+bool neat_save(neat_t population, const char *path);
+
+/* Continue a population written by neat_save with the same build, the file
+ * is mapped into memory and the genomes are used from there without copying
+ * them, changes are never written back to the file. Every size, offset and
+ * index of the file is checked first, so a damaged file is either refused or
+ * loads a population that can be used
+ *
+ * return NULL when the file can't be read or wasn't written by neat_save
+ */
+neat_t neat_load(const char *path);
+
 const float *neat_run(neat_t population, size_t genome_id, const float *inputs);
 
+/* Compile a genome into a program that doesn't depend on the population, it
+ * only needs the nn part of the library to run and has to be freed with
+ * nn_program_destroy
+ */
+struct nn_program *neat_export(neat_t population, size_t genome_id);
+
+/* The genome with the highest fitness */
+size_t neat_get_best_genome(neat_t population);
+
+/* Run every genome of the population on a set of samples, the results match
+ * neat_run up to rounding because the weighted sums are added in another
+ * order. Expect them to differ by about 1e-6 times the sum of the absolute
+ * products going into a node
+ * inputs:	nsamples rows of network_inputs values
+ * nsamples:	amount of rows in inputs
+ * outputs:	caller owned buffer of population_size * nsamples *
+ * 		network_outputs values, the results of genome i for sample j
+ * 		start at outputs[(i * nsamples + j) * network_outputs]
+ */
+void neat_run_batch(neat_t population,
+		    const float *inputs,
+		    size_t nsamples,
+		    float *outputs);
+
+/* Calculate the fitness of every genome in parallel, the results are stored
+ * with neat_set_fitness and the time alive of every genome is increased
+ * fitness:	callback returning the fitness of a single genome
+ * userdata:	passed to every call of fitness
+ */
+void neat_evaluate(neat_t population, neat_fitness_fn fitness, void *userdata);
+
+/* Same as neat_evaluate but genomes that didn't change since they were last
+ * evaluated on the same input set get the same fitness again without calling
+ * fitness, copies of a genome share its result until they're changed
+ * input_set:	id of the data the fitness function uses, change it when the
+ * 		results of unchanged genomes would be different
+ */
+void neat_evaluate_cached(neat_t population,
+			  neat_fitness_fn fitness,
+			  void *userdata,
+			  uint64_t input_set);
+
 void neat_epoch(neat_t population);
 
+/* Assign every genome to a species again, the distances are calculated in
+ * parallel but the result doesn't depend on the amount of threads
+ */
+void neat_speciate(neat_t population);
+
+/* Index of the species of a genome, SIZE_MAX when it isn't in one */
+size_t neat_get_species(neat_t population, size_t genome_id);
+
 void neat_set_fitness(neat_t population, size_t genome_id, float fitness);
+/* The last fitness stored for a genome, children start with the one of their
+ * parent
+ */
+float neat_get_fitness(neat_t population, size_t genome_id);
+
+/* Evaluate genomes asynchronously, workers on any thread acquire a genome,
+ * run it and report its fitness in any order. Genomes that are handed out
+ * are never replaced, children are handed out before the others so they
+ * get the genome_minimum_ticks_alive results they need first. An epoch runs
+ * after every epoch_reports results
+ *
+ * return the id of the genome to evaluate or NEAT_NO_GENOME
+ */
+size_t neat_acquire_genome(neat_t population);
+/* Set the fitness of an acquired genome and increase its time alive */
+void neat_report_fitness(neat_t population, size_t genome_id, float fitness);
+
+/* Migration between populations that evolve independently, like islands on
+ * other threads or machines. The best genomes of a population are sent as
+ * self-contained messages and replace the worst genomes of the receiver
+ */
+
+/* Delivers messages to another population, every message is a single block
+ * of bytes that has to arrive unchanged. A transport is only used by one
+ * population at a time so it doesn't need to lock anything shared with it
+ * send:	return false when the message was dropped
+ * receive:	copy the next message into a buffer of size bytes, return its
+ * 		size or 0 when there are no messages. Messages larger than the
+ * 		buffer are dropped but still return their size
+ */
+struct neat_transport{
+	bool (*send)(void *destination, const void *message, size_t size);
+	size_t (*receive)(void *source, void *message, size_t size);
+
+	void *destination, *source;
+};
+
+/* Bytes needed for a message of any genome of the population */
+size_t neat_genome_message_size(neat_t population);
+
+/* Serialize a genome with its fitness
+ *
+ * return the size of the message or 0 when it doesn't fit
+ */
+size_t neat_write_genome(neat_t population,
+			 size_t genome_id,
+			 void *message,
+			 size_t size);
+
+/* Replace the worst genome that lived long enough with the genome of a
+ * message written by a population with the same network config
+ *
+ * return false when the message is invalid or no genome can be replaced
+ */
+bool neat_read_genome(neat_t population, const void *message, size_t size);
+
+/* Send the nmigrants best genomes and read every message waiting in the
+ * transport, this can run while other threads report fitness but only one
+ * thread can migrate a population at a time. Sends the transport refuses
+ * are counted in ndropped_migrants of the stats
+ *
+ * return the amount of genomes that were received
+ */
+size_t neat_migrate(neat_t population,
+		    const struct neat_transport *transport,
+		    size_t nmigrants);
+
+/* A transport within a process, populations on different threads can use
+ * the same queue at the same time. Connect them in a ring by sending to the
+ * queue of the next population and receiving from their own
+ */
+struct neat_queue;
+
+/* capacity:		messages that can wait in the queue, more are dropped
+ * message_size:	largest message, see neat_genome_message_size
+ */
+struct neat_queue *neat_queue_create(size_t capacity, size_t message_size);
+void neat_queue_destroy(struct neat_queue *queue);
+
+/* Functions of a struct neat_transport, destination and source are queues */
+bool neat_queue_send(void *destination, const void *message, size_t size);
+size_t neat_queue_receive(void *source, void *message, size_t size);
+
+/* Copy the counters since the population was created or reset
+ *
+ * return false when the library is built without NEAT_STATS
+ */
+bool neat_get_stats(neat_t population, struct neat_stats *stats);
+void neat_reset_stats(neat_t population);
 
 void neat_increase_time_alive(neat_t population, size_t genome_id);
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 
 enum nn_activation{
 	NN_ACTIVATION_SIGMOID,
@@ -8,15 +12,60 @@ enum nn_activation{
 	NN_ACTIVATION_RELU
 };
 
+/* xoshiro256** generator, every thread should use its own one */
+struct nn_rng{
+	uint64_t state[4];
+};
+
+/* The same seed always gives the same numbers */
+void nn_rng_seed(struct nn_rng *rng, uint64_t seed);
+
+/* Skip ahead 2^128 numbers, a copy that is jumped can be used by another
+ * thread without ever overlapping with the original
+ */
+void nn_rng_jump(struct nn_rng *rng);
+
+uint64_t nn_rng_next(struct nn_rng *rng);
+
+/* Random float from start up to but not including end */
+float nn_rng_float(struct nn_rng *rng, float start, float end);
+
+/* Random index below count without the bias of a modulo, count can't be
+ * bigger than UINT32_MAX
+ */
+size_t nn_rng_index(struct nn_rng *rng, size_t count);
+
+/* Fill values with random floats like nn_rng_float, generated multiple at a
+ * time by independent streams that are seeded from rng
+ */
+void nn_rng_fill(struct nn_rng *rng,
+		 float *values,
+		 size_t count,
+		 float start,
+		 float end);
+
+struct nn_ffnet;
+
+typedef float *(*nn_ffnet_run_fn)(const struct nn_ffnet *net,
+				  const float *inputs,
+				  float *scratch);
+
 struct nn_ffnet{
 	size_t ninputs, nhiddens, noutputs, nhidden_layers;
 	size_t nweights, nneurons;
 
 	float *weight, *output;
+	/* The weights are stored by the caller instead of behind the struct */
+	bool external_weights;
 
 	float bias;
 
 	enum nn_activation hidden_activation, output_activation;
+
+	/* Specialized for the activation functions by
+	 * nn_ffnet_set_activations
+	 */
+	nn_ffnet_run_fn run;
 };
 
 /* Create a new feedforward neural net, the activation functions for the hidden
@@ -32,9 +81,78 @@ struct nn_ffnet *nn_ffnet_create(size_t max_input_count,
 				 size_t max_output_count,
 				 size_t max_hidden_layer_count);
 
-/* Copy the feedforward network into a newly allocated one */
+/* Amount of weights of a feedforward network with the given sizes, the
+ * arguments are the same as for nn_ffnet_create
+ */
+size_t nn_ffnet_weight_count(size_t input_count,
+			     size_t hidden_count,
+			     size_t output_count,
+			     size_t hidden_layer_count);
+
+/* Amount of bytes needed to store a feedforward network with the given sizes,
+ * the arguments are the same as for nn_ffnet_create
+ */
+size_t nn_ffnet_size(size_t input_count,
+		     size_t hidden_count,
+		     size_t output_count,
+		     size_t hidden_layer_count);
+
+/* Create a new feedforward neural net like nn_ffnet_create but in memory
+ * owned by the caller, it must not be passed to nn_ffnet_destroy
+ * memory:	at least nn_ffnet_size bytes aligned for a struct nn_ffnet
+ */
+struct nn_ffnet *nn_ffnet_init(void *memory,
+			       size_t input_count,
+			       size_t hidden_count,
+			       size_t output_count,
+			       size_t hidden_layer_count);
+
+/* Amount of bytes needed to store a feedforward network with the given sizes
+ * without its weights, the arguments are the same as for nn_ffnet_create
+ */
+size_t nn_ffnet_size_external(size_t input_count,
+			      size_t hidden_count,
+			      size_t output_count,
+			      size_t hidden_layer_count);
+
+/* Same as nn_ffnet_init but the weights are stored in memory owned by the
+ * caller as well, like a row of a tensor with the weights of many networks
+ * memory:	at least nn_ffnet_size_external bytes aligned for a struct
+ * 		nn_ffnet
+ * weight:	room for nn_ffnet_weight_count floats, or NULL when the caller
+ * 		keeps them in another precision. The network only describes
+ * 		the topology then and can't be run, see
+ * 		nn_program_from_ffnet_weights
+ */
+struct nn_ffnet *nn_ffnet_init_external(void *memory,
+					float *weight,
+					size_t input_count,
+					size_t hidden_count,
+					size_t output_count,
+					size_t hidden_layer_count);
+
+/* Amount of bytes used by the feedforward network, external weights aren't
+ * counted
+ */
+size_t nn_ffnet_bytes(const struct nn_ffnet *net);
+
+/* Copy the feedforward network into a newly allocated one, a copy of a
+ * network with external weights shares them
+ */
 struct nn_ffnet *nn_ffnet_copy(struct nn_ffnet *net);
 
+/* Copy the feedforward network into memory owned by the caller, it must not
+ * be passed to nn_ffnet_destroy
+ * memory:	at least nn_ffnet_bytes bytes aligned for a struct nn_ffnet
+ */
+struct nn_ffnet *nn_ffnet_copy_into(void *memory, const struct nn_ffnet *net);
+
+/* Fix the pointers of a network that was moved or read from a file, the bytes
+ * must have been written by the same build. External weights have to be
+ * pointed to again by the caller
+ */
+void nn_ffnet_relocate(struct nn_ffnet *net);
+
 /* Deallocate the memory of the feedforward network */
 void nn_ffnet_destroy(struct nn_ffnet *net);
 
@@ -54,6 +172,9 @@ void nn_ffnet_set_bias(struct nn_ffnet *net, float bias);
 /* Give all the weights in the feedforward network a value between -1 & 1 */
 void nn_ffnet_randomize(struct nn_ffnet *net);
 
+/* Same as nn_ffnet_randomize with numbers from rng instead of rand() */
+void nn_ffnet_randomize_ex(struct nn_ffnet *net, struct nn_rng *rng);
+
 /* Run the input on the feedforward algorithm to calculate the output
  * inputs:	array of input values, assumed to be the same amount as
  * 		input_count as supplied to the nn_ffnet_create function
@@ -62,3 +183,401 @@ void nn_ffnet_randomize(struct nn_ffnet *net);
  * output_count as supplied to the nn_ffnet_create function
  */
 float *nn_ffnet_run(struct nn_ffnet *net, const float *inputs);
+
+/* Amount of floats needed for the scratch buffer of nn_ffnet_run_ex */
+size_t nn_ffnet_scratch_size(const struct nn_ffnet *net);
+
+/* Run the feedforward algorithm without touching the network itself so the
+ * same network can be run from multiple threads at the same time
+ * inputs:	array of input values, see nn_ffnet_run
+ * scratch:	array of at least nn_ffnet_scratch_size floats to store the
+ * 		activations in
+ *
+ * return the outputs as an array of floats inside of scratch
+ */
+float *nn_ffnet_run_ex(const struct nn_ffnet *net,
+		       const float *inputs,
+		       float *scratch);
+
+/* Amount of floats needed for the scratch buffer of nn_ffnet_run_batch, it
+ * doesn't depend on the amount of samples
+ */
+size_t nn_ffnet_batch_scratch_size(const struct nn_ffnet *net);
+
+/* Run the feedforward algorithm on multiple samples, they're processed in
+ * blocks so every weight is only loaded once per block instead of once per
+ * sample
+ * inputs:	nsamples arrays of input values stored after each other
+ * nsamples:	amount of samples
+ * outputs:	room for nsamples arrays of output values, stored in the same
+ * 		order as the inputs
+ * scratch:	array of at least nn_ffnet_batch_scratch_size floats, like
+ * 		nn_ffnet_run_ex the network itself isn't touched
+ */
+void nn_ffnet_run_batch(const struct nn_ffnet *net,
+			const float *inputs,
+			size_t nsamples,
+			float *outputs,
+			float *scratch);
+
+/* Run samples that are already stored per input with the value of every
+ * sample next to each other, like [ input0 sample0, input0 sample1.. ], so
+ * the same inputs can be used for multiple networks
+ * scratch:	(nn_ffnet_scratch_size - input_count) * nsamples floats
+ *
+ * return the outputs inside of scratch, stored per output like the inputs
+ */
+float *nn_ffnet_run_block(const struct nn_ffnet *net,
+			  const float *inputs,
+			  size_t nsamples,
+			  float *scratch);
+
+/* A connection between two nodes of a graph network, the nodes are numbered
+ * like this: [ input.., bias, output.., hidden.. ]
+ */
+struct nn_graphnet_edge{
+	size_t from, to;
+	float weight;
+};
+
+/* Sparse network with an arbitrary feedforward topology, the computed nodes
+ * are stored in topological order and grouped in levels that only depend on
+ * earlier levels, the incoming edges of every node are stored next to each
+ * other
+ */
+struct nn_graphnet{
+	size_t ninputs, nhiddens, noutputs, nedges;
+	size_t nlevels;
+
+	/* Position after the last hidden node of every level */
+	size_t *level_end;
+	/* Incoming edges of computed node i are edge_start[i] until
+	 * edge_start[i + 1]
+	 */
+	size_t *edge_start;
+	/* Position of the node value the edge reads from */
+	size_t *edge_source;
+	float *edge_weight;
+
+	float *output;
+
+	float bias;
+
+	enum nn_activation hidden_activation, output_activation;
+};
+
+/* Create a new graph network, the activation functions are set by default to
+ * NN_ACTIVATION_SIGMOID and the bias to -1.0 like nn_ffnet_create
+ * input_count:		amount of input nodes
+ * hidden_count:	amount of hidden nodes
+ * output_count:	amount of output nodes
+ * edges:		connections between the nodes, they can't form a cycle,
+ * 			go into an input or the bias or leave an output
+ * edge_count:		amount of edges
+ */
+struct nn_graphnet *nn_graphnet_create(size_t input_count,
+				       size_t hidden_count,
+				       size_t output_count,
+				       const struct nn_graphnet_edge *edges,
+				       size_t edge_count);
+
+/* Create a graph network with the same output as the feedforward network but
+ * without the weights that are too small to matter
+ * treshold:	weights with an absolute value up to this are left out
+ */
+struct nn_graphnet *nn_graphnet_from_ffnet(const struct nn_ffnet *net,
+					   float treshold);
+
+/* Deallocate the memory of the graph network */
+void nn_graphnet_destroy(struct nn_graphnet *net);
+
+/* Set the activation functions, see nn_ffnet_set_activations */
+void nn_graphnet_set_activations(struct nn_graphnet *net,
+				 enum nn_activation hidden,
+				 enum nn_activation output);
+
+/* Set the value of the bias node */
+void nn_graphnet_set_bias(struct nn_graphnet *net, float bias);
+
+/* Run the graph network, only the edges that exist are evaluated
+ * inputs:	array of input values, assumed to be input_count long
+ *
+ * return the outputs as an array of output_count floats
+ */
+float *nn_graphnet_run(struct nn_graphnet *net, const float *inputs);
+
+/* Amount of floats needed for the scratch buffer of nn_graphnet_run_ex */
+size_t nn_graphnet_scratch_size(const struct nn_graphnet *net);
+
+/* Run the graph network without touching the network itself, see
+ * nn_ffnet_run_ex
+ */
+float *nn_graphnet_run_ex(const struct nn_graphnet *net,
+			  const float *inputs,
+			  float *scratch);
+
+/* Recurrent network with layers like a feedforward network where every layer
+ * also reads its own values of the previous step. The network only holds the
+ * weights, the values of an episode are stored in a state buffer owned by the
+ * caller so many episodes can share the same network
+ */
+struct nn_rnet{
+	size_t ninputs, nhiddens, noutputs, nhidden_layers;
+	size_t nweights;
+
+	/* Every row of a layer starts with the weight of the bias node, then a
+	 * weight for every node of the previous layer and one for every node of
+	 * the layer itself
+	 */
+	float *weight;
+
+	float bias;
+
+	enum nn_activation hidden_activation, output_activation;
+};
+
+/* Create a new recurrent network, the arguments and defaults are the same as
+ * for nn_ffnet_create and all weights start at 0
+ */
+struct nn_rnet *nn_rnet_create(size_t input_count,
+			       size_t hidden_count,
+			       size_t output_count,
+			       size_t hidden_layer_count);
+
+/* Amount of weights of a recurrent network with the given sizes */
+size_t nn_rnet_weight_count(size_t input_count,
+			    size_t hidden_count,
+			    size_t output_count,
+			    size_t hidden_layer_count);
+
+/* Create a recurrent network that behaves like the feedforward network, the
+ * recurrent weights are 0
+ */
+struct nn_rnet *nn_rnet_from_ffnet(const struct nn_ffnet *net);
+
+/* Deallocate the memory of the recurrent network */
+void nn_rnet_destroy(struct nn_rnet *net);
+
+/* Set the activation functions, see nn_ffnet_set_activations */
+void nn_rnet_set_activations(struct nn_rnet *net,
+			     enum nn_activation hidden,
+			     enum nn_activation output);
+
+/* Set the value of the bias node */
+void nn_rnet_set_bias(struct nn_rnet *net, float bias);
+
+/* Set every weight to a random value between -0.5 and 0.5 */
+void nn_rnet_randomize_ex(struct nn_rnet *net, struct nn_rng *rng);
+
+/* Amount of floats in the state of an episode, an episode starts with all of
+ * them set to 0
+ */
+size_t nn_rnet_state_size(const struct nn_rnet *net);
+
+/* Advance an episode by one step, the network itself isn't touched so the
+ * same network can step multiple episodes from multiple threads at once
+ * state:	nn_rnet_state_size floats with the values of the last step
+ * inputs:	array of input_count values
+ *
+ * return the outputs as an array of floats inside of state
+ */
+float *nn_rnet_step(const struct nn_rnet *net,
+		    float *state,
+		    const float *inputs);
+
+/* Advance nepisodes episodes at once, every weight is loaded once for all of
+ * them. The states are stored per value with the value of every episode next
+ * to each other, like [ value0 episode0, value0 episode1.. ]
+ * states:	nn_rnet_state_size * nepisodes floats
+ * inputs:	nepisodes arrays of input values stored after each other
+ * outputs:	room for nepisodes arrays of output values, stored in the same
+ * 		order as the inputs
+ */
+void nn_rnet_step_batch(const struct nn_rnet *net,
+			float *states,
+			size_t nepisodes,
+			const float *inputs,
+			float *outputs);
+
+/* How the weights of a program are stored, the values are always floats */
+enum nn_precision{
+	NN_PRECISION_FLOAT,
+	/* The upper 16 bits of a float, same range with less precision */
+	NN_PRECISION_BF16,
+	/* Scaled to -127 until 127 per layer */
+	NN_PRECISION_INT8
+};
+
+/* Bytes of a single weight stored in the precision */
+size_t nn_precision_size(enum nn_precision precision);
+
+/* Store count weights in the precision, int8 weights are scaled so the biggest
+ * one uses the whole range
+ * output:	room for count weights of nn_precision_size bytes
+ *
+ * return the scale every stored weight has to be multiplied by, 1 unless the
+ * precision is NN_PRECISION_INT8
+ */
+float nn_precision_store(enum nn_precision precision,
+			 const float *weight,
+			 size_t count,
+			 void *output);
+
+/* Convert count weights stored with nn_precision_store back to floats */
+void nn_precision_load(enum nn_precision precision,
+		       const void *weight,
+		       size_t count,
+		       float scale,
+		       float *output);
+
+/* A bfloat16 is the upper half of a float, so converting it back only needs a
+ * shift which the compiler can vectorize
+ */
+static inline float nn_bf16_to_float(uint16_t value)
+{
+	uint32_t bits = (uint32_t)value << 16;
+
+	float result;
+	memcpy(&result, &bits, sizeof(float));
+
+	return result;
+}
+
+/* Round to the nearest bfloat16, ties go to the even one */
+static inline uint16_t nn_float_to_bf16(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(float));
+
+	bits += 0x7fff + ((bits >> 16) & 1);
+
+	return (uint16_t)(bits >> 16);
+}
+
+enum nn_opcode{
+	/* Weighted sums of a fully connected layer */
+	NN_OPCODE_DENSE,
+	/* Weighted sums of nodes with their own incoming edges */
+	NN_OPCODE_SPARSE,
+	/* Apply the activation function on the values */
+	NN_OPCODE_ACTIVATE
+};
+
+/* A single step of a program, all positions are indices in the values */
+struct nn_instruction{
+	enum nn_opcode opcode;
+	enum nn_activation activation;
+
+	/* The values written by the instruction */
+	size_t first, count;
+	/* Dense: the values read, every output has nsources + 1 weights
+	 * starting at weight, the first one belongs to the bias
+	 * Sparse: weight is the index in edge_start of the first output
+	 */
+	size_t source, nsources;
+	size_t weight;
+	/* Dense: multiplier of the int8 weights */
+	float scale;
+};
+
+/* A network lowered into a flat list of instructions, everything the run
+ * needs is computed once when it's compiled. The value after the inputs is
+ * the bias, the values look like this: [ input.., bias, computed.. ]
+ */
+struct nn_program{
+	size_t ninputs, noutputs, nvalues;
+	size_t ninstructions, nweights, nnodes, nedges;
+
+	/* Position of the first output in the values */
+	size_t output;
+	/* Value of the bias node, 1 unless the weights are stored elsewhere
+	 * since the bias of the network is folded into its own copy of them
+	 */
+	float bias;
+
+	struct nn_instruction *instruction;
+	/* Incoming edges of sparse node i are edge_start[i] until
+	 * edge_start[i + 1]
+	 */
+	size_t *edge_start;
+	size_t *edge_source;
+	float *edge_weight;
+
+	/* The dense weights, only the one of the precision is set. They're
+	 * behind the struct unless the program was compiled with
+	 * nn_program_from_ffnet_weights
+	 */
+	enum nn_precision precision;
+	float *weight;
+	uint16_t *weight_bf16;
+	int8_t *weight_int8;
+
+	float *value;
+};
+
+/* Compile the network into a program, the program doesn't depend on the
+ * network afterwards and has to be compiled again when it changes
+ */
+struct nn_program *nn_program_from_ffnet(const struct nn_ffnet *net);
+struct nn_program *nn_program_from_graphnet(const struct nn_graphnet *net);
+
+/* Compile the feedforward network with smaller weights, they take 2 or 4
+ * times less memory at the cost of accuracy
+ */
+struct nn_program *nn_program_from_ffnet_precision(const struct nn_ffnet *net,
+						   enum nn_precision precision);
+
+/* Compile only the topology of the network, the program runs on weights that
+ * are stored elsewhere in the order of the network and has to be compiled
+ * again when they move. Nothing is copied so this allocates only the
+ * instructions and values
+ * weight:	nn_ffnet_weight_count weights in the precision, they have to
+ * 		outlive the program
+ * scale:	multiplier of every int8 weight, see nn_precision_store
+ */
+struct nn_program *nn_program_from_ffnet_weights(const struct nn_ffnet *net,
+						 enum nn_precision precision,
+						 void *weight,
+						 float scale);
+
+/* Copy the program into a new one that has its own weights */
+struct nn_program *nn_program_copy(const struct nn_program *program);
+
+/* Deallocate the memory of the program */
+void nn_program_destroy(struct nn_program *program);
+
+/* Write the program as C source with the weights as constants, so it can be
+ * built into a program without this library. It defines this function:
+ * void name(const float *inputs, float *outputs)
+ * which is safe to call from multiple threads, the activations may differ
+ * slightly because the ones of libm are used
+ *
+ * return false when writing to the file failed
+ */
+bool nn_program_write_c(const struct nn_program *program,
+			FILE *file,
+			const char *name);
+
+/* Run the program, see nn_ffnet_run */
+float *nn_program_run(struct nn_program *program, const float *inputs);
+
+/* Amount of floats needed for the scratch buffer of nn_program_run_ex */
+size_t nn_program_scratch_size(const struct nn_program *program);
+
+/* Run the program without touching it, see nn_ffnet_run_ex, any amount of
+ * threads can run the same program at once with their own scratch buffers
+ */
+float *nn_program_run_ex(const struct nn_program *program,
+			 const float *inputs,
+			 float *scratch);
+
+/* Run samples that are stored per input like nn_ffnet_run_block does, every
+ * weight is loaded once for all of them
+ * scratch:	nn_program_scratch_size * nsamples floats
+ *
+ * return the outputs inside of scratch, stored per output like the inputs
+ */
+float *nn_program_run_block(const struct nn_program *program,
+			    const float *inputs,
+			    size_t nsamples,
+			    float *scratch);
@@ -0,0 +1,370 @@
+#include "population.h"
+
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+
+/* Samples of a block that every genome runs before the next block */
+#define NEAT_BACKEND_BLOCK_SAMPLES 64
+
+/* Scratch that is kept between the runs and only grows when a run needs
+ * more than before
+ */
+struct neat_scratch{
+	float *values;
+	size_t size;
+};
+
+static float *neat_scratch_reserve(struct neat_pop *p,
+				   struct neat_scratch *scratch,
+				   size_t size)
+{
+	if(size > scratch->size){
+		free(scratch->values);
+		scratch->values = malloc(sizeof(float) * size);
+		assert(scratch->values);
+		scratch->size = size;
+		NEAT_STATS_ADD(p, nallocations, 1);
+	}
+
+	return scratch->values;
+}
+
+/* Store the inputs per node once for all genomes, block by block */
+static const float *neat_store_blocks(struct neat_pop *p,
+				      struct neat_scratch *scratch,
+				      const float *inputs,
+				      size_t nsamples)
+{
+	size_t ninputs = p->conf.network_inputs;
+	float *blocks = neat_scratch_reserve(p,
+					     scratch,
+					     nsamples * ninputs + 1);
+	for(size_t first = 0;
+	    first < nsamples;
+	    first += NEAT_BACKEND_BLOCK_SAMPLES){
+		size_t block = nsamples - first;
+		if(block > NEAT_BACKEND_BLOCK_SAMPLES){
+			block = NEAT_BACKEND_BLOCK_SAMPLES;
+		}
+
+		const float *input = inputs + first * ninputs;
+		float *transposed = blocks + first * ninputs;
+		for(size_t i = 0; i < block; i++){
+			for(size_t j = 0; j < ninputs; j++){
+				transposed[j * block + i] =
+					input[i * ninputs + j];
+			}
+		}
+	}
+
+	return blocks;
+}
+
+/* Store the results of a block per sample again */
+static void neat_load_block(const float *result,
+			    size_t block,
+			    size_t noutputs,
+			    float *output)
+{
+	for(size_t i = 0; i < block; i++){
+		for(size_t j = 0; j < noutputs; j++){
+			output[i * noutputs + j] = result[j * block + i];
+		}
+	}
+}
+
+/* Networks with reduced weights run their compiled programs, which read the
+ * weights in that precision from the rows of the pool, block by block
+ */
+static void neat_run_programs(struct neat_scratch *blocks,
+			      struct neat_scratch *scratch,
+			      struct neat_pop *p,
+			      const float *inputs,
+			      size_t nsamples,
+			      float *outputs)
+{
+	size_t ninputs = p->conf.network_inputs;
+	size_t noutputs = p->conf.network_outputs;
+	int nthreads = neat_thread_count(p);
+
+	#pragma omp parallel for num_threads(nthreads)
+	for(size_t i = 0; i < p->ngenomes; i++){
+		if(p->genomes[i]->program == NULL){
+			NEAT_STATS_ADD(p, ncompilations, 1);
+		}
+		neat_genome_compile(p->genomes[i]);
+	}
+
+	size_t scratch_size = 0;
+	for(size_t i = 0; i < p->ngenomes; i++){
+		size_t size = nn_program_scratch_size(p->genomes[i]->program);
+		if(size > scratch_size){
+			scratch_size = size;
+		}
+	}
+	scratch_size *= NEAT_BACKEND_BLOCK_SAMPLES;
+	const float *transposed = neat_store_blocks(p,
+						    blocks,
+						    inputs,
+						    nsamples);
+	float *scratches = neat_scratch_reserve(p,
+						scratch,
+						scratch_size * nthreads);
+
+	#pragma omp parallel num_threads(nthreads)
+	{
+		float *values = scratches + scratch_size * omp_get_thread_num();
+
+		#pragma omp for schedule(dynamic, 16)
+		for(size_t i = 0; i < p->ngenomes; i++){
+			const struct nn_program *program =
+				p->genomes[i]->program;
+			float *genome_outputs =
+				outputs + i * nsamples * noutputs;
+
+			for(size_t first = 0;
+			    first < nsamples;
+			    first += NEAT_BACKEND_BLOCK_SAMPLES){
+				size_t block = nsamples - first;
+				if(block > NEAT_BACKEND_BLOCK_SAMPLES){
+					block = NEAT_BACKEND_BLOCK_SAMPLES;
+				}
+
+				float *result =
+					nn_program_run_block(program,
+							     transposed +
+							     first * ninputs,
+							     block,
+							     values);
+				neat_load_block(result,
+						block,
+						noutputs,
+						genome_outputs +
+						first * noutputs);
+			}
+		}
+	}
+}
+
+/* The inputs stored per node for the programs and the scratch of every
+ * thread
+ */
+struct neat_cpu{
+	struct neat_scratch blocks, scratch;
+};
+
+static void *neat_cpu_create(struct neat_pop *p)
+{
+	struct neat_cpu *cpu = calloc(1, sizeof(struct neat_cpu));
+	assert(cpu);
+
+	return cpu;
+}
+
+static void neat_cpu_destroy(void *state)
+{
+	struct neat_cpu *cpu = state;
+
+	free(cpu->blocks.values);
+	free(cpu->scratch.values);
+	free(cpu);
+}
+
+static void neat_cpu_run_batch(void *state,
+			       struct neat_pop *p,
+			       const float *inputs,
+			       size_t nsamples,
+			       float *outputs)
+{
+	struct neat_cpu *cpu = state;
+	size_t noutputs = p->conf.network_outputs;
+
+	if(p->conf.network_precision != NN_PRECISION_FLOAT){
+		neat_run_programs(&cpu->blocks,
+				  &cpu->scratch,
+				  p,
+				  inputs,
+				  nsamples,
+				  outputs);
+		return;
+	}
+
+	size_t scratch_size = 0;
+	for(size_t i = 0; i < p->ngenomes; i++){
+		size_t size = nn_ffnet_batch_scratch_size(p->genomes[i]->net);
+		if(size > scratch_size){
+			scratch_size = size;
+		}
+	}
+	int nthreads = neat_thread_count(p);
+	float *scratches = neat_scratch_reserve(p,
+						&cpu->scratch,
+						scratch_size * nthreads);
+
+	#pragma omp parallel num_threads(nthreads)
+	{
+		float *scratch = scratches +
+				 scratch_size * omp_get_thread_num();
+
+		#pragma omp for schedule(dynamic, 16)
+		for(size_t i = 0; i < p->ngenomes; i++){
+			nn_ffnet_run_batch(p->genomes[i]->net,
+					   inputs,
+					   nsamples,
+					   outputs + i * nsamples * noutputs,
+					   scratch);
+		}
+	}
+}
+
+/* The genomes are run straight from the weights tensor of the pool, which
+ * packed_weights keeps with a row for every genome. Only the versions are
+ * tracked to count the rows that changed since the last run
+ */
+struct neat_packed{
+	/* Version of the data of every genome at the last run, 0 if none */
+	uint64_t *versions;
+
+	/* Largest scratch size of the networks */
+	size_t nneurons;
+
+	/* The inputs stored per node and the scratch of every thread */
+	struct neat_scratch blocks, scratch;
+};
+
+static void *neat_packed_create(struct neat_pop *p)
+{
+	/* neat_create turns packed_weights on for this backend */
+	assert(p->pool->weights);
+
+	struct neat_packed *packed = calloc(1, sizeof(struct neat_packed));
+	assert(packed);
+
+	packed->versions = calloc(p->ngenomes, sizeof(uint64_t));
+	assert(packed->versions);
+
+	return packed;
+}
+
+static void neat_packed_destroy(void *state)
+{
+	struct neat_packed *packed = state;
+
+	free(packed->versions);
+	free(packed->blocks.values);
+	free(packed->scratch.values);
+	free(packed);
+}
+
+/* Count the rows an accelerator would have to copy again */
+static void neat_packed_update(struct neat_packed *packed, struct neat_pop *p)
+{
+	packed->nneurons = 0;
+	for(size_t i = 0; i < p->ngenomes; i++){
+		const struct neat_genome *genome = p->genomes[i];
+
+		if(packed->versions[i] != genome->data->version){
+			packed->versions[i] = genome->data->version;
+			NEAT_STATS_ADD(p, nuploads, 1);
+		}
+
+		if(genome->net->nneurons > packed->nneurons){
+			packed->nneurons = genome->net->nneurons;
+		}
+	}
+}
+
+static void neat_packed_run_batch(void *state,
+				  struct neat_pop *p,
+				  const float *inputs,
+				  size_t nsamples,
+				  float *outputs)
+{
+	struct neat_packed *packed = state;
+
+	neat_packed_update(packed, p);
+
+	/* Reduced rows are only read by the programs of the genomes */
+	if(p->conf.network_precision != NN_PRECISION_FLOAT){
+		neat_run_programs(&packed->blocks,
+				  &packed->scratch,
+				  p,
+				  inputs,
+				  nsamples,
+				  outputs);
+		return;
+	}
+
+	size_t ninputs = p->conf.network_inputs;
+	size_t noutputs = p->conf.network_outputs;
+	const float *blocks = neat_store_blocks(p,
+						&packed->blocks,
+						inputs,
+						nsamples);
+
+	size_t scratch_size = (packed->nneurons - ninputs) *
+			      NEAT_BACKEND_BLOCK_SAMPLES;
+	int nthreads = neat_thread_count(p);
+	float *scratches = neat_scratch_reserve(p,
+						&packed->scratch,
+						scratch_size * nthreads);
+
+	#pragma omp parallel num_threads(nthreads)
+	{
+		float *scratch = scratches +
+				 scratch_size * omp_get_thread_num();
+
+		#pragma omp for schedule(dynamic, 16)
+		for(size_t i = 0; i < p->ngenomes; i++){
+			const struct nn_ffnet *net = p->genomes[i]->net;
+			float *genome_outputs =
+				outputs + i * nsamples * noutputs;
+
+			for(size_t first = 0;
+			    first < nsamples;
+			    first += NEAT_BACKEND_BLOCK_SAMPLES){
+				size_t block = nsamples - first;
+				if(block > NEAT_BACKEND_BLOCK_SAMPLES){
+					block = NEAT_BACKEND_BLOCK_SAMPLES;
+				}
+
+				float *result =
+					nn_ffnet_run_block(net,
+							   blocks +
+							   first * ninputs,
+							   block,
+							   scratch);
+
+				neat_load_block(result,
+						block,
+						noutputs,
+						genome_outputs +
+						first * noutputs);
+			}
+		}
+	}
+}
+
+static const struct neat_backend_ops neat_backends[] = {
+	[NEAT_BACKEND_CPU] = {
+		.create = neat_cpu_create,
+		.destroy = neat_cpu_destroy,
+		.run_batch = neat_cpu_run_batch
+	},
+	[NEAT_BACKEND_PACKED] = {
+		.create = neat_packed_create,
+		.destroy = neat_packed_destroy,
+		.run_batch = neat_packed_run_batch
+	}
+};
+
+const struct neat_backend_ops *neat_get_backend(enum neat_backend backend)
+{
+	if(backend > NEAT_BACKEND_PACKED){
+		fprintf(stderr, "Backend \"%d\" not found\n", backend);
+		exit(-1);
+	}
+
+	return neat_backends + backend;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <neat.h>
+
+struct neat_pop;
+
+/* Runs the whole population at once, a backend can keep its own copy of the
+ * genomes as long as it brings it up to date before running them
+ */
+struct neat_backend_ops{
+	/* Called before the population has any genomes */
+	void *(*create)(struct neat_pop *p);
+	void (*destroy)(void *state);
+
+	/* See neat_run_batch */
+	void (*run_batch)(void *state,
+			  struct neat_pop *p,
+			  const float *inputs,
+			  size_t nsamples,
+			  float *outputs);
+};
+
+/* Exits the program when the backend doesn't exist */
+const struct neat_backend_ops *neat_get_backend(enum neat_backend backend);
@@ -0,0 +1,621 @@
+#include "population.h"
+
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define NEAT_IMAGE_MAGIC "NEATPOP"
+#define NEAT_IMAGE_VERSION 4
+/* Written in the native byte order to detect files from other machines */
+#define NEAT_IMAGE_BYTE_ORDER 0x01020304
+
+/* An image looks like this, every part starts on a multiple of
+ * NEAT_POOL_ALIGNMENT so the data blocks can be used as a pool straight from
+ * the mapped file:
+ * [ **header**, fitness.., time_alive.., species_of.., species_slot..,
+ *   genome_data.., species.., species_genomes.., data.., weights.. ]
+ * There is room for a data block for every genome, the unused ones are never
+ * written so they don't take space on disk. The weights are only there with
+ * packed_weights and have a row for every data block, stored in the
+ * precision of the networks
+ */
+struct neat_image_header{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t size_size, config_size, block_size, weight_stride;
+
+	struct neat_config conf;
+	uint64_t ngenomes, nspecies, ndata;
+	int64_t innovation;
+	uint64_t solved;
+	struct nn_rng rng;
+
+	/* Offsets of the parts from the start of the file */
+	uint64_t fitness, time_alive, species_of, species_slot;
+	uint64_t genome_data, species, species_genomes, data, weights;
+	uint64_t size;
+};
+
+struct neat_image_species{
+	uint64_t active, ngenomes;
+	double fitness_sum;
+};
+
+#define NEAT_MESSAGE_MAGIC "NEATGEN"
+#define NEAT_MESSAGE_VERSION 2
+
+/* A genome sent to another population, the packed genome follows the header:
+ * [ **header**, net.., innovation.. ]
+ */
+struct neat_message_header{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t size_size, size;
+
+	float fitness;
+};
+
+static uint64_t neat_image_align(uint64_t offset)
+{
+	return (offset + NEAT_POOL_ALIGNMENT - 1) /
+	       NEAT_POOL_ALIGNMENT * NEAT_POOL_ALIGNMENT;
+}
+
+/* Place a part of count elements of size bytes at the next aligned offset
+ * after *end and move *end behind it
+ *
+ * return false when the offsets don't fit in 64 bits
+ */
+static bool neat_image_place(uint64_t *end,
+			     uint64_t *offset,
+			     uint64_t count,
+			     uint64_t size)
+{
+	uint64_t bytes;
+	if(*end > UINT64_MAX - NEAT_POOL_ALIGNMENT ||
+	   __builtin_mul_overflow(count, size, &bytes)){
+		return false;
+	}
+
+	*offset = neat_image_align(*end);
+
+	return !__builtin_add_overflow(*offset, bytes, end);
+}
+
+/* Give every part a place after the previous one, the counts can come from
+ * an untrusted file
+ *
+ * return false when the image would be too big to address
+ */
+static bool neat_image_layout(struct neat_image_header *header,
+			      uint64_t nspecies_genomes)
+{
+	uint64_t n = header->ngenomes;
+	uint64_t end = sizeof(struct neat_image_header);
+
+	if(!neat_image_place(&end, &header->fitness, n, sizeof(float)) ||
+	   !neat_image_place(&end, &header->time_alive, n, sizeof(size_t)) ||
+	   !neat_image_place(&end, &header->species_of, n, sizeof(size_t)) ||
+	   !neat_image_place(&end, &header->species_slot, n, sizeof(size_t)) ||
+	   !neat_image_place(&end, &header->genome_data, n, sizeof(uint64_t)) ||
+	   !neat_image_place(&end,
+			     &header->species,
+			     header->nspecies,
+			     sizeof(struct neat_image_species)) ||
+	   !neat_image_place(&end,
+			     &header->species_genomes,
+			     nspecies_genomes,
+			     sizeof(size_t)) ||
+	   !neat_image_place(&end, &header->data, n, header->block_size) ||
+	   !neat_image_place(&end,
+			     &header->weights,
+			     n,
+			     header->weight_stride)){
+		return false;
+	}
+	header->size = end;
+
+	return true;
+}
+
+static bool neat_image_write(FILE *file,
+			     uint64_t offset,
+			     const void *data,
+			     size_t size)
+{
+	if(size == 0){
+		return true;
+	}
+
+	if(fseek(file, offset, SEEK_SET) != 0){
+		return false;
+	}
+
+	return fwrite(data, size, 1, file) == 1;
+}
+
+static size_t neat_data_index(const struct neat_pop *p,
+			      const struct neat_genome_data *data)
+{
+	const struct neat_pool *pool = p->pool->data;
+
+	return ((const char*)data - pool->memory) / pool->block_size;
+}
+
+bool neat_save(neat_t population, const char *path)
+{
+	struct neat_pop *p = population;
+	assert(p);
+	assert(path);
+
+	struct neat_image_header header;
+	memset(&header, 0, sizeof(struct neat_image_header));
+
+	memcpy(header.magic, NEAT_IMAGE_MAGIC, sizeof(header.magic));
+	header.version = NEAT_IMAGE_VERSION;
+	header.byte_order = NEAT_IMAGE_BYTE_ORDER;
+	header.size_size = sizeof(size_t);
+	header.config_size = sizeof(struct neat_config);
+	header.block_size = p->pool->data->block_size;
+	header.weight_stride = p->pool->weight_stride;
+
+	header.conf = p->conf;
+	header.ngenomes = p->ngenomes;
+	header.nspecies = p->nspecies;
+	header.innovation = p->innovation;
+	header.solved = p->solved;
+	header.rng = p->rngs[0];
+
+	/* Shared data is only stored once, the blocks are numbered in the order
+	 * they're first used so there are no gaps
+	 */
+	size_t nblocks = p->pool->data->nused;
+	size_t *new_index = malloc(sizeof(size_t) * (nblocks + 1));
+	uint64_t *genome_data = malloc(sizeof(uint64_t) * p->ngenomes);
+	const struct neat_genome_data **data =
+		malloc(sizeof(struct neat_genome_data*) * p->ngenomes);
+	assert(new_index && genome_data && data);
+	NEAT_STATS_ADD(p, nallocations, 3);
+
+	for(size_t i = 0; i < nblocks; i++){
+		new_index[i] = SIZE_MAX;
+	}
+	for(size_t i = 0; i < p->ngenomes; i++){
+		const struct neat_genome_data *block = p->genomes[i]->data;
+		size_t index = neat_data_index(p, block);
+
+		if(new_index[index] == SIZE_MAX){
+			new_index[index] = header.ndata;
+			data[header.ndata++] = block;
+		}
+		genome_data[i] = new_index[index];
+	}
+
+	size_t nspecies_genomes = 0;
+	struct neat_image_species *species =
+		malloc(sizeof(struct neat_image_species) * (p->nspecies + 1));
+	assert(species);
+	NEAT_STATS_ADD(p, nallocations, 1);
+	for(size_t i = 0; i < p->nspecies; i++){
+		species[i].active = p->species[i]->active;
+		species[i].ngenomes = p->species[i]->ngenomes;
+		species[i].fitness_sum = p->species[i]->fitness_sum;
+		nspecies_genomes += p->species[i]->ngenomes;
+	}
+
+	bool fits = neat_image_layout(&header, nspecies_genomes);
+	assert(fits);
+
+	FILE *file = fopen(path, "wb");
+	bool success = file != NULL;
+
+	size_t n = p->ngenomes;
+	if(success){
+		success =
+			neat_image_write(file, 0, &header, sizeof(header)) &&
+			neat_image_write(file, header.fitness, p->fitness,
+					 sizeof(float) * n) &&
+			neat_image_write(file, header.time_alive,
+					 p->time_alive, sizeof(size_t) * n) &&
+			neat_image_write(file, header.species_of,
+					 p->species_of, sizeof(size_t) * n) &&
+			neat_image_write(file, header.species_slot,
+					 p->species_slot, sizeof(size_t) * n) &&
+			neat_image_write(file, header.genome_data, genome_data,
+					 sizeof(uint64_t) * n) &&
+			neat_image_write(file, header.species, species,
+					 sizeof(struct neat_image_species) *
+					 p->nspecies);
+	}
+
+	uint64_t offset = header.species_genomes;
+	for(size_t i = 0; success && i < p->nspecies; i++){
+		size_t bytes = sizeof(size_t) * p->species[i]->ngenomes;
+		success = neat_image_write(file, offset,
+					   p->species[i]->genomes, bytes);
+		offset += bytes;
+	}
+
+	for(size_t i = 0; success && i < header.ndata; i++){
+		success = neat_image_write(file,
+					   header.data + i * header.block_size,
+					   data[i],
+					   header.block_size);
+	}
+
+	/* The rows are renumbered the same way as the blocks */
+	size_t row_size = header.weight_stride;
+	for(size_t i = 0; success && row_size > 0 && i < header.ndata; i++){
+		success = neat_image_write(file,
+					   header.weights + i * row_size,
+					   neat_genome_weight_row(p->pool,
+								  data[i]),
+					   row_size);
+	}
+
+	/* Extend the file with the room for the unused blocks */
+	if(success){
+		success = fflush(file) == 0 &&
+			  ftruncate(fileno(file), header.size) == 0;
+	}
+	if(file != NULL && fclose(file) != 0){
+		success = false;
+	}
+
+	free(new_index);
+	free(genome_data);
+	free(data);
+	free(species);
+
+	return success;
+}
+
+/* Any byte other than 0 or 1 isn't a bool, so it's read as a byte */
+static bool neat_image_bool_is_valid(const bool *value)
+{
+	unsigned char byte;
+	memcpy(&byte, value, sizeof(byte));
+
+	return byte <= 1;
+}
+
+/* Every genome listed in a species has to point back at its place in there,
+ * and the other way around, so they can be removed from it
+ */
+static bool neat_image_species_are_valid(const char *image)
+{
+	const struct neat_image_header *header = (const void*)image;
+	const struct neat_image_species *species =
+		(const void*)(image + header->species);
+	const size_t *species_genomes =
+		(const void*)(image + header->species_genomes);
+	const size_t *species_of = (const void*)(image + header->species_of);
+	const size_t *species_slot =
+		(const void*)(image + header->species_slot);
+
+	size_t *first = malloc(sizeof(size_t) * (header->nspecies + 1));
+	assert(first);
+
+	bool valid = true;
+	size_t next = 0;
+	for(size_t i = 0; valid && i < header->nspecies; i++){
+		first[i] = next;
+		for(size_t j = 0; valid && j < species[i].ngenomes; j++){
+			size_t genome_id = species_genomes[next++];
+			valid = genome_id < header->ngenomes &&
+				species_of[genome_id] == i &&
+				species_slot[genome_id] == j;
+		}
+	}
+
+	for(size_t i = 0; valid && i < header->ngenomes; i++){
+		size_t s = species_of[i];
+		if(s == NEAT_NO_SPECIES){
+			continue;
+		}
+
+		valid = s < header->nspecies &&
+			species_slot[i] < species[s].ngenomes &&
+			species_genomes[first[s] + species_slot[i]] == i;
+	}
+
+	free(first);
+
+	return valid;
+}
+
+/* Every block has to hold a network of the config and be referenced by as
+ * many genomes as its reference count says
+ */
+static bool neat_image_data_is_valid(const char *image)
+{
+	const struct neat_image_header *header = (const void*)image;
+	const uint64_t *genome_data =
+		(const void*)(image + header->genome_data);
+
+	size_t *references = calloc(header->ndata + 1, sizeof(size_t));
+	assert(references);
+
+	bool valid = true;
+	for(size_t i = 0; valid && i < header->ngenomes; i++){
+		valid = genome_data[i] < header->ndata;
+		if(valid){
+			references[genome_data[i]]++;
+		}
+	}
+
+	for(size_t i = 0; valid && i < header->ndata; i++){
+		const struct neat_genome_data *data =
+			(const void*)(image + header->data +
+				      i * header->block_size);
+		valid = data->references == references[i] &&
+			neat_genome_data_is_valid(header->conf, data);
+	}
+
+	free(references);
+
+	return valid;
+}
+
+/* Check everything the population depends on before anything is allocated,
+ * the file can be anything so every size is checked before it's used
+ */
+static bool neat_image_is_valid(const char *image, size_t size)
+{
+	const struct neat_image_header *header = (const void*)image;
+
+	if(size < sizeof(struct neat_image_header) ||
+	   memcmp(header->magic,
+		  NEAT_IMAGE_MAGIC,
+		  sizeof(header->magic)) != 0 ||
+	   header->version != NEAT_IMAGE_VERSION ||
+	   header->byte_order != NEAT_IMAGE_BYTE_ORDER ||
+	   header->size_size != sizeof(size_t) ||
+	   header->config_size != sizeof(struct neat_config)){
+		return false;
+	}
+
+	if(!neat_image_bool_is_valid(&header->conf.reset_on_extinction) ||
+	   !neat_image_bool_is_valid(&header->conf.packed_weights)){
+		return false;
+	}
+
+	/* The sizes computed from the config can't overflow once the biggest
+	 * genome fits in the file
+	 */
+	struct neat_config config = header->conf;
+	if(config.network_precision > NN_PRECISION_INT8 ||
+	   config.backend > NEAT_BACKEND_PACKED ||
+	   (config.backend == NEAT_BACKEND_PACKED && !config.packed_weights) ||
+	   (config.network_precision != NN_PRECISION_FLOAT &&
+	    !config.packed_weights) ||
+	   !neat_genome_config_fits(config, size)){
+		return false;
+	}
+
+	/* More threads than genomes can't be of use, only a corrupted count
+	 * asks for that many
+	 */
+	size_t n = header->ngenomes;
+	if(n == 0 || n != config.population_size ||
+	   config.evaluation_threads > n ||
+	   header->ndata > n ||
+	   header->block_size % NEAT_POOL_ALIGNMENT != 0 ||
+	   header->block_size < neat_genome_size(config) ||
+	   header->weight_stride != neat_genome_weight_stride(config) ||
+	   header->size != size){
+		return false;
+	}
+
+	/* The species have to be in the file before their sizes are read */
+	if(header->species % NEAT_POOL_ALIGNMENT != 0 ||
+	   header->species > size ||
+	   header->nspecies > (size - header->species) /
+			      sizeof(struct neat_image_species)){
+		return false;
+	}
+
+	/* A genome is in one species at most */
+	const struct neat_image_species *species =
+		(const void*)(image + header->species);
+	size_t nspecies_genomes = 0;
+	for(size_t i = 0; i < header->nspecies; i++){
+		if(species[i].ngenomes > n - nspecies_genomes){
+			return false;
+		}
+		nspecies_genomes += species[i].ngenomes;
+	}
+
+	/* The layout is only valid if it's the same as the one written, every
+	 * part is inside of the file after this
+	 */
+	struct neat_image_header layout = *header;
+	if(!neat_image_layout(&layout, nspecies_genomes) ||
+	   memcmp(&layout, header, sizeof(struct neat_image_header)) != 0){
+		return false;
+	}
+
+	return neat_image_species_are_valid(image) &&
+	       neat_image_data_is_valid(image);
+}
+
+neat_t neat_load(const char *path)
+{
+	assert(path);
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){
+		return NULL;
+	}
+
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size <= 0){
+		close(fd);
+		return NULL;
+	}
+	size_t size = info.st_size;
+
+	/* Private so the population can change the genomes in place without
+	 * touching the file
+	 */
+	char *image = mmap(NULL,
+			   size,
+			   PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE,
+			   fd,
+			   0);
+	close(fd);
+	if(image == MAP_FAILED){
+		return NULL;
+	}
+
+	if(!neat_image_is_valid(image, size)){
+		munmap(image, size);
+		return NULL;
+	}
+
+	const struct neat_image_header *header = (const void*)image;
+	struct neat_config config = header->conf;
+	size_t n = header->ngenomes;
+
+	void *weights = NULL;
+	if(config.packed_weights){
+		weights = image + header->weights;
+	}
+
+	struct neat_genome_pool *pool =
+		neat_genome_pool_create_in(config,
+					   n,
+					   image + header->data,
+					   header->block_size,
+					   header->ndata,
+					   weights);
+	struct neat_pop *p = neat_alloc_population(config, pool);
+	p->image = image;
+	p->image_size = size;
+
+	p->solved = header->solved;
+	p->innovation = header->innovation;
+	neat_seed_rngs(p, header->rng);
+
+	memcpy(p->fitness, image + header->fitness, sizeof(float) * n);
+	memcpy(p->time_alive, image + header->time_alive, sizeof(size_t) * n);
+	memcpy(p->species_of, image + header->species_of, sizeof(size_t) * n);
+	memcpy(p->species_slot,
+	       image + header->species_slot,
+	       sizeof(size_t) * n);
+
+	/* Only the pointers inside of the data have to be fixed */
+	const uint64_t *genome_data =
+		(const void*)(image + header->genome_data);
+	for(size_t i = 0; i < n; i++){
+		char *data = image + header->data +
+			     genome_data[i] * header->block_size;
+		p->genomes[i] = neat_genome_load(pool, config, (void*)data);
+	}
+
+	const struct neat_image_species *species =
+		(const void*)(image + header->species);
+	const size_t *species_genomes =
+		(const void*)(image + header->species_genomes);
+	for(size_t i = 0; i < header->nspecies; i++){
+		struct neat_species *s = neat_create_new_species(p);
+
+		s->active = species[i].active;
+		s->fitness_sum = species[i].fitness_sum;
+
+		/* Species that died out don't have any room */
+		if(species[i].ngenomes > 0){
+			neat_species_reserve(s, species[i].ngenomes);
+			s->ngenomes = species[i].ngenomes;
+			memcpy(s->genomes,
+			       species_genomes,
+			       sizeof(size_t) * s->ngenomes);
+		}
+
+		species_genomes += s->ngenomes;
+	}
+
+	return p;
+}
+
+size_t neat_genome_message_size(neat_t population)
+{
+	struct neat_pop *p = population;
+	assert(p);
+
+	return sizeof(struct neat_message_header) +
+	       neat_genome_max_pack_size(p->conf);
+}
+
+size_t neat_write_genome(neat_t population,
+			 size_t genome_id,
+			 void *message,
+			 size_t size)
+{
+	struct neat_pop *p = population;
+	assert(p);
+	assert(genome_id < p->ngenomes);
+	assert(message);
+
+	/* The genome can be replaced by an epoch of another thread */
+	omp_set_lock(&p->lock);
+
+	const struct neat_genome *genome = p->genomes[genome_id];
+	size_t packed_size = neat_genome_pack_size(genome);
+	if(size < sizeof(struct neat_message_header) + packed_size){
+		omp_unset_lock(&p->lock);
+		return 0;
+	}
+
+	struct neat_message_header header;
+	memset(&header, 0, sizeof(struct neat_message_header));
+
+	memcpy(header.magic, NEAT_MESSAGE_MAGIC, sizeof(header.magic));
+	header.version = NEAT_MESSAGE_VERSION;
+	header.byte_order = NEAT_IMAGE_BYTE_ORDER;
+	header.size_size = sizeof(size_t);
+	header.size = packed_size;
+	header.fitness = p->fitness[genome_id];
+
+	memcpy(message, &header, sizeof(struct neat_message_header));
+	neat_genome_pack(genome, (char*)message + sizeof(header));
+
+	omp_unset_lock(&p->lock);
+
+	return sizeof(struct neat_message_header) + packed_size;
+}
+
+bool neat_read_genome(neat_t population, const void *message, size_t size)
+{
+	struct neat_pop *p = population;
+	assert(p);
+	assert(message);
+
+	struct neat_message_header header;
+	if(size < sizeof(struct neat_message_header)){
+		return false;
+	}
+	memcpy(&header, message, sizeof(struct neat_message_header));
+
+	if(memcmp(header.magic,
+		  NEAT_MESSAGE_MAGIC,
+		  sizeof(header.magic)) != 0 ||
+	   header.version != NEAT_MESSAGE_VERSION ||
+	   header.byte_order != NEAT_IMAGE_BYTE_ORDER ||
+	   header.size_size != sizeof(size_t) ||
+	   header.size != size - sizeof(struct neat_message_header)){
+		return false;
+	}
+
+	return neat_insert_genome(p,
+				  (const char*)message + sizeof(header),
+				  header.size,
+				  header.fitness);
+}
@@ -1,57 +1,781 @@
 #include "genome.h"
 
+#include <stddef.h>
+#include <limits.h>
+#include <stdint.h>
 #include <string.h>
+#include <math.h>
 #include <assert.h>
 
-struct neat_genome *neat_genome_create(struct neat_config config,
+/* Weights of the excess, disjoint and weight difference terms of the distance
+ * as used in the original NEAT paper
+ */
+#define NEAT_EXCESS_COEFFICIENT 1.0f
+#define NEAT_DISJOINT_COEFFICIENT 1.0f
+#define NEAT_WEIGHT_COEFFICIENT 0.4f
+
+/* Genomes with fewer weights that aren't zero than this fraction are compiled
+ * into a sparse program, reading the source of every edge costs about as much
+ * as a few multiplications of a dense row. Added nodes start with zero
+ * weights so young topologies are often that sparse
+ */
+#define NEAT_SPARSE_DENSITY 0.3f
+
+/* A data block looks like this, the weights are in the tensor of the pool
+ * instead with packed_weights and only there with a reduced precision:
+ * [ **struct neat_genome_data**, **struct nn_ffnet**, weight.., neuron..,
+ *   innovation.. ]
+ */
+static size_t neat_genome_net_offset(void)
+{
+	/* Keep the network aligned like a malloc'd one would be */
+	size_t align = sizeof(max_align_t);
+
+	return (sizeof(struct neat_genome_data) + align - 1) / align * align;
+}
+
+static void neat_genome_set_innovations(struct neat_genome *genome)
+{
+	assert(genome);
+
+	genome->innovations = (int*)((char*)genome->net +
+				     nn_ffnet_bytes(genome->net));
+}
+
+/* Point the network at the row of the data, reduced weights are left out of
+ * it since it only knows floats
+ */
+static void neat_genome_set_weights(struct neat_genome_pool *pool,
+				    struct neat_genome *genome)
+{
+	genome->reduced_weights = NULL;
+	if(pool->weights == NULL){
+		return;
+	}
+
+	void *row = neat_genome_weight_row(pool, genome->data);
+	if(genome->precision == NN_PRECISION_FLOAT){
+		genome->net->weight = row;
+	}else{
+		genome->net->weight = NULL;
+		genome->reduced_weights = row;
+	}
+}
+
+/* Weight i of the genome, whatever precision it's stored in */
+static inline float neat_genome_weight(const struct neat_genome *genome,
+				       size_t i)
+{
+	const void *weights = genome->reduced_weights;
+	if(weights == NULL){
+		return genome->net->weight[i];
+	}
+
+	if(genome->precision == NN_PRECISION_BF16){
+		return nn_bf16_to_float(((const uint16_t*)weights)[i]);
+	}
+
+	return ((const int8_t*)weights)[i] * genome->data->scale;
+}
+
+/* The weights of the genome as floats that can be changed in place, reduced
+ * ones are converted into a buffer of nweights floats first and have to be
+ * stored again with neat_genome_store_weights
+ */
+static float *neat_genome_weights(const struct neat_genome *genome,
+				  float *buffer)
+{
+	if(genome->reduced_weights == NULL){
+		return genome->net->weight;
+	}
+
+	nn_precision_load(genome->precision,
+			  genome->reduced_weights,
+			  genome->net->nweights,
+			  genome->data->scale,
+			  buffer);
+
+	return buffer;
+}
+
+static void neat_genome_store_weights(struct neat_genome *genome,
+				      const float *weight)
+{
+	if(genome->reduced_weights != NULL){
+		genome->data->scale =
+			nn_precision_store(genome->precision,
+					   weight,
+					   genome->net->nweights,
+					   genome->reduced_weights);
+	}
+}
+
+struct neat_genome_pool *neat_genome_pool_create(struct neat_config config,
+						 size_t ngenomes)
+{
+	struct neat_genome_pool *pool = malloc(sizeof(struct neat_genome_pool));
+	assert(pool);
+
+	pool->genomes = neat_pool_create(sizeof(struct neat_genome), ngenomes);
+	pool->data = neat_pool_create(neat_genome_size(config), ngenomes);
+	pool->next_version = 1;
+
+	pool->weight_stride = neat_genome_weight_stride(config);
+	pool->weights = NULL;
+	pool->owns_weights = false;
+	if(config.packed_weights){
+		pool->weights = aligned_alloc(NEAT_POOL_ALIGNMENT,
+					      pool->weight_stride * ngenomes);
+		assert(pool->weights);
+		pool->owns_weights = true;
+	}
+
+	return pool;
+}
+
+struct neat_genome_pool *neat_genome_pool_create_in(struct neat_config config,
+						    size_t ngenomes,
+						    void *data,
+						    size_t block_size,
+						    size_t ndata,
+						    void *weights)
+{
+	assert(neat_genome_size(config) <= block_size);
+	assert((weights != NULL) == config.packed_weights);
+	assert((uintptr_t)weights % NEAT_POOL_ALIGNMENT == 0);
+
+	struct neat_genome_pool *pool = malloc(sizeof(struct neat_genome_pool));
+	assert(pool);
+
+	pool->genomes = neat_pool_create(sizeof(struct neat_genome), ngenomes);
+	pool->data = neat_pool_create_in(data, block_size, ngenomes, ndata);
+	/* Raised past the versions of the loaded data by neat_genome_load */
+	pool->next_version = 1;
+
+	pool->weight_stride = neat_genome_weight_stride(config);
+	pool->weights = weights;
+	pool->owns_weights = false;
+
+	return pool;
+}
+
+void neat_genome_pool_destroy(struct neat_genome_pool *pool)
+{
+	assert(pool);
+
+	neat_pool_destroy(pool->genomes);
+	neat_pool_destroy(pool->data);
+	if(pool->owns_weights){
+		free(pool->weights);
+	}
+	free(pool);
+}
+
+/* Genomes start without any hidden nodes and can grow to the hidden layers
+ * of the config
+ */
+static void neat_genome_max_topology(struct neat_config config,
+				     size_t *hiddens,
+				     size_t *layers)
+{
+	*hiddens = 0;
+	*layers = 0;
+	if(config.network_hidden_nodes > 0 && config.network_hidden_layers > 0){
+		*hiddens = config.network_hidden_nodes;
+		*layers = config.network_hidden_layers;
+	}
+}
+
+/* Bytes of the network & amount of weights of the biggest topology allowed by
+ * the config
+ */
+static void neat_genome_max_sizes(struct neat_config config,
+				  bool external_weights,
+				  size_t *net_bytes,
+				  size_t *nweights)
+{
+	size_t inputs = config.network_inputs;
+	size_t outputs = config.network_outputs;
+
+	size_t hiddens, layers;
+	neat_genome_max_topology(config, &hiddens, &layers);
+
+	/* Both only grow with the amount of hidden nodes & layers */
+	*nweights = nn_ffnet_weight_count(inputs, hiddens, outputs, layers);
+	if(external_weights){
+		*net_bytes = nn_ffnet_size_external(inputs,
+						    hiddens,
+						    outputs,
+						    layers);
+	}else{
+		*net_bytes = nn_ffnet_size(inputs, hiddens, outputs, layers);
+	}
+}
+
+size_t neat_genome_size(struct neat_config config)
+{
+	size_t net_bytes, nweights;
+	neat_genome_max_sizes(config,
+			      config.packed_weights,
+			      &net_bytes,
+			      &nweights);
+
+	return neat_genome_net_offset() + net_bytes + sizeof(int) * nweights;
+}
+
+/* total += count * size, false when it doesn't fit in a size_t */
+static bool neat_genome_add_product(size_t *total, size_t count, size_t size)
+{
+	size_t product;
+
+	return !__builtin_mul_overflow(count, size, &product) &&
+	       !__builtin_add_overflow(*total, product, total);
+}
+
+bool neat_genome_config_fits(struct neat_config config, size_t size)
+{
+	size_t inputs = config.network_inputs;
+	size_t outputs = config.network_outputs;
+
+	size_t hiddens, layers;
+	neat_genome_max_topology(config, &hiddens, &layers);
+
+	/* Every node takes more than a byte, so the sums below can't wrap */
+	if(inputs == 0 || outputs == 0 ||
+	   inputs > size || outputs > size || hiddens > size){
+		return false;
+	}
+
+	/* The same sums as nn_ffnet_weight_count and nn_ffnet_size, every term
+	 * is checked on its own
+	 */
+	size_t nweights = 0;
+	size_t last = inputs;
+	if(layers > 0){
+		size_t internal = 0;
+		if(!neat_genome_add_product(&nweights, inputs + 1, hiddens) ||
+		   !neat_genome_add_product(&internal,
+					    layers - 1,
+					    hiddens + 1) ||
+		   !neat_genome_add_product(&nweights, internal, hiddens)){
+			return false;
+		}
+		last = hiddens;
+	}
+	if(!neat_genome_add_product(&nweights, last + 1, outputs)){
+		return false;
+	}
+
+	size_t nneurons = inputs + outputs;
+	size_t bytes = neat_genome_net_offset() + sizeof(struct nn_ffnet);
+	return neat_genome_add_product(&nneurons, hiddens, layers) &&
+	       neat_genome_add_product(&bytes, nneurons, sizeof(float)) &&
+	       neat_genome_add_product(&bytes, nweights, sizeof(float)) &&
+	       neat_genome_add_product(&bytes, nweights, sizeof(int)) &&
+	       bytes <= size;
+}
+
+size_t neat_genome_weight_stride(struct neat_config config)
+{
+	if(!config.packed_weights){
+		return 0;
+	}
+
+	size_t net_bytes, nweights;
+	neat_genome_max_sizes(config, true, &net_bytes, &nweights);
+
+	size_t bytes = nn_precision_size(config.network_precision) * nweights;
+	return (bytes + NEAT_POOL_ALIGNMENT - 1) /
+	       NEAT_POOL_ALIGNMENT * NEAT_POOL_ALIGNMENT;
+}
+
+void *neat_genome_weight_row(const struct neat_genome_pool *pool,
+			     const struct neat_genome_data *data)
+{
+	assert(pool);
+	assert(pool->weights);
+	assert(data);
+
+	size_t index = ((const char*)data - pool->data->memory) /
+		       pool->data->block_size;
+
+	return (char*)pool->weights + index * pool->weight_stride;
+}
+
+/* The place of a weight is given by the layer it goes to, its target and its
+ * source. Weights to the outputs get a different place for every amount of
+ * hidden layers in front of them since they come from other nodes:
+ * [ hidden layer.., outputs without hidden layers, outputs behind 1 hidden
+ *   layer.. ]
+ */
+static void neat_genome_number_weights(struct neat_config config,
+				       struct neat_genome *genome,
 				       int innovation)
 {
+	const struct nn_ffnet *net = genome->net;
+
+	size_t max_hiddens, max_layers;
+	neat_genome_max_topology(config, &max_hiddens, &max_layers);
+	size_t max_targets = net->noutputs > max_hiddens ? net->noutputs :
+							    max_hiddens;
+	size_t max_sources = net->ninputs > max_hiddens ? net->ninputs :
+							   max_hiddens;
+	size_t row_size = max_sources + 1;
+
+	/* Every place must have a number */
+	assert((2 * max_layers + 1) * max_targets * row_size <=
+	       (size_t)(INT_MAX - innovation));
+
+	int *next = genome->innovations;
+	size_t nlayers = net->nhidden_layers + 1;
+	for(size_t i = 0; i < nlayers; i++){
+		bool output_layer = i == nlayers - 1;
+		size_t nsources = i == 0 ? net->ninputs : net->nhiddens;
+		size_t ntargets = output_layer ? net->noutputs : net->nhiddens;
+
+		size_t block = i;
+		if(output_layer){
+			block = max_layers + net->nhidden_layers;
+		}
+
+		for(size_t j = 0; j < ntargets; j++){
+			int first = innovation +
+				    (int)((block * max_targets + j) * row_size);
+			for(size_t k = 0; k <= nsources; k++){
+				*next++ = first + (int)k;
+			}
+		}
+	}
+	assert(next - genome->innovations == net->nweights);
+}
+
+struct neat_genome *neat_genome_create(struct neat_genome_pool *pool,
+				       struct neat_config config,
+				       int innovation)
+{
+	assert(pool);
 	assert(innovation > 0);
+	assert(neat_genome_size(config) <= pool->data->block_size);
 
-	struct neat_genome *genome = calloc(1, sizeof(struct neat_genome));
-	assert(genome);
+	struct neat_genome *genome = neat_pool_alloc(pool->genomes);
+	memset(genome, 0, sizeof(struct neat_genome));
+
+	genome->precision = config.network_precision;
 
-	genome->net = nn_ffnet_create(config.network_inputs,
-				      0,
-				      config.network_outputs,
-				      0);
+	genome->data = neat_pool_alloc(pool->data);
+	genome->data->references = 1;
+	genome->data->version = pool->next_version++;
+	genome->data->scale = 1.0f;
+
+	void *memory = (char*)genome->data + neat_genome_net_offset();
+	if(pool->weights != NULL){
+		/* Reduced weights are cleared below */
+		float *row = NULL;
+		if(genome->precision == NN_PRECISION_FLOAT){
+			row = neat_genome_weight_row(pool, genome->data);
+		}
+		genome->net = nn_ffnet_init_external(memory,
+						     row,
+						     config.network_inputs,
+						     0,
+						     config.network_outputs,
+						     0);
+	}else{
+		genome->net = nn_ffnet_init(memory,
+					    config.network_inputs,
+					    0,
+					    config.network_outputs,
+					    0);
+	}
 
 	nn_ffnet_set_activations(genome->net,
 				 NN_ACTIVATION_RELU,
 				 NN_ACTIVATION_RELU);
 
-	genome->innovations = malloc(sizeof(int) * genome->net->nweights);
-	assert(genome->innovations);
-	for(size_t i = 0; i < genome->net->nweights; i++){
-		genome->innovations[i] = innovation;
+	neat_genome_set_weights(pool, genome);
+	if(genome->reduced_weights != NULL){
+		memset(genome->reduced_weights,
+		       0,
+		       nn_precision_size(genome->precision) *
+		       genome->net->nweights);
 	}
 
+	neat_genome_set_innovations(genome);
+	neat_genome_number_weights(config, genome, innovation);
+
 	return genome;
 }
 
-struct neat_genome *neat_genome_copy(const struct neat_genome *genome)
+struct neat_genome *neat_genome_copy(struct neat_genome_pool *pool,
+				     const struct neat_genome *genome)
 {
-	struct neat_genome *new = malloc(sizeof(struct neat_genome));
-	assert(new);
-
-	memcpy(new, genome, sizeof(struct neat_genome));
+	assert(pool);
+	assert(genome);
 
-	new->net = nn_ffnet_copy(genome->net);
+	struct neat_genome *new = neat_pool_alloc(pool->genomes);
 
-	size_t bytes = sizeof(int) * genome->net->nweights;
-	new->innovations = malloc(bytes);
-	memcpy(new->innovations, genome->innovations, bytes);
+	/* The program of the original isn't read, a worker can be compiling
+	 * it in neat_run while the genome is copied. The copy compiles its
+	 * own when it is run
+	 */
+	*new = (struct neat_genome){
+		.data = genome->data,
+		.net = genome->net,
+		.innovations = genome->innovations,
+		.program = NULL,
+		.precision = genome->precision,
+		.reduced_weights = genome->reduced_weights
+	};
+	new->data->references++;
 
 	return new;
 }
 
-void neat_genome_destroy(struct neat_genome *genome)
+struct neat_genome *neat_genome_load(struct neat_genome_pool *pool,
+				     struct neat_config config,
+				     struct neat_genome_data *data)
+{
+	assert(pool);
+	assert(data);
+	assert(data->references > 0);
+
+	struct neat_genome *genome = neat_pool_alloc(pool->genomes);
+	memset(genome, 0, sizeof(struct neat_genome));
+
+	genome->precision = config.network_precision;
+
+	genome->data = data;
+	genome->net = (struct nn_ffnet*)((char*)data +
+					 neat_genome_net_offset());
+	nn_ffnet_relocate(genome->net);
+	neat_genome_set_weights(pool, genome);
+
+	if(data->version >= pool->next_version){
+		pool->next_version = data->version + 1;
+	}
+
+	neat_genome_set_innovations(genome);
+
+	return genome;
+}
+
+size_t neat_genome_pack_size(const struct neat_genome *genome)
+{
+	assert(genome);
+
+	const struct nn_ffnet *net = genome->net;
+
+	return nn_ffnet_size(net->ninputs,
+			     net->nhiddens,
+			     net->noutputs,
+			     net->nhidden_layers) +
+	       sizeof(int) * net->nweights;
+}
+
+size_t neat_genome_max_pack_size(struct neat_config config)
+{
+	size_t net_bytes, nweights;
+	neat_genome_max_sizes(config, false, &net_bytes, &nweights);
+
+	return net_bytes + sizeof(int) * nweights;
+}
+
+/* A packed genome looks like a network that stores its own weights:
+ * [ **struct nn_ffnet**, weight.., neuron.., innovation.. ]
+ */
+void neat_genome_pack(const struct neat_genome *genome, void *buffer)
+{
+	assert(genome);
+	assert(buffer);
+
+	const struct nn_ffnet *net = genome->net;
+	struct nn_ffnet header = *net;
+	header.external_weights = false;
+
+	char *next = buffer;
+	memcpy(next, &header, sizeof(struct nn_ffnet));
+	next += sizeof(struct nn_ffnet);
+	for(size_t i = 0; i < net->nweights; i++){
+		float weight = neat_genome_weight(genome, i);
+		memcpy(next, &weight, sizeof(float));
+		next += sizeof(float);
+	}
+	memcpy(next, net->output, sizeof(float) * net->nneurons);
+	next += sizeof(float) * net->nneurons;
+	memcpy(next, genome->innovations, sizeof(int) * net->nweights);
+}
+
+/* Check the header of a network from an untrusted source against the config,
+ * everything behind it fits the biggest genome once this holds
+ */
+static bool neat_genome_net_is_valid(struct neat_config config,
+				     const struct nn_ffnet *net,
+				     bool external_weights)
+{
+	/* Read as a byte, it doesn't have to hold a valid bool */
+	unsigned char external;
+	memcpy(&external, &net->external_weights, sizeof(external));
+
+	if(net->ninputs != config.network_inputs ||
+	   net->noutputs != config.network_outputs ||
+	   net->nhiddens > config.network_hidden_nodes ||
+	   net->nhidden_layers > config.network_hidden_layers ||
+	   (net->nhiddens > 0) != (net->nhidden_layers > 0) ||
+	   external != external_weights ||
+	   net->hidden_activation > NN_ACTIVATION_RELU ||
+	   net->output_activation > NN_ACTIVATION_RELU){
+		return false;
+	}
+
+	size_t nweights = nn_ffnet_weight_count(net->ninputs,
+						net->nhiddens,
+						net->noutputs,
+						net->nhidden_layers);
+	size_t bytes;
+	if(external_weights){
+		bytes = nn_ffnet_size_external(net->ninputs,
+					       net->nhiddens,
+					       net->noutputs,
+					       net->nhidden_layers);
+	}else{
+		bytes = nn_ffnet_size(net->ninputs,
+				      net->nhiddens,
+				      net->noutputs,
+				      net->nhidden_layers);
+	}
+
+	return net->nweights == nweights && nn_ffnet_bytes(net) == bytes;
+}
+
+/* Distances rely on the order of the innovations, they don't have to be
+ * aligned
+ */
+static bool neat_genome_innovations_are_sorted(const void *innovations,
+					       size_t count)
+{
+	int previous = 0;
+	for(size_t i = 0; i < count; i++){
+		int innovation;
+		memcpy(&innovation,
+		       (const char*)innovations + sizeof(int) * i,
+		       sizeof(int));
+		if(innovation <= previous){
+			return false;
+		}
+		previous = innovation;
+	}
+
+	return true;
+}
+
+bool neat_genome_can_unpack(const struct neat_genome_pool *pool,
+			    struct neat_config config,
+			    const void *buffer,
+			    size_t size)
 {
+	assert(pool);
+	assert(buffer);
+
+	if(size < sizeof(struct nn_ffnet) ||
+	   size > neat_genome_max_pack_size(config)){
+		return false;
+	}
+
+	/* The buffer doesn't have to be aligned */
+	struct nn_ffnet net;
+	memcpy(&net, buffer, sizeof(struct nn_ffnet));
+
+	if(!neat_genome_net_is_valid(config, &net, false)){
+		return false;
+	}
+
+	size_t bytes = nn_ffnet_bytes(&net);
+	if(size != bytes + sizeof(int) * net.nweights){
+		return false;
+	}
+
+	return neat_genome_innovations_are_sorted((const char*)buffer + bytes,
+						  net.nweights);
+}
+
+bool neat_genome_data_is_valid(struct neat_config config,
+			       const struct neat_genome_data *data)
+{
+	assert(data);
+
+	const struct nn_ffnet *net =
+		(const void*)((const char*)data + neat_genome_net_offset());
+	if(data->references == 0 ||
+	   !neat_genome_net_is_valid(config, net, config.packed_weights)){
+		return false;
+	}
+
+	return neat_genome_innovations_are_sorted((const char*)net +
+						  nn_ffnet_bytes(net),
+						  net->nweights);
+}
+
+struct neat_genome *neat_genome_unpack(struct neat_genome_pool *pool,
+				       struct neat_config config,
+				       const void *buffer,
+				       size_t size)
+{
+	assert(pool);
+	assert(neat_genome_can_unpack(pool, config, buffer, size));
+
+	struct neat_genome_data *data = neat_pool_alloc(pool->data);
+	data->references = 1;
+	data->version = pool->next_version++;
+	data->scale = 1.0f;
+
+	char *memory = (char*)data + neat_genome_net_offset();
+	if(pool->weights == NULL){
+		memcpy(memory, buffer, size);
+	}else{
+		/* Move the weights to the tensor and the rest up to the net */
+		const char *packed = buffer;
+		struct nn_ffnet *net = (struct nn_ffnet*)memory;
+		memcpy(net, packed, sizeof(struct nn_ffnet));
+		net->external_weights = true;
+		packed += sizeof(struct nn_ffnet);
+
+		size_t weight_bytes = sizeof(float) * net->nweights;
+		void *row = neat_genome_weight_row(pool, data);
+		enum nn_precision precision = config.network_precision;
+		if(precision == NN_PRECISION_FLOAT){
+			memcpy(row, packed, weight_bytes);
+		}else{
+			/* Convert them in the room of the innovations, which
+			 * is aligned and as big, before those are copied
+			 */
+			float *weight = (float*)(memory + nn_ffnet_bytes(net));
+			memcpy(weight, packed, weight_bytes);
+			data->scale = nn_precision_store(precision,
+							 weight,
+							 net->nweights,
+							 row);
+		}
+		memcpy(net + 1,
+		       packed + weight_bytes,
+		       size - sizeof(struct nn_ffnet) - weight_bytes);
+	}
+
+	return neat_genome_load(pool, config, data);
+}
+
+static void neat_genome_release_data(struct neat_genome_pool *pool,
+				     struct neat_genome_data *data)
+{
+	assert(data->references > 0);
+
+	if(--data->references == 0){
+		neat_pool_free(pool->data, data);
+	}
+}
+
+void neat_genome_destroy(struct neat_genome_pool *pool,
+			 struct neat_genome *genome)
+{
+	assert(pool);
 	assert(genome);
 
-	nn_ffnet_destroy(genome->net);
-	free(genome->innovations);
-	free(genome);
+	neat_genome_invalidate(genome);
+	neat_genome_release_data(pool, genome->data);
+
+	neat_pool_free(pool->genomes, genome);
+}
+
+void neat_genome_make_unique(struct neat_genome_pool *pool,
+			     struct neat_genome *genome)
+{
+	assert(pool);
+	assert(genome);
+
+	neat_genome_invalidate(genome);
+
+	if(genome->data->references == 1){
+		genome->data->version = pool->next_version++;
+		return;
+	}
+
+	struct neat_genome_data *old = genome->data;
+	struct neat_genome_data *data = neat_pool_alloc(pool->data);
+	data->references = 1;
+	data->version = pool->next_version++;
+	data->scale = old->scale;
+
+	const int *innovations = genome->innovations;
+	genome->data = data;
+	genome->net = nn_ffnet_copy_into((char*)data + neat_genome_net_offset(),
+					 genome->net);
+	/* The copy still shares the weights of the old row */
+	if(pool->weights != NULL){
+		memcpy(neat_genome_weight_row(pool, data),
+		       neat_genome_weight_row(pool, old),
+		       nn_precision_size(genome->precision) *
+		       genome->net->nweights);
+		neat_genome_set_weights(pool, genome);
+	}
+	neat_genome_set_innovations(genome);
+	memcpy(genome->innovations,
+	       innovations,
+	       sizeof(int) * genome->net->nweights);
+
+	neat_genome_release_data(pool, old);
+}
+
+struct nn_program *neat_genome_program(const struct neat_genome *genome)
+{
+	assert(genome);
+
+	const struct nn_ffnet *net = genome->net;
+
+	/* The row already has the weights in the precision of the program */
+	if(genome->reduced_weights != NULL){
+		return nn_program_from_ffnet_weights(net,
+						     genome->precision,
+						     genome->reduced_weights,
+						     genome->data->scale);
+	}
+
+	/* Sparse programs only have full precision weights */
+	if(genome->precision != NN_PRECISION_FLOAT){
+		return nn_program_from_ffnet_precision(net, genome->precision);
+	}
+
+	size_t nnonzero = 0;
+	for(size_t i = 0; i < net->nweights; i++){
+		nnonzero += net->weight[i] != 0.0f;
+	}
+	if(nnonzero >= NEAT_SPARSE_DENSITY * net->nweights){
+		return nn_program_from_ffnet(net);
+	}
+
+	/* Leave only the zero weights out so the result stays the same */
+	struct nn_graphnet *graph = nn_graphnet_from_ffnet(net, 0.0f);
+	struct nn_program *program = nn_program_from_graphnet(graph);
+	nn_graphnet_destroy(graph);
+
+	return program;
+}
+
+void neat_genome_compile(struct neat_genome *genome)
+{
+	assert(genome);
+
+	if(genome->program == NULL){
+		genome->program = neat_genome_program(genome);
+	}
+}
+
+void neat_genome_invalidate(struct neat_genome *genome)
+{
+	assert(genome);
+
+	if(genome->program != NULL){
+		nn_program_destroy(genome->program);
+		genome->program = NULL;
+	}
 }
 
 const float *neat_genome_run(struct neat_genome *genome, const float *inputs)
@@ -59,21 +783,335 @@ const float *neat_genome_run(struct neat_genome *genome, const float *inputs)
 	assert(genome);
 	assert(inputs);
 
-	return nn_ffnet_run(genome->net, inputs);
+	neat_genome_compile(genome);
+
+	return nn_program_run(genome->program, inputs);
+}
+
+size_t neat_genome_scratch_size(struct neat_config config)
+{
+	size_t net_bytes, nweights;
+	neat_genome_max_sizes(config, false, &net_bytes, &nweights);
+
+	/* Room for three values for every weight, one of them holds the
+	 * reduced weights as floats while they're changed
+	 */
+	return 3 * nweights;
 }
 
-void neat_genome_add_random_node(struct neat_genome *genome, int innovation)
+void neat_genome_mutate_weights(struct neat_genome_pool *pool,
+				struct neat_genome *genome,
+				struct nn_rng *rng,
+				float power,
+				float reset_probability,
+				float *scratch)
 {
+	assert(pool);
 	assert(genome);
-	assert(innovation >= 0);
+	assert(rng);
+	assert(scratch);
 
+	neat_genome_make_unique(pool, genome);
+
+	size_t nweights = genome->net->nweights;
+	float *chance = scratch;
+	float *value = scratch + nweights;
+	nn_rng_fill(rng, chance, nweights, 0.0f, 1.0f);
+	nn_rng_fill(rng, value, nweights, -1.0f, 1.0f);
+
+	/* Both outcomes are calculated for every weight so the loop doesn't
+	 * branch and is vectorized
+	 */
+	float *weight = neat_genome_weights(genome, scratch + 2 * nweights);
+	for(size_t i = 0; i < nweights; i++){
+		float perturbed = weight[i] + value[i] * power;
+		bool reset = chance[i] < reset_probability;
+		weight[i] = reset ? value[i] : perturbed;
+	}
+	neat_genome_store_weights(genome, weight);
+}
+
+bool neat_genome_add_random_node(struct neat_genome_pool *pool,
+				 struct neat_config config,
+				 struct neat_genome *genome,
+				 struct nn_rng *rng,
+				 int innovation,
+				 float *scratch)
+{
+	assert(pool);
+	assert(genome);
+	assert(rng);
+	assert(innovation > 0);
+	assert(scratch);
+
+	size_t max_hiddens, max_layers;
+	neat_genome_max_topology(config, &max_hiddens, &max_layers);
+
+	/* All hidden layers have the same size, so a node is added to every
+	 * one of them or a whole layer is added
+	 */
+	const struct nn_ffnet *net = genome->net;
+	bool widen = net->nhiddens < max_hiddens;
+	bool deepen = net->nhidden_layers > 0 &&
+		      net->nhidden_layers < max_layers;
+	if(!widen && !deepen){
+		return false;
+	}
+	if(widen && deepen){
+		widen = nn_rng_float(rng, 0.0f, 1.0f) < 0.5f;
+		deepen = !widen;
+	}
+
+	neat_genome_make_unique(pool, genome);
+	struct nn_ffnet old = *genome->net;
+
+	size_t nhiddens = old.nhiddens + (widen ? 1 : 0);
+	size_t nlayers = old.nhidden_layers + (deepen ? 1 : 0);
+	if(nlayers == 0){
+		nlayers = 1;
+	}
+
+	/* The network is built again in its own block, keep what's needed of
+	 * the old one
+	 */
+	const float *old_weight = scratch;
+	if(genome->reduced_weights == NULL){
+		memcpy(scratch, old.weight, sizeof(float) * old.nweights);
+	}else{
+		neat_genome_weights(genome, scratch);
+	}
+
+	void *memory = genome->net;
+	struct nn_ffnet *new;
+	if(old.external_weights){
+		new = nn_ffnet_init_external(memory,
+					     old.weight,
+					     old.ninputs,
+					     nhiddens,
+					     old.noutputs,
+					     nlayers);
+	}else{
+		new = nn_ffnet_init(memory,
+				    old.ninputs,
+				    nhiddens,
+				    old.noutputs,
+				    nlayers);
+	}
+	nn_ffnet_set_activations(new,
+				 old.hidden_activation,
+				 old.output_activation);
+	nn_ffnet_set_bias(new, old.bias);
+
+	float *fresh = scratch + old.nweights;
+	if(widen){
+		nn_rng_fill(rng, fresh, new->nweights, -1.0f, 1.0f);
+	}
+
+	/* Reduced weights are built as floats behind the fresh ones */
+	float *first_weight = new->weight;
+	if(genome->reduced_weights != NULL){
+		first_weight = fresh + new->nweights;
+	}
+
+	float *weight = first_weight;
+	for(size_t i = 0; i <= new->nhidden_layers; i++){
+		bool output_layer = i == new->nhidden_layers;
+		size_t nsources = i == 0 ? new->ninputs : new->nhiddens;
+		size_t ntargets = output_layer ? new->noutputs : new->nhiddens;
+		size_t nrow = nsources + 1;
+
+		/* A new layer passes the values of the layer in front of it
+		 * on, which doesn't change them with ReLU
+		 */
+		if(deepen && i == old.nhidden_layers && !output_layer){
+			memset(weight, 0, sizeof(float) * ntargets * nrow);
+			for(size_t j = 0; j < ntargets; j++){
+				weight[j * nrow + 1 + j] = 1.0f;
+			}
+			weight += ntargets * nrow;
+			continue;
+		}
+
+		/* The outputs are connected to other nodes when the first
+		 * hidden layer is added, so none of the old weights fit
+		 */
+		size_t nold_sources = i == 0 ? old.ninputs : old.nhiddens;
+		size_t nold_targets = output_layer ? old.noutputs :
+						     old.nhiddens;
+		if(old.nhidden_layers == 0){
+			nold_targets = 0;
+		}
+
+		/* Every old row gets a weight of 0 from the new node behind
+		 * it, the new rows are random
+		 */
+		for(size_t j = 0; j < nold_targets; j++){
+			memcpy(weight,
+			       old_weight,
+			       sizeof(float) * (nold_sources + 1));
+			memset(weight + nold_sources + 1,
+			       0,
+			       sizeof(float) * (nsources - nold_sources));
+
+			weight += nrow;
+			old_weight += nold_sources + 1;
+		}
+
+		size_t nfresh = (ntargets - nold_targets) * nrow;
+		memcpy(weight, fresh, sizeof(float) * nfresh);
+		weight += nfresh;
+		fresh += nfresh;
+	}
+	assert(weight - first_weight == new->nweights);
+	assert(old.nhidden_layers == 0 ||
+	       old_weight - scratch == old.nweights);
+	neat_genome_store_weights(genome, first_weight);
+
+	neat_genome_set_innovations(genome);
+	neat_genome_number_weights(config, genome, innovation);
+
+	return true;
+}
+
+void neat_genome_crossover(struct neat_genome_pool *pool,
+			   struct neat_genome *genome,
+			   const struct neat_genome *other,
+			   struct nn_rng *rng,
+			   float *scratch)
+{
+	assert(pool);
+	assert(genome);
+	assert(other);
+	assert(rng);
+	assert(scratch);
+
+	neat_genome_make_unique(pool, genome);
+
+	size_t ngenes = genome->net->nweights;
+	size_t nother_genes = other->net->nweights;
+	float *chance = scratch;
+	nn_rng_fill(rng, chance, ngenes, 0.0f, 1.0f);
+
+	const int *innovations = genome->innovations;
+	const int *other_innovations = other->innovations;
+	float *weight = neat_genome_weights(genome, scratch + ngenes);
+	const float *other_weight = neat_genome_weights(other,
+							scratch + 2 * ngenes);
+
+	/* A single merge of the sorted innovations, the side that is behind
+	 * moves on and both do when they match
+	 */
+	size_t i = 0, j = 0;
+	while(i < ngenes && j < nother_genes){
+		int innovation = innovations[i];
+		int other_innovation = other_innovations[j];
+
+		bool take = innovation == other_innovation && chance[i] < 0.5f;
+		weight[i] = take ? other_weight[j] : weight[i];
+
+		i += innovation <= other_innovation;
+		j += other_innovation <= innovation;
+	}
+	neat_genome_store_weights(genome, weight);
+}
+
+float neat_genome_distance(const struct neat_genome *genome,
+			   const struct neat_genome *other,
+			   float treshold)
+{
+	assert(genome);
+	assert(other);
+
+	/* Copies that weren't changed yet are the same genome */
+	if(genome->data == other->data){
+		return 0.0f;
+	}
+
+	const int *innovations = genome->innovations;
+	const int *other_innovations = other->innovations;
+
+	size_t ngenes = genome->net->nweights;
+	size_t nother_genes = other->net->nweights;
+
+	/* Normalize by the size of the biggest genome, the weight difference
+	 * is an average over the matching genes which can't be more than the
+	 * amount of genes in the smallest genome
+	 */
+	size_t nmax = ngenes > nother_genes ? ngenes : nother_genes;
+	size_t nmin = ngenes < nother_genes ? ngenes : nother_genes;
+	float structure_scale = 1.0f / (float)(nmax > 0 ? nmax : 1);
+	float weight_scale = 1.0f / (float)(nmin > 0 ? nmin : 1);
+
+	size_t i = 0, j = 0;
+	size_t ndisjoint = 0, nmatching = 0;
+	float weight_difference = 0.0f;
+	while(i < ngenes && j < nother_genes){
+		if(innovations[i] == other_innovations[j]){
+			weight_difference +=
+				fabsf(neat_genome_weight(genome, i) -
+				      neat_genome_weight(other, j));
+			nmatching++;
+			i++;
+			j++;
+		}else if(innovations[i] < other_innovations[j]){
+			ndisjoint++;
+			i++;
+		}else{
+			ndisjoint++;
+			j++;
+		}
+
+		/* Both terms only grow so this is the least the distance can
+		 * be, stop when that is already too far away
+		 */
+		float lower_bound =
+			NEAT_DISJOINT_COEFFICIENT * ndisjoint *
+			structure_scale +
+			NEAT_WEIGHT_COEFFICIENT * weight_difference *
+			weight_scale;
+		if(lower_bound > treshold){
+			return lower_bound;
+		}
+	}
+
+	/* The genes left over are newer than anything in the other genome */
+	size_t nexcess = (ngenes - i) + (nother_genes - j);
+
+	float average_weight_difference = 0.0f;
+	if(nmatching > 0){
+		average_weight_difference = weight_difference /
+					    (float)nmatching;
+	}
+
+	return NEAT_EXCESS_COEFFICIENT * nexcess * structure_scale +
+	       NEAT_DISJOINT_COEFFICIENT * ndisjoint * structure_scale +
+	       NEAT_WEIGHT_COEFFICIENT * average_weight_difference;
 }
 
 bool neat_genome_is_compatible(const struct neat_genome *genome,
 			       const struct neat_genome *other,
 			       float treshold)
 {
-	//TODO implement by checking the distance between the genomes
+	return neat_genome_distance(genome, other, treshold) <= treshold;
+}
 
-	return true;
+size_t neat_genome_find_compatible(const struct neat_genome *genome,
+				   const struct neat_genome *const *others,
+				   size_t nothers,
+				   float treshold)
+{
+	assert(genome);
+	assert(others);
+
+	for(size_t i = 0; i < nothers; i++){
+		if(others[i] == NULL){
+			continue;
+		}
+
+		if(neat_genome_is_compatible(genome, others[i], treshold)){
+			return i;
+		}
+	}
+
+	return nothers;
 }
@@ -4,23 +4,240 @@
 #include <nn.h>
 
 #include "species.h"
+#include "pool.h"
 
+#include <stdint.h>
+
+/* Network and innovations of a genome, shared by copies of the genome until
+ * one of them gets changed
+ */
+struct neat_genome_data{
+	size_t references;
+	/* Unique within the pool, a new version is given to the data every
+	 * time it can be changed
+	 */
+	uint64_t version;
+	/* Multiplier of the int8 weights in the row of the data, see
+	 * nn_precision_store
+	 */
+	float scale;
+};
+
+/* The fitness and time alive are stored in the population */
 struct neat_genome{
+	struct neat_genome_data *data;
+	/* Both are stored in the data */
 	struct nn_ffnet *net;
+	/* Innovation number of every weight, always sorted from low to high
+	 * so genomes can be compared in a single pass
+	 */
 	int *innovations;
-	float fitness;
-	int time_alive;
+	/* Compiled version of the network, NULL until it's needed and after
+	 * the network changed
+	 */
+	struct nn_program *program;
+	enum nn_precision precision;
+	/* With a reduced precision the weights are only stored in this row of
+	 * the pool in that precision and the network has no float weights.
+	 * NULL with full precision
+	 */
+	void *reduced_weights;
+};
+
+/* Storage for the genomes and their data, both have a block for every genome
+ * so there is always enough room even if none of them share their data
+ */
+struct neat_genome_pool{
+	struct neat_pool *genomes;
+	struct neat_pool *data;
+
+	/* With packed_weights the weights of data block i are in row i of
+	 * this tensor instead of in the block, NULL otherwise. The rows store
+	 * them in the precision of the genomes
+	 */
+	void *weights;
+	size_t weight_stride;
+	/* Weights given to neat_genome_pool_create_in are not freed */
+	bool owns_weights;
+
+	uint64_t next_version;
 };
 
-struct neat_genome *neat_genome_create(struct neat_config config,
+struct neat_genome_pool *neat_genome_pool_create(struct neat_config config,
+						 size_t ngenomes);
+
+/* Use memory owned by the caller for the data of the genomes, the first ndata
+ * blocks already contain data
+ * data:	room for ngenomes blocks of block_size bytes, see
+ * 		neat_pool_create_in
+ * weights:	ngenomes rows of neat_genome_weight_stride bytes aligned to
+ * 		NEAT_POOL_ALIGNMENT with packed_weights, NULL otherwise
+ */
+struct neat_genome_pool *neat_genome_pool_create_in(struct neat_config config,
+						    size_t ngenomes,
+						    void *data,
+						    size_t block_size,
+						    size_t ndata,
+						    void *weights);
+void neat_genome_pool_destroy(struct neat_genome_pool *pool);
+
+/* Bytes needed for the data of a genome, its network and innovations in a
+ * single pool block, large enough for the biggest topology allowed by the
+ * config
+ */
+size_t neat_genome_size(struct neat_config config);
+
+/* Check a config from an untrusted source before any size is computed from
+ * it, the biggest genome has to take at most size bytes
+ */
+bool neat_genome_config_fits(struct neat_config config, size_t size);
+
+/* Bytes between the rows of the weight tensor, every row starts on
+ * NEAT_POOL_ALIGNMENT and fits the biggest topology allowed by the config in
+ * the precision of its networks. 0 without packed_weights, which a reduced
+ * precision always turns on
+ */
+size_t neat_genome_weight_stride(struct neat_config config);
+
+/* The row of the weight tensor that belongs to a data block */
+void *neat_genome_weight_row(const struct neat_genome_pool *pool,
+			      const struct neat_genome_data *data);
+
+/* Every weight is numbered by its place in the biggest topology allowed by
+ * the config, so genomes that grew the same nodes share their innovations and
+ * the innovations of a network are always sorted in memory order
+ * innovation:	innovation number of the first place
+ */
+struct neat_genome *neat_genome_create(struct neat_genome_pool *pool,
+				       struct neat_config config,
 				       int innovation);
-struct neat_genome *neat_genome_copy(const struct neat_genome *genome);
-void neat_genome_destroy(struct neat_genome *genome);
+/* The copy shares the data with the genome, use neat_genome_make_unique
+ * before changing either of them
+ */
+struct neat_genome *neat_genome_copy(struct neat_genome_pool *pool,
+				     const struct neat_genome *genome);
+void neat_genome_destroy(struct neat_genome_pool *pool,
+			 struct neat_genome *genome);
+
+/* Create a genome on data that is already in the pool, like after loading
+ * it, the data keeps its reference count and version
+ */
+struct neat_genome *neat_genome_load(struct neat_genome_pool *pool,
+				     struct neat_config config,
+				     struct neat_genome_data *data);
+
+/* The network and innovations of a genome without anything that only
+ * matters in this population, used to send it to another one. The weights
+ * are always packed behind the network, wherever the pool keeps them
+ */
+size_t neat_genome_pack_size(const struct neat_genome *genome);
+/* The biggest packed genome allowed by the config */
+size_t neat_genome_max_pack_size(struct neat_config config);
+void neat_genome_pack(const struct neat_genome *genome, void *buffer);
+
+/* Check a packed genome from an untrusted source before it's unpacked, it
+ * has to fit the config and a data block of the pool
+ */
+bool neat_genome_can_unpack(const struct neat_genome_pool *pool,
+			    struct neat_config config,
+			    const void *buffer,
+			    size_t size);
+/* Check a data block of neat_genome_size bytes from an untrusted source
+ * before a genome is loaded on it
+ */
+bool neat_genome_data_is_valid(struct neat_config config,
+			       const struct neat_genome_data *data);
+/* Create a genome with its own data from a packed one */
+struct neat_genome *neat_genome_unpack(struct neat_genome_pool *pool,
+				       struct neat_config config,
+				       const void *buffer,
+				       size_t size);
+
+/* Give the genome its own data when it's shared so it can be changed, this
+ * also invalidates the compiled program and gives the data a new version
+ */
+void neat_genome_make_unique(struct neat_genome_pool *pool,
+			     struct neat_genome *genome);
+
+/* Compile the network into a new program owned by the caller, sparse
+ * networks get sparse instructions that skip the zero weights when the
+ * precision is NN_PRECISION_FLOAT. A program of reduced weights runs on the
+ * row of the pool, so it can't be used after the genome changed or was
+ * destroyed, see nn_program_copy
+ */
+struct nn_program *neat_genome_program(const struct neat_genome *genome);
+
+/* Compile the network when there is no up to date program yet, running a
+ * genome does this by itself but then it can't be done from multiple threads
+ */
+void neat_genome_compile(struct neat_genome *genome);
+
+/* Throw the compiled program away, must be called after every change to the
+ * network
+ */
+void neat_genome_invalidate(struct neat_genome *genome);
 
 const float *neat_genome_run(struct neat_genome *genome, const float *inputs);
 
-void neat_genome_add_random_node(struct neat_genome *genome, int innovation);
+/* Floats of scratch space needed by the mutations of genomes with the config */
+size_t neat_genome_scratch_size(struct neat_config config);
+
+/* Perturb every weight by up to power in both directions or give it a new
+ * value between -1 & 1 instead with a chance of reset_probability
+ * scratch:	room for neat_genome_scratch_size floats
+ */
+void neat_genome_mutate_weights(struct neat_genome_pool *pool,
+				struct neat_genome *genome,
+				struct nn_rng *rng,
+				float power,
+				float reset_probability,
+				float *scratch);
+
+/* Add a node to every hidden layer, the first hidden layer with a single node
+ * to a genome without any or a hidden layer in front of the outputs. The
+ * weights going to new nodes are random and the ones coming from them are 0,
+ * a new layer passes the values on. The outputs only change when the first
+ * layer is added or a layer is added without ReLU as hidden activation
+ * innovation:	the same as for neat_genome_create
+ * scratch:	room for neat_genome_scratch_size floats
+ *
+ * return false when the genome already has the topology of the config
+ */
+bool neat_genome_add_random_node(struct neat_genome_pool *pool,
+				 struct neat_config config,
+				 struct neat_genome *genome,
+				 struct nn_rng *rng,
+				 int innovation,
+				 float *scratch);
+
+/* Take the weights of other for about half of the genes both genomes share,
+ * the genes only the genome has are kept. The genome should be the fitter
+ * parent since it keeps its topology
+ * scratch:	room for neat_genome_scratch_size floats
+ */
+void neat_genome_crossover(struct neat_genome_pool *pool,
+			   struct neat_genome *genome,
+			   const struct neat_genome *other,
+			   struct nn_rng *rng,
+			   float *scratch);
+
+/* The NEAT distance between two genomes, the calculation stops as soon as the
+ * distance is known to be above treshold and a value above it is returned
+ */
+float neat_genome_distance(const struct neat_genome *genome,
+			   const struct neat_genome *other,
+			   float treshold);
 
 bool neat_genome_is_compatible(const struct neat_genome *genome,
 			       const struct neat_genome *other,
 			       float treshold);
+
+/* Compare a genome with multiple others at once
+ * others:	genomes to compare with, NULL entries are skipped
+ *
+ * return the index of the first compatible genome or nothers if there is none
+ */
+size_t neat_genome_find_compatible(const struct neat_genome *genome,
+				   const struct neat_genome *const *others,
+				   size_t nothers,
+				   float treshold);
@@ -0,0 +1,172 @@
+#include "population.h"
+
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+
+/* Messages waiting to be received, a ring buffer of fixed size slots */
+struct neat_queue{
+	omp_lock_t lock;
+
+	size_t capacity, message_size;
+	size_t first, count;
+
+	size_t *sizes;
+	char *messages;
+};
+
+static int neat_compare_ranks_descending(const void *a, const void *b)
+{
+	const struct neat_genome_rank *rank_a = a, *rank_b = b;
+
+	if(rank_a->fitness != rank_b->fitness){
+		return rank_a->fitness > rank_b->fitness ? -1 : 1;
+	}
+
+	return rank_a->genome_id < rank_b->genome_id ? -1 : 1;
+}
+
+size_t neat_migrate(neat_t population,
+		    const struct neat_transport *transport,
+		    size_t nmigrants)
+{
+	struct neat_pop *p = population;
+	assert(p);
+	assert(transport);
+	assert(transport->send);
+	assert(transport->receive);
+
+	size_t message_size = neat_genome_message_size(p);
+	void *message = p->migration_message;
+
+	/* Send the best genomes before any of them can be replaced, they're
+	 * ranked in a buffer of our own because the epochs of the population
+	 * use its ranks
+	 */
+	if(nmigrants > p->ngenomes){
+		nmigrants = p->ngenomes;
+	}
+	struct neat_genome_rank *ranks = p->migration_ranks;
+
+	omp_set_lock(&p->lock);
+	for(size_t i = 0; i < p->ngenomes; i++){
+		ranks[i].fitness = p->fitness[i];
+		ranks[i].genome_id = i;
+	}
+	omp_unset_lock(&p->lock);
+
+	qsort(ranks, p->ngenomes, sizeof(struct neat_genome_rank),
+	      neat_compare_ranks_descending);
+
+	for(size_t i = 0; i < nmigrants; i++){
+		size_t size = neat_write_genome(p,
+						ranks[i].genome_id,
+						message,
+						message_size);
+		assert(size > 0);
+
+		if(!transport->send(transport->destination, message, size)){
+			NEAT_STATS_ADD(p, ndropped_migrants, 1);
+		}
+	}
+	NEAT_STATS_ADD(p, nmigrants, nmigrants);
+
+	/* Messages that don't fit can't be from a compatible population */
+	size_t nreceived = 0;
+	size_t size;
+	while((size = transport->receive(transport->source,
+					 message,
+					 message_size)) > 0){
+		if(size <= message_size && neat_read_genome(p, message, size)){
+			nreceived++;
+		}
+	}
+
+	return nreceived;
+}
+
+struct neat_queue *neat_queue_create(size_t capacity, size_t message_size)
+{
+	assert(capacity > 0);
+	assert(message_size > 0);
+
+	struct neat_queue *queue = calloc(1, sizeof(struct neat_queue));
+	assert(queue);
+
+	omp_init_lock(&queue->lock);
+
+	queue->capacity = capacity;
+	queue->message_size = message_size;
+
+	queue->sizes = malloc(sizeof(size_t) * capacity);
+	queue->messages = malloc(message_size * capacity);
+	assert(queue->sizes && queue->messages);
+
+	return queue;
+}
+
+void neat_queue_destroy(struct neat_queue *queue)
+{
+	assert(queue);
+
+	omp_destroy_lock(&queue->lock);
+
+	free(queue->sizes);
+	free(queue->messages);
+	free(queue);
+}
+
+bool neat_queue_send(void *destination, const void *message, size_t size)
+{
+	struct neat_queue *queue = destination;
+	assert(queue);
+	assert(message);
+	assert(size > 0);
+
+	if(size > queue->message_size){
+		return false;
+	}
+
+	omp_set_lock(&queue->lock);
+
+	bool sent = queue->count < queue->capacity;
+	if(sent){
+		size_t slot = (queue->first + queue->count) % queue->capacity;
+		queue->sizes[slot] = size;
+		memcpy(queue->messages + slot * queue->message_size,
+		       message,
+		       size);
+		queue->count++;
+	}
+
+	omp_unset_lock(&queue->lock);
+
+	return sent;
+}
+
+size_t neat_queue_receive(void *source, void *message, size_t size)
+{
+	struct neat_queue *queue = source;
+	assert(queue);
+	assert(message);
+
+	omp_set_lock(&queue->lock);
+
+	size_t received = 0;
+	if(queue->count > 0){
+		size_t slot = queue->first;
+		received = queue->sizes[slot];
+		if(received <= size){
+			memcpy(message,
+			       queue->messages + slot * queue->message_size,
+			       received);
+		}
+
+		queue->first = (queue->first + 1) % queue->capacity;
+		queue->count--;
+	}
+
+	omp_unset_lock(&queue->lock);
+
+	return received;
+}
@@ -0,0 +1,97 @@
+#include "pool.h"
+
+#include <stdint.h>
+#include <assert.h>
+
+struct neat_pool *neat_pool_create(size_t block_size, size_t nblocks)
+{
+	assert(block_size > 0);
+	assert(nblocks > 0);
+
+	struct neat_pool *pool = calloc(1, sizeof(struct neat_pool));
+	assert(pool);
+
+	/* Round the blocks up so the next one is aligned again */
+	pool->block_size = (block_size + NEAT_POOL_ALIGNMENT - 1) /
+			   NEAT_POOL_ALIGNMENT * NEAT_POOL_ALIGNMENT;
+	pool->nblocks = nblocks;
+
+	pool->memory = aligned_alloc(NEAT_POOL_ALIGNMENT,
+				     pool->block_size * nblocks);
+	assert(pool->memory);
+
+	/* Nothing is chained yet, the blocks come from the unused ones */
+	pool->free_blocks = NULL;
+	pool->nfree = nblocks;
+	pool->nused = 0;
+	pool->owns_memory = true;
+
+	return pool;
+}
+
+struct neat_pool *neat_pool_create_in(void *memory,
+				      size_t block_size,
+				      size_t nblocks,
+				      size_t nused)
+{
+	assert(memory);
+	assert((uintptr_t)memory % NEAT_POOL_ALIGNMENT == 0);
+	assert(block_size > 0);
+	assert(block_size % NEAT_POOL_ALIGNMENT == 0);
+	assert(nused <= nblocks);
+
+	struct neat_pool *pool = calloc(1, sizeof(struct neat_pool));
+	assert(pool);
+
+	pool->block_size = block_size;
+	pool->nblocks = nblocks;
+	pool->memory = memory;
+
+	pool->free_blocks = NULL;
+	pool->nfree = nblocks - nused;
+	pool->nused = nused;
+	pool->owns_memory = false;
+
+	return pool;
+}
+
+void neat_pool_destroy(struct neat_pool *pool)
+{
+	assert(pool);
+	assert(pool->memory);
+
+	if(pool->owns_memory){
+		free(pool->memory);
+	}
+	free(pool);
+}
+
+void *neat_pool_alloc(struct neat_pool *pool)
+{
+	assert(pool);
+	assert(pool->nfree > 0);
+
+	pool->nfree--;
+
+	if(pool->free_blocks == NULL){
+		return pool->memory + pool->nused++ * pool->block_size;
+	}
+
+	void *block = pool->free_blocks;
+	pool->free_blocks = *(void**)block;
+
+	return block;
+}
+
+void neat_pool_free(struct neat_pool *pool, void *block)
+{
+	assert(pool);
+	assert(block);
+	assert((char*)block >= pool->memory);
+	assert((char*)block < pool->memory + pool->block_size * pool->nused);
+
+	/* The free list is stored in the unused blocks themselves */
+	*(void**)block = pool->free_blocks;
+	pool->free_blocks = block;
+	pool->nfree++;
+}
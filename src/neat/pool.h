@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* Every block starts on a cache line */
+#define NEAT_POOL_ALIGNMENT 64
+
+/* Fixed size blocks that are allocated once and recycled through a free list,
+ * the most recently freed block is handed out first. Blocks that were never
+ * used are handed out in order afterwards so their memory isn't touched
+ * before it's needed
+ */
+struct neat_pool{
+	size_t block_size;
+	size_t nblocks;
+
+	char *memory;
+	void *free_blocks;
+	size_t nfree;
+	/* Blocks handed out at least once, they're all at the start */
+	size_t nused;
+
+	/* Memory given to neat_pool_create_in is not freed */
+	bool owns_memory;
+};
+
+struct neat_pool *neat_pool_create(size_t block_size, size_t nblocks);
+
+/* Create a pool in memory owned by the caller where the first nused blocks
+ * are already handed out, like the blocks of a loaded file
+ * memory:	nblocks blocks aligned to NEAT_POOL_ALIGNMENT
+ * block_size:	a multiple of NEAT_POOL_ALIGNMENT
+ */
+struct neat_pool *neat_pool_create_in(void *memory,
+				      size_t block_size,
+				      size_t nblocks,
+				      size_t nused);
+void neat_pool_destroy(struct neat_pool *pool);
+
+void *neat_pool_alloc(struct neat_pool *pool);
+void neat_pool_free(struct neat_pool *pool, void *block);
@@ -1,105 +1,531 @@
 #include "population.h"
 
 #include <float.h>
+#include <string.h>
 #include <assert.h>
+#include <omp.h>
+#include <sys/mman.h>
+
+/* Mutations of every child as used in the original NEAT paper, the weights
+ * of a child are mutated with the first chance and then every weight is
+ * either perturbed or reset
+ */
+#define NEAT_WEIGHT_MUTATION_PROBABILITY 0.8f
+#define NEAT_WEIGHT_RESET_PROBABILITY 0.1f
+#define NEAT_WEIGHT_MUTATION_POWER 0.5f
+#define NEAT_ADD_NODE_PROBABILITY 0.03f
+
+/* The generator of the calling thread, workers of neat_report_fitness can be
+ * more than there are generators but they hold the lock while using one
+ */
+static struct nn_rng *neat_rng(struct neat_pop *p)
+{
+	size_t thread = omp_get_thread_num();
+	if(thread >= p->nrngs){
+		thread = 0;
+	}
+
+	return p->rngs + thread;
+}
+
+/* Mark a genome as in flight, fails when it already is */
+static bool neat_claim_genome(struct neat_pop *p, size_t genome_id)
+{
+	return !atomic_exchange(p->in_flight + genome_id, true);
+}
+
+static void neat_release_genome(struct neat_pop *p, size_t genome_id)
+{
+	atomic_store(p->in_flight + genome_id, false);
+}
+
+/* Let neat_acquire_genome hand a genome out before the others, must be
+ * called while holding the lock
+ */
+static void neat_push_young(struct neat_pop *p, size_t genome_id)
+{
+	if(!atomic_load(&p->asynchronous)){
+		return;
+	}
+
+	size_t tail = atomic_load(&p->young_tail);
+	if(tail - atomic_load(&p->young_head) >= p->ngenomes){
+		return;
+	}
+
+	p->young[tail % p->ngenomes] = genome_id;
+	atomic_store(&p->young_tail, tail + 1);
+}
+
+static size_t neat_pop_young(struct neat_pop *p)
+{
+	size_t head = atomic_load(&p->young_head);
+	for(;;){
+		if(head == atomic_load(&p->young_tail)){
+			return NEAT_NO_GENOME;
+		}
+
+		/* The slot can only be reused after the head moved past it */
+		size_t genome_id = p->young[head % p->ngenomes];
+		if(atomic_compare_exchange_weak(&p->young_head,
+						&head,
+						head + 1)){
+			return genome_id;
+		}
+	}
+}
 
 static void neat_reset_genomes(struct neat_pop *p)
 {
 	assert(p);
 
 	/* Create a base genome and copy it for every other one */
-	p->genomes[0] = neat_genome_create(p->conf, p->innovation++);
+	p->genomes[0] = neat_genome_create(p->pool, p->conf, p->innovation);
 
 	for(size_t i = 1; i < p->ngenomes; i++){
-		p->genomes[i] = neat_genome_copy(p->genomes[0]);
+		p->genomes[i] = neat_genome_copy(p->pool, p->genomes[0]);
 	}
 }
 
-static void neat_replace_genome(struct neat_pop *p,
-				size_t dest,
-				struct neat_genome *src)
+static void neat_replace_genome(struct neat_pop *p, size_t dest, size_t src)
 {
 	assert(p);
-	assert(src);
-	assert(p->genomes[dest] != src);
+	assert(dest < p->ngenomes);
+	assert(src < p->ngenomes);
+	assert(dest != src);
+
+	/* The pool hands the freed block out again and the copy shares the
+	 * data of the parent until it gets changed
+	 */
+	neat_genome_destroy(p->pool, p->genomes[dest]);
+	p->genomes[dest] = neat_genome_copy(p->pool, p->genomes[src]);
+
+	/* Start with the fitness of the parent but give it time to prove
+	 * itself before it can be replaced
+	 */
+	p->fitness[dest] = p->fitness[src];
+	p->time_alive[dest] = 0;
+	p->cache[dest] = p->cache[src];
 
-	neat_genome_destroy(p->genomes[dest]);
-	p->genomes[dest] = neat_genome_copy(src);
+	neat_push_young(p, dest);
 }
 
-static struct neat_species *neat_create_new_species(struct neat_pop *p,
-						    struct neat_genome *base)
+struct neat_species *neat_create_new_species(struct neat_pop *p)
 {
 	assert(p);
 
-	p->species = realloc(p->species,
-			     sizeof(struct neat_species*) * ++p->nspecies);
-	assert(p->species);
+	/* Grow the arrays of the species together by doubling them */
+	if(p->nspecies == p->species_capacity){
+		size_t capacity = p->species_capacity * 2;
+		if(capacity == 0){
+			capacity = 4;
+		}
+		NEAT_STATS_ADD(p, nallocations, 3);
+
+		p->species = realloc(p->species,
+				     sizeof(struct neat_species*) * capacity);
+		p->species_chances = realloc(p->species_chances,
+					     sizeof(float) * capacity);
+		p->representants = realloc(p->representants,
+					   sizeof(struct neat_genome*) *
+					   capacity);
+		assert(p->species && p->species_chances && p->representants);
 
-	struct neat_species *new = neat_species_create(p->conf, base);
-	p->species[p->nspecies - 1] = new;
+		p->species_capacity = capacity;
+	}
+
+	NEAT_STATS_ADD(p, nallocations, 1);
+
+	struct neat_species *new = neat_species_create();
+	p->species[p->nspecies++] = new;
 
 	return new;
 }
 
+/* Throw the species away that died out when the config asks for it, this
+ * moves the species after them so it must not be called while speciating.
+ * Otherwise their indices are used again by new species
+ */
+static void neat_remove_extinct_species(struct neat_pop *p)
+{
+	assert(p);
+
+	if(!p->conf.reset_on_extinction){
+		return;
+	}
+
+	size_t nspecies = 0;
+	size_t *new_index = NULL;
+	for(size_t i = 0; i < p->nspecies; i++){
+		struct neat_species *s = p->species[i];
+		if(s->ngenomes > 0){
+			if(new_index != NULL){
+				new_index[i] = nspecies;
+			}
+			p->species[nspecies++] = s;
+			continue;
+		}
+
+		/* Only renumber when there is something to remove */
+		if(new_index == NULL){
+			new_index = malloc(sizeof(size_t) * p->nspecies);
+			assert(new_index);
+			NEAT_STATS_ADD(p, nallocations, 1);
+			for(size_t j = 0; j < i; j++){
+				new_index[j] = j;
+			}
+		}
+		neat_species_destroy(s);
+	}
+
+	if(new_index == NULL){
+		return;
+	}
+
+	p->nspecies = nspecies;
+	for(size_t i = 0; i < p->ngenomes; i++){
+		if(p->species_of[i] != NEAT_NO_SPECIES){
+			p->species_of[i] = new_index[p->species_of[i]];
+		}
+	}
+	free(new_index);
+}
+
+static void neat_add_to_species(struct neat_pop *p,
+				size_t species,
+				size_t genome_id)
+{
+	assert(p);
+	assert(species < p->nspecies);
+	assert(p->species_of[genome_id] == NEAT_NO_SPECIES);
+
+	bool resized = neat_species_add_genome(p->species[species],
+					       genome_id,
+					       p->fitness,
+					       p->species_slot);
+	if(resized){
+		NEAT_STATS_ADD(p, nallocations, 1);
+	}
+	p->species_of[genome_id] = species;
+}
+
+static void neat_remove_from_species(struct neat_pop *p, size_t genome_id)
+{
+	assert(p);
+
+	size_t species = p->species_of[genome_id];
+	if(species == NEAT_NO_SPECIES){
+		return;
+	}
+
+	NEAT_STATS_START(removal);
+
+	bool resized = neat_species_remove_genome(p->species[species],
+						  genome_id,
+						  p->fitness,
+						  p->species_slot);
+	if(resized){
+		NEAT_STATS_ADD(p, nallocations, 1);
+	}
+	p->species_of[genome_id] = NEAT_NO_SPECIES;
+
+	NEAT_STATS_STOP(p, removal_cycles, removal);
+}
+
 static bool neat_find_worst_fitness(struct neat_pop *p, size_t *worst_genome)
 {
 	assert(p);
 	assert(worst_genome);
 
+	NEAT_STATS_START(selection);
+
 	bool found_worst = false;
 
 	float worst_fitness = FLT_MAX;
 	for(size_t i = 0; i < p->ngenomes; i++){
-		struct neat_genome *genome = p->genomes[i];
-
-		float fitness = genome->fitness;
+		float fitness = p->fitness[i];
 		if(fitness < worst_fitness &&
-		   genome->time_alive > p->conf.genome_minimum_ticks_alive){
+		   p->time_alive[i] > p->conf.genome_minimum_ticks_alive &&
+		   !atomic_load_explicit(p->in_flight + i,
+					 memory_order_relaxed)){
 			*worst_genome = i;
 			worst_fitness = fitness;
 			found_worst = true;
 		}
 	}
 
+	NEAT_STATS_STOP(p, selection_cycles, selection);
+
 	return found_worst;
 }
 
-static float neat_get_species_fitness_average(struct neat_pop *p)
+/* Find the worst genome and mark it as in flight so it isn't handed out while
+ * it's replaced
+ */
+static bool neat_claim_worst_fitness(struct neat_pop *p, size_t *worst_genome)
+{
+	/* It can be handed out after it was found, the next search skips it */
+	while(neat_find_worst_fitness(p, worst_genome)){
+		if(neat_claim_genome(p, *worst_genome)){
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Cumulative chance of every species to reproduce, empty species don't add to
+ * it so they are never picked. If no species has a positive fitness every
+ * species is as likely
+ *
+ * return the total chance
+ */
+static float neat_calculate_species_chances(struct neat_pop *p)
 {
 	assert(p);
 
-	float total_avg = 0.0;
+	float total_chance = 0.0f;
 	for(size_t i = 0; i < p->nspecies; i++){
-		total_avg += neat_species_get_average_fitness(p->species[i]);
+		struct neat_species *s = p->species[i];
+		if(s->ngenomes > 0){
+			float avg = neat_species_get_average_fitness(s);
+			if(avg > 0.0f){
+				total_chance += avg;
+			}
+		}
+		p->species_chances[i] = total_chance;
+	}
+	if(total_chance > 0.0f){
+		return total_chance;
+	}
+
+	for(size_t i = 0; i < p->nspecies; i++){
+		if(p->species[i]->ngenomes > 0){
+			total_chance += 1.0f;
+		}
+		p->species_chances[i] = total_chance;
 	}
-	total_avg /= (double)p->nspecies;
 
-	return total_avg;
+	return total_chance;
 }
 
-static void neat_speciate_genome(struct neat_pop *p, size_t genome_id)
+int neat_thread_count(const struct neat_pop *p)
+{
+	if(p->conf.evaluation_threads > 0){
+		return p->conf.evaluation_threads;
+	}
+
+	return omp_get_max_threads();
+}
+
+/* Pick a random genome of every species to compare with, empty species have
+ * nothing to compare with
+ */
+static void neat_pick_representants(struct neat_pop *p)
+{
+	assert(p);
+
+	for(size_t i = 0; i < p->nspecies; i++){
+		p->representants[i] = NULL;
+		if(p->species[i]->ngenomes > 0){
+			size_t representant =
+				neat_species_get_representant(p->species[i],
+							      neat_rng(p));
+			p->representants[i] = p->genomes[representant];
+		}
+	}
+}
+
+/* Index for a new species, the first one that died out is used again so the
+ * species never outnumber the genomes
+ */
+static size_t neat_reuse_species(struct neat_pop *p)
 {
 	assert(p);
 
+	for(size_t i = 0; i < p->nspecies; i++){
+		if(p->species[i]->ngenomes == 0){
+			return i;
+		}
+	}
+
+	neat_create_new_species(p);
+	return p->nspecies - 1;
+}
+
+/* Add a genome to the first species created while speciating it's compatible
+ * with, or to a new species it represents
+ */
+static void neat_add_to_new_species(struct neat_pop *p, size_t genome_id)
+{
 	struct neat_genome *genome = p->genomes[genome_id];
 	float compatibility_treshold = p->conf.genome_compatibility_treshold;
 
-	/* Add genome to species if the representant matches the genome */
-	for(size_t i = 0; i < p->nspecies; i++){
-		struct neat_genome *species_representant =
-			neat_species_get_representant(p->species[i]);
-		if(neat_genome_is_compatible(genome,
-					     species_representant,
-					     compatibility_treshold)){
-			neat_species_add_genome(p->species[i], genome);
-			return;
+	size_t nnew = p->nnew_species;
+	size_t found = neat_genome_find_compatible(genome,
+						   p->new_representants,
+						   nnew,
+						   compatibility_treshold);
+
+	size_t species;
+	if(found < nnew){
+		species = p->new_species[found];
+	}else{
+		species = neat_reuse_species(p);
+		p->representants[species] = genome;
+
+		p->new_representants[nnew] = genome;
+		p->new_species[nnew] = species;
+		p->nnew_species++;
+	}
+	neat_add_to_species(p, species, genome_id);
+}
+
+/* Speciate multiple genomes that aren't in a species at once, compared with
+ * the representants that are already picked. The distances are calculated in
+ * parallel and the genomes are added in order afterwards so the result doesn't
+ * depend on the amount of threads
+ */
+static void neat_speciate_genomes(struct neat_pop *p,
+				  const size_t *genome_ids,
+				  size_t ngenomes)
+{
+	assert(p);
+	assert(genome_ids || ngenomes == 0);
+
+	NEAT_STATS_START(speciation);
+
+	size_t nexisting = p->nspecies;
+	float compatibility_treshold = p->conf.genome_compatibility_treshold;
+	const struct neat_genome **representants = p->representants;
+	size_t *compatible = p->compatible_species;
+
+	#pragma omp parallel for num_threads(neat_thread_count(p)) \
+		schedule(dynamic, 64) if(ngenomes * nexisting > 4096)
+	for(size_t i = 0; i < ngenomes; i++){
+		const struct neat_genome *genome = p->genomes[genome_ids[i]];
+		compatible[i] =
+			neat_genome_find_compatible(genome,
+						    representants,
+						    nexisting,
+						    compatibility_treshold);
+	}
+
+	/* The existing species are filled first so only the ones that are
+	 * still empty can be used again for new species
+	 */
+	for(size_t i = 0; i < ngenomes; i++){
+		if(compatible[i] < nexisting){
+			neat_add_to_species(p, compatible[i], genome_ids[i]);
+		}
+	}
+
+	/* Genomes without a species create new ones, later genomes have to be
+	 * compared with those so this part is sequential
+	 */
+	p->nnew_species = 0;
+	for(size_t i = 0; i < ngenomes; i++){
+		if(compatible[i] >= nexisting){
+			neat_add_to_new_species(p, genome_ids[i]);
+		}
+	}
+
+	NEAT_STATS_STOP(p, speciation_cycles, speciation);
+}
+
+static void neat_speciate_genome(struct neat_pop *p, size_t genome_id)
+{
+	assert(p);
+
+	neat_pick_representants(p);
+	neat_speciate_genomes(p, &genome_id, 1);
+}
+
+static void neat_reproduce_genome(struct neat_pop *p,
+				  size_t dest,
+				  struct neat_species *s)
+{
+	assert(p);
+	assert(s);
+	assert(s->ngenomes > 0);
+
+	NEAT_STATS_START(reproduction);
+
+	struct nn_rng *rng = neat_rng(p);
+
+	/* Select a random genome from the species */
+	size_t genitor = neat_species_select_genitor(s, rng);
+
+	float random = nn_rng_float(rng, 0.0f, 1.0f);
+	if(random < p->conf.species_crossover_probability){
+		/* The child gets the topology of the fitter parent */
+		size_t other = neat_species_select_genitor(s, rng);
+		if(p->fitness[other] > p->fitness[genitor]){
+			size_t fitter = other;
+			other = genitor;
+			genitor = fitter;
+		}
+
+		neat_replace_genome(p, dest, genitor);
+		if(other != genitor){
+			neat_genome_crossover(p->pool,
+					      p->genomes[dest],
+					      p->genomes[other],
+					      rng,
+					      p->mutation_scratch);
+		}
+	}else{
+		neat_replace_genome(p, dest, genitor);
+	}
+
+	struct neat_genome *child = p->genomes[dest];
+	if(nn_rng_float(rng, 0.0f, 1.0f) < NEAT_ADD_NODE_PROBABILITY){
+		neat_genome_add_random_node(p->pool,
+					    p->conf,
+					    child,
+					    rng,
+					    p->innovation,
+					    p->mutation_scratch);
+	}
+	if(nn_rng_float(rng, 0.0f, 1.0f) < NEAT_WEIGHT_MUTATION_PROBABILITY){
+		neat_genome_mutate_weights(p->pool,
+					   child,
+					   rng,
+					   NEAT_WEIGHT_MUTATION_POWER,
+					   NEAT_WEIGHT_RESET_PROBABILITY,
+					   p->mutation_scratch);
+	}
+
+	NEAT_STATS_STOP(p, reproduction_cycles, reproduction);
+}
+
+static size_t neat_pick_species(struct neat_pop *p, float total_chance)
+{
+	assert(p);
+
+	/* Binary search the first species whose cumulative chance is higher,
+	 * empty species have the same chance as the one before them so they
+	 * are never picked
+	 */
+	float random = nn_rng_float(neat_rng(p), 0.0f, total_chance);
+
+	size_t low = 0, high = p->nspecies;
+	while(low < high){
+		size_t mid = low + (high - low) / 2;
+		if(p->species_chances[mid] > random){
+			high = mid;
+		}else{
+			low = mid + 1;
 		}
 	}
 
-	/* If no matching species could be found create a new species */
-	struct neat_species *new = neat_create_new_species(p, NULL);
-	neat_species_add_genome(new, genome);
+	/* Rounding can put the random value on the total */
+	while(low >= p->nspecies || p->species[low]->ngenomes == 0){
+		assert(low > 0);
+		low--;
+	}
+
+	return low;
 }
 
 static void neat_select_reproduction_species(struct neat_pop *p,
@@ -107,47 +533,152 @@ static void neat_select_reproduction_species(struct neat_pop *p,
 {
 	assert(p);
 
-	float total_avg = neat_get_species_fitness_average(p);
+	/* The worst genome was the last one left */
+	float total_chance = neat_calculate_species_chances(p);
+	if(total_chance <= 0.0f){
+		return;
+	}
 
-	float selection_random = (float)rand() / (float)RAND_MAX;
-	for(size_t i = 0; i < p->nspecies; i++){
-		struct neat_species *s = p->species[i];
+	size_t species = neat_pick_species(p, total_chance);
+	neat_reproduce_genome(p, worst_genome, p->species[species]);
+	neat_speciate_genome(p, worst_genome);
+}
 
-		/* Ignore empty species */
-		if(s->ngenomes == 0){
-			continue;
-		}
+static int neat_compare_ranks(const void *a, const void *b)
+{
+	const struct neat_genome_rank *rank_a = a, *rank_b = b;
 
-		float avg = neat_species_get_average_fitness(s);
-		float selection_prob = avg / total_avg;
+	if(rank_a->fitness != rank_b->fitness){
+		return rank_a->fitness < rank_b->fitness ? -1 : 1;
+	}
 
-		/* If we didn't find a match, 
-		 * reduce the chance to find a new one
-		 */
-		if(selection_random > selection_prob){
-			selection_random -= selection_prob;
-			continue;
+	/* Keep the order stable for genomes with the same fitness */
+	return rank_a->genome_id < rank_b->genome_id ? -1 : 1;
+}
+
+static void neat_generational_epoch(struct neat_pop *p)
+{
+	assert(p);
+
+	NEAT_STATS_START(selection);
+
+	/* Rank the genomes that lived long enough to be replaced */
+	size_t neligible = 0;
+	for(size_t i = 0; i < p->ngenomes; i++){
+		if(p->time_alive[i] > p->conf.genome_minimum_ticks_alive &&
+		   !atomic_load_explicit(p->in_flight + i,
+					 memory_order_relaxed)){
+			p->ranks[neligible].fitness = p->fitness[i];
+			p->ranks[neligible].genome_id = i;
+			neligible++;
 		}
+	}
 
-		float random = (float)rand() / (float)RAND_MAX;
-		if(random < p->conf.species_crossover_probability){
-			/* Do a crossover */
-			//TODO: do crossover
-		}else{
-			/* Select a random genome from the species */
-			struct neat_genome *g = neat_species_select_genitor(s);
-			neat_replace_genome(p, worst_genome, g);
+	/* Always keep at least one genome to reproduce from */
+	size_t nculled = p->conf.epoch_replacement_fraction * p->ngenomes;
+	if(nculled >= p->ngenomes){
+		nculled = p->ngenomes - 1;
+	}
+	if(nculled > neligible){
+		nculled = neligible;
+	}
+	if(nculled == 0){
+		NEAT_STATS_STOP(p, selection_cycles, selection);
+		return;
+	}
+
+	qsort(p->ranks, neligible, sizeof(struct neat_genome_rank),
+	      neat_compare_ranks);
+
+	/* Keep the genomes that were handed out after they were ranked */
+	size_t nclaimed = 0;
+	for(size_t i = 0; i < neligible && nclaimed < nculled; i++){
+		if(neat_claim_genome(p, p->ranks[i].genome_id)){
+			p->ranks[nclaimed++] = p->ranks[i];
 		}
+	}
+	nculled = nclaimed;
+
+	NEAT_STATS_STOP(p, selection_cycles, selection);
 
-		neat_speciate_genome(p, worst_genome);
+	/* Remove the worst genomes from their species */
+	for(size_t i = 0; i < nculled; i++){
+		neat_remove_from_species(p, p->ranks[i].genome_id);
+	}
+
+	/* Calculate the chances of the species once for the whole generation */
+	float total_chance = neat_calculate_species_chances(p);
 
-		break;
+	/* The children are only added to species after all of them are created
+	 * so they can't be picked as genitors of each other
+	 */
+	for(size_t i = 0; i < nculled; i++){
+		size_t species = neat_pick_species(p, total_chance);
+		neat_reproduce_genome(p, p->ranks[i].genome_id,
+				      p->species[species]);
+	}
+
+	size_t *children = p->speciating;
+	for(size_t i = 0; i < nculled; i++){
+		children[i] = p->ranks[i].genome_id;
+	}
+	neat_pick_representants(p);
+	neat_speciate_genomes(p, children, nculled);
+
+	for(size_t i = 0; i < nculled; i++){
+		neat_release_genome(p, children[i]);
 	}
 }
 
-neat_t neat_create(struct neat_config config)
+bool neat_insert_genome(struct neat_pop *p,
+			const void *packed,
+			size_t size,
+			float fitness)
+{
+	assert(p);
+	assert(packed);
+
+	if(!neat_genome_can_unpack(p->pool, p->conf, packed, size)){
+		return false;
+	}
+
+	omp_set_lock(&p->lock);
+
+	size_t worst_genome = 0;
+	if(!neat_claim_worst_fitness(p, &worst_genome)){
+		omp_unset_lock(&p->lock);
+		return false;
+	}
+
+	/* Destroy the old genome first, its data block might be the only free
+	 * one left
+	 */
+	neat_remove_from_species(p, worst_genome);
+	neat_genome_destroy(p->pool, p->genomes[worst_genome]);
+
+	struct neat_genome *genome = neat_genome_unpack(p->pool,
+							p->conf,
+							packed,
+							size);
+	p->genomes[worst_genome] = genome;
+	p->fitness[worst_genome] = fitness;
+	p->time_alive[worst_genome] = 0;
+
+	neat_push_young(p, worst_genome);
+	neat_speciate_genome(p, worst_genome);
+
+	neat_release_genome(p, worst_genome);
+	neat_remove_extinct_species(p);
+	omp_unset_lock(&p->lock);
+
+	return true;
+}
+
+struct neat_pop *neat_alloc_population(struct neat_config config,
+					struct neat_genome_pool *pool)
 {
 	assert(config.population_size > 0);
+	assert(pool);
 
 	struct neat_pop *p = calloc(1, sizeof(struct neat_pop));
 	assert(p);
@@ -156,18 +687,138 @@ neat_t neat_create(struct neat_config config)
 	p->conf = config;
 	p->innovation = 1;
 
-	/* Create a genome and copy it n times where n is the population size */
 	p->ngenomes = config.population_size;
 	p->genomes = malloc(sizeof(struct neat_genome*) *
 			    config.population_size);
-	assert(p->ngenomes);
+	assert(p->genomes);
 
-	neat_reset_genomes(p);
+	p->fitness = calloc(config.population_size, sizeof(float));
+	assert(p->fitness);
+	/* No data has version 0 so nothing is cached yet */
+	p->cache = calloc(config.population_size,
+			  sizeof(struct neat_cached_fitness));
+	assert(p->cache);
+	p->time_alive = calloc(config.population_size, sizeof(size_t));
+	assert(p->time_alive);
+	p->species_of = malloc(sizeof(size_t) * config.population_size);
+	assert(p->species_of);
+	p->species_slot = calloc(config.population_size, sizeof(size_t));
+	assert(p->species_slot);
+	for(size_t i = 0; i < config.population_size; i++){
+		p->species_of[i] = NEAT_NO_SPECIES;
+	}
+
+	p->ranks = malloc(sizeof(struct neat_genome_rank) *
+			  config.population_size);
+	assert(p->ranks);
+
+	omp_init_lock(&p->lock);
+	p->in_flight = malloc(sizeof(atomic_bool) * config.population_size);
+	assert(p->in_flight);
+	for(size_t i = 0; i < config.population_size; i++){
+		atomic_init(p->in_flight + i, false);
+	}
+	atomic_init(&p->next_genome, 0);
+	atomic_init(&p->asynchronous, false);
+	p->nreports = 0;
+
+	p->young = malloc(sizeof(size_t) * config.population_size);
+	assert(p->young);
+	atomic_init(&p->young_head, 0);
+	atomic_init(&p->young_tail, 0);
+
+	p->speciating = malloc(sizeof(size_t) * config.population_size);
+	p->compatible_species = malloc(sizeof(size_t) * config.population_size);
+	assert(p->speciating && p->compatible_species);
+	p->new_species = malloc(sizeof(size_t) * config.population_size);
+	p->new_representants = malloc(sizeof(struct neat_genome*) *
+				      config.population_size);
+	assert(p->new_species && p->new_representants);
+	p->nnew_species = 0;
+
+	p->mutation_scratch = malloc(sizeof(float) *
+				     neat_genome_scratch_size(config));
+	assert(p->mutation_scratch);
+
+	p->migration_message = malloc(neat_genome_message_size(p));
+	p->migration_ranks = malloc(sizeof(struct neat_genome_rank) *
+				    config.population_size);
+	assert(p->migration_message && p->migration_ranks);
+
+	p->pool = pool;
+
+	p->backend = neat_get_backend(config.backend);
+	p->backend_state = p->backend->create(p);
+
+	/* Enough generators for the evaluation threads */
+	p->nrngs = omp_get_max_threads();
+	if(config.evaluation_threads > p->nrngs){
+		p->nrngs = config.evaluation_threads;
+	}
+	p->rngs = malloc(sizeof(struct nn_rng) * p->nrngs);
+	assert(p->rngs);
+
+	struct nn_rng rng;
+	nn_rng_seed(&rng, config.random_seed);
+	neat_seed_rngs(p, rng);
+
+#ifdef NEAT_STATS
+	p->nthread_stats = p->nrngs;
+	p->thread_stats = aligned_alloc(NEAT_STATS_LINE,
+					sizeof(struct neat_thread_stats) *
+					p->nthread_stats);
+	assert(p->thread_stats);
+	for(size_t i = 0; i < p->nthread_stats; i++){
+		atomic_init(&p->thread_stats[i].nruns, 0);
+		atomic_init(&p->thread_stats[i].nflops, 0);
+	}
+#endif
 
-	/* Create the starting species */
 	p->nspecies = 0;
+	p->species_capacity = 0;
 	p->species = NULL;
-	neat_create_new_species(p, p->genomes[0]);
+
+	return p;
+}
+
+void neat_seed_rngs(struct neat_pop *p, struct nn_rng rng)
+{
+	assert(p);
+
+	/* Every generator continues where the streams of the previous ones
+	 * end
+	 */
+	p->rngs[0] = rng;
+	for(size_t i = 1; i < p->nrngs; i++){
+		p->rngs[i] = p->rngs[i - 1];
+		nn_rng_jump(p->rngs + i);
+	}
+}
+
+neat_t neat_create(struct neat_config config)
+{
+	assert(config.population_size > 0);
+
+	/* The packed backend runs the genomes from the tensor of the pool and
+	 * reduced weights are only stored in its rows
+	 */
+	if(config.backend == NEAT_BACKEND_PACKED ||
+	   config.network_precision != NN_PRECISION_FLOAT){
+		config.packed_weights = true;
+	}
+
+	struct neat_genome_pool *pool =
+		neat_genome_pool_create(config, config.population_size);
+	struct neat_pop *p = neat_alloc_population(config, pool);
+
+	/* Create a genome and copy it n times where n is the population size */
+	neat_reset_genomes(p);
+
+	/* Create the starting species containing every genome */
+	neat_create_new_species(p);
+	for(size_t i = 0; i < p->ngenomes; i++){
+		neat_add_to_species(p, 0, i);
+	}
 
 	return p;
 }
@@ -178,14 +829,41 @@ void neat_destroy(neat_t population)
 	assert(p);
 
 	for(size_t i = 0; i < p->ngenomes; i++){
-		neat_genome_destroy(p->genomes[i]);
+		neat_genome_destroy(p->pool, p->genomes[i]);
 	}
 	free(p->genomes);
+	free(p->fitness);
+	free(p->cache);
+	free(p->time_alive);
+	free(p->species_of);
+	free(p->species_slot);
+	free(p->ranks);
+	p->backend->destroy(p->backend_state);
+	omp_destroy_lock(&p->lock);
+	free(p->in_flight);
+	free(p->young);
+	free(p->speciating);
+	free(p->compatible_species);
+	free(p->new_species);
+	free(p->new_representants);
+	free(p->mutation_scratch);
+	free(p->migration_message);
+	free(p->migration_ranks);
+	neat_genome_pool_destroy(p->pool);
+	free(p->rngs);
+#ifdef NEAT_STATS
+	free(p->thread_stats);
+#endif
+	if(p->image != NULL){
+		munmap(p->image, p->image_size);
+	}
 
 	for(size_t i = 0; i < p->nspecies; i++){
 		neat_species_destroy(p->species[i]);
 	}
 	free(p->species);
+	free(p->species_chances);
+	free(p->representants);
 	free(p);
 }
 
@@ -197,26 +875,288 @@ const float *neat_run(neat_t population,
 	assert(p);
 	assert(genome_id < p->ngenomes);
 
-	return neat_genome_run(p->genomes[genome_id], inputs);
+	struct neat_genome *genome = p->genomes[genome_id];
+	if(genome->program == NULL){
+		NEAT_STATS_ADD(p, ncompilations, 1);
+	}
+	NEAT_STATS_ADD_THREAD(p, nruns, 1);
+	NEAT_STATS_ADD_THREAD(p, nflops, 2 * genome->net->nweights);
+
+	return neat_genome_run(genome, inputs);
 }
 
-void neat_epoch(neat_t population)
+struct nn_program *neat_export(neat_t population, size_t genome_id)
 {
 	struct neat_pop *p = population;
 	assert(p);
+	assert(genome_id < p->ngenomes);
+
+	const struct neat_genome *genome = p->genomes[genome_id];
+
+	/* Compile a new one, the cached program belongs to the genome */
+	struct nn_program *program = neat_genome_program(genome);
+	if(genome->reduced_weights == NULL){
+		return program;
+	}
+
+	/* It runs on the row of the genome, which changes with the genome */
+	struct nn_program *copy = nn_program_copy(program);
+	nn_program_destroy(program);
+
+	return copy;
+}
+
+size_t neat_get_best_genome(neat_t population)
+{
+	struct neat_pop *p = population;
+	assert(p);
+
+	size_t best = 0;
+	for(size_t i = 1; i < p->ngenomes; i++){
+		if(p->fitness[i] > p->fitness[best]){
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+void neat_run_batch(neat_t population,
+		    const float *inputs,
+		    size_t nsamples,
+		    float *outputs)
+{
+	struct neat_pop *p = population;
+	assert(p);
+	assert(inputs);
+	assert(outputs);
+
+	p->backend->run_batch(p->backend_state, p, inputs, nsamples, outputs);
+
+#ifdef NEAT_STATS
+	uint64_t nweights = 0;
+	for(size_t i = 0; i < p->ngenomes; i++){
+		nweights += p->genomes[i]->net->nweights;
+	}
+	NEAT_STATS_ADD(p, nflops, 2 * nweights * nsamples);
+	NEAT_STATS_ADD(p, nruns, p->ngenomes * nsamples);
+#endif
+}
+
+#ifdef NEAT_STATS
+/* Move what the threads counted in neat_run to the stats */
+static void neat_merge_thread_stats(struct neat_pop *p)
+{
+	for(size_t i = 0; i < p->nthread_stats; i++){
+		struct neat_thread_stats *thread = p->thread_stats + i;
+		uint64_t nruns = atomic_exchange(&thread->nruns, 0);
+		uint64_t nflops = atomic_exchange(&thread->nflops, 0);
+		NEAT_STATS_ADD(p, nruns, nruns);
+		NEAT_STATS_ADD(p, nflops, nflops);
+	}
+}
+#endif
+
+/* cached:	use and fill the fitness cache for the input set */
+static void neat_evaluate_genomes(struct neat_pop *p,
+				  neat_fitness_fn fitness,
+				  void *userdata,
+				  bool cached,
+				  uint64_t input_set)
+{
+	assert(p);
+	assert(fitness);
+
+	int nthreads = neat_thread_count(p);
+
+	/* Compile them all first so the fitness function can run any genome
+	 * without changing it
+	 */
+	NEAT_STATS_START(evaluation);
+#ifdef NEAT_STATS
+	double start = omp_get_wtime();
+#endif
+
+	#pragma omp parallel for num_threads(nthreads)
+	for(size_t i = 0; i < p->ngenomes; i++){
+		if(p->genomes[i]->program == NULL){
+			NEAT_STATS_ADD(p, ncompilations, 1);
+		}
+		neat_genome_compile(p->genomes[i]);
+	}
+
+	#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+	for(size_t i = 0; i < p->ngenomes; i++){
+		struct neat_cached_fitness *entry = p->cache + i;
+		uint64_t version = p->genomes[i]->data->version;
+
+		if(cached &&
+		   entry->version == version &&
+		   entry->input_set == input_set){
+			neat_set_fitness(p, i, entry->fitness);
+			NEAT_STATS_ADD(p, ncache_hits, 1);
+		}else{
+			float result = fitness(p, i, userdata);
+			neat_set_fitness(p, i, result);
+			NEAT_STATS_ADD(p, nevaluations, 1);
+
+			if(cached){
+				entry->version = version;
+				entry->input_set = input_set;
+				entry->fitness = result;
+			}
+		}
+
+		neat_increase_time_alive(p, i);
+	}
+
+	NEAT_STATS_STOP(p, evaluation_cycles, evaluation);
+#ifdef NEAT_STATS
+	p->stats.evaluation_seconds += omp_get_wtime() - start;
+	neat_merge_thread_stats(p);
+#endif
+}
+
+void neat_evaluate(neat_t population, neat_fitness_fn fitness, void *userdata)
+{
+	neat_evaluate_genomes(population, fitness, userdata, false, 0);
+}
+
+void neat_evaluate_cached(neat_t population,
+			  neat_fitness_fn fitness,
+			  void *userdata,
+			  uint64_t input_set)
+{
+	neat_evaluate_genomes(population, fitness, userdata, true, input_set);
+}
+
+/* Must be called while holding the lock */
+static void neat_run_epoch(struct neat_pop *p)
+{
+	assert(p);
+
+	NEAT_STATS_START(epoch);
 
 	size_t worst_genome = 0;
-	if(!neat_find_worst_fitness(p, &worst_genome)){
-		return;
+	if(p->conf.epoch_replacement_fraction > 0.0f){
+		neat_generational_epoch(p);
+	}else if(neat_claim_worst_fitness(p, &worst_genome)){
+		neat_remove_from_species(p, worst_genome);
+
+		neat_select_reproduction_species(p, worst_genome);
+		neat_release_genome(p, worst_genome);
 	}
 
-	/* Remove the worst genome from the species if it contains it */
+	neat_remove_extinct_species(p);
+
+	NEAT_STATS_STOP(p, epoch_cycles, epoch);
+	NEAT_STATS_ADD(p, nepochs, 1);
+}
+
+void neat_epoch(neat_t population)
+{
+	struct neat_pop *p = population;
+	assert(p);
+
+	omp_set_lock(&p->lock);
+	neat_run_epoch(p);
+	omp_unset_lock(&p->lock);
+}
+
+void neat_speciate(neat_t population)
+{
+	struct neat_pop *p = population;
+	assert(p);
+
+	omp_set_lock(&p->lock);
+
+	/* Compare with the species as they are before emptying them */
+	neat_pick_representants(p);
+
+	/* The room of the species is used again for the genomes they get */
 	for(size_t i = 0; i < p->nspecies; i++){
-		neat_species_remove_genome(p->species[i],
-					   p->genomes[worst_genome]);
+		neat_species_clear(p->species[i]);
+	}
+	for(size_t i = 0; i < p->ngenomes; i++){
+		p->species_of[i] = NEAT_NO_SPECIES;
+		p->speciating[i] = i;
+	}
+
+	neat_speciate_genomes(p, p->speciating, p->ngenomes);
+
+	/* Free the room of the species that stayed empty or got smaller */
+	for(size_t i = 0; i < p->nspecies; i++){
+		if(neat_species_shrink(p->species[i])){
+			NEAT_STATS_ADD(p, nallocations, 1);
+		}
+	}
+	neat_remove_extinct_species(p);
+
+	omp_unset_lock(&p->lock);
+}
+
+size_t neat_get_species(neat_t population, size_t genome_id)
+{
+	struct neat_pop *p = population;
+	assert(p);
+	assert(genome_id < p->ngenomes);
+
+	return p->species_of[genome_id];
+}
+
+size_t neat_acquire_genome(neat_t population)
+{
+	struct neat_pop *p = population;
+	assert(p);
+
+	/* From now on children are queued to be evaluated first */
+	if(!atomic_load_explicit(&p->asynchronous, memory_order_relaxed)){
+		atomic_store(&p->asynchronous, true);
+	}
+
+	size_t genome_id;
+	while((genome_id = neat_pop_young(p)) != NEAT_NO_GENOME){
+		if(neat_claim_genome(p, genome_id)){
+			return genome_id;
+		}
 	}
 
-	neat_select_reproduction_species(p, worst_genome);
+	/* Hand out the others in turns so they all get results */
+	for(size_t i = 0; i < p->ngenomes; i++){
+		genome_id = atomic_fetch_add(&p->next_genome, 1) % p->ngenomes;
+		if(neat_claim_genome(p, genome_id)){
+			return genome_id;
+		}
+	}
+
+	return NEAT_NO_GENOME;
+}
+
+void neat_report_fitness(neat_t population, size_t genome_id, float fitness)
+{
+	struct neat_pop *p = population;
+	assert(p);
+	assert(genome_id < p->ngenomes);
+	assert(atomic_load(p->in_flight + genome_id));
+
+	omp_set_lock(&p->lock);
+
+	neat_set_fitness(p, genome_id, fitness);
+	neat_increase_time_alive(p, genome_id);
+	NEAT_STATS_ADD(p, nevaluations, 1);
+
+	/* It needs more results before it can be replaced */
+	if(p->time_alive[genome_id] <= p->conf.genome_minimum_ticks_alive){
+		neat_push_young(p, genome_id);
+	}
+	neat_release_genome(p, genome_id);
+
+	if(++p->nreports >= p->conf.epoch_reports){
+		p->nreports = 0;
+		neat_run_epoch(p);
+	}
+
+	omp_unset_lock(&p->lock);
 }
 
 void neat_set_fitness(neat_t population, size_t genome_id, float fitness)
@@ -225,7 +1165,24 @@ void neat_set_fitness(neat_t population, size_t genome_id, float fitness)
 	assert(p);
 	assert(genome_id < p->ngenomes);
 
-	p->genomes[genome_id]->fitness = fitness;
+	/* Keep the fitness sum of its species up to date */
+	size_t species = p->species_of[genome_id];
+	if(species != NEAT_NO_SPECIES){
+		neat_species_update_fitness(p->species[species],
+					    p->fitness[genome_id],
+					    fitness);
+	}
+
+	p->fitness[genome_id] = fitness;
+}
+
+float neat_get_fitness(neat_t population, size_t genome_id)
+{
+	struct neat_pop *p = population;
+	assert(p);
+	assert(genome_id < p->ngenomes);
+
+	return p->fitness[genome_id];
 }
 
 void neat_increase_time_alive(neat_t population, size_t genome_id)
@@ -234,5 +1191,61 @@ void neat_increase_time_alive(neat_t population, size_t genome_id)
 	assert(p);
 	assert(genome_id < p->ngenomes);
 
-	p->genomes[genome_id]->time_alive++;
+	p->time_alive[genome_id]++;
+}
+
+bool neat_get_stats(neat_t population, struct neat_stats *stats)
+{
+	struct neat_pop *p = population;
+	assert(p);
+	assert(stats);
+
+#ifdef NEAT_STATS
+	neat_merge_thread_stats(p);
+	*stats = p->stats;
+
+	if(stats->evaluation_seconds > 0.0){
+		stats->evaluations_per_second = stats->nevaluations /
+						stats->evaluation_seconds;
+	}
+
+	/* The species change every epoch so count them now */
+	stats->nspecies = 0;
+	stats->smallest_species = 0;
+	stats->largest_species = 0;
+	for(size_t i = 0; i < p->nspecies; i++){
+		size_t ngenomes = p->species[i]->ngenomes;
+		if(ngenomes == 0){
+			continue;
+		}
+
+		if(stats->nspecies == 0 || ngenomes < stats->smallest_species){
+			stats->smallest_species = ngenomes;
+		}
+		if(ngenomes > stats->largest_species){
+			stats->largest_species = ngenomes;
+		}
+		stats->nspecies++;
+	}
+
+	return true;
+#else
+	memset(stats, 0, sizeof(struct neat_stats));
+
+	return false;
+#endif
+}
+
+void neat_reset_stats(neat_t population)
+{
+	struct neat_pop *p = population;
+	assert(p);
+
+#ifdef NEAT_STATS
+	memset(&p->stats, 0, sizeof(struct neat_stats));
+	for(size_t i = 0; i < p->nthread_stats; i++){
+		atomic_store(&p->thread_stats[i].nruns, 0);
+		atomic_store(&p->thread_stats[i].nflops, 0);
+	}
+#endif
 }
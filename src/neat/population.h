@@ -4,17 +4,148 @@
 
 #include "species.h"
 #include "genome.h"
+#include "pool.h"
+#include "stats.h"
+#include "backend.h"
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <omp.h>
+
+/* Species index of genomes that are not part of any species */
+#define NEAT_NO_SPECIES SIZE_MAX
+
+/* Fitness of a genome the last time it was evaluated by neat_evaluate_cached,
+ * only valid while its data has the same version
+ */
+struct neat_cached_fitness{
+	uint64_t version, input_set;
+	float fitness;
+};
+
+/* Used to sort the genomes by fitness */
+struct neat_genome_rank{
+	float fitness;
+	size_t genome_id;
+};
 
 struct neat_pop{
 	struct neat_config conf;
 
 	bool solved;
 
+	/* Storage of the genomes, recycled when a genome gets replaced */
+	struct neat_genome_pool *pool;
+
 	struct neat_genome **genomes;
 	size_t ngenomes;
 
+	/* Indexed by the genome, kept next to each other so selection can
+	 * scan them without touching the genomes themselves
+	 */
+	float *fitness;
+	size_t *time_alive;
+	size_t *species_of;
+	size_t *species_slot;
+	/* Copied with the fitness to children that share the data */
+	struct neat_cached_fitness *cache;
+
+	/* Species that died out stay until they're removed, see
+	 * reset_on_extinction
+	 */
 	struct neat_species **species;
-	size_t nspecies;
+	size_t nspecies, species_capacity;
+
+	/* Runs neat_run_batch with its own copy of the genomes */
+	const struct neat_backend_ops *backend;
+	void *backend_state;
+
+	/* Scratch space for the generational epochs */
+	struct neat_genome_rank *ranks;
+	float *species_chances;
+
+	/* Representant of every species while speciating, NULL when empty */
+	const struct neat_genome **representants;
+	/* Genomes that are speciated at once and the species they're
+	 * compatible with
+	 */
+	size_t *speciating;
+	size_t *compatible_species;
+	/* Species created while speciating and their representants */
+	size_t *new_species;
+	const struct neat_genome **new_representants;
+	size_t nnew_species;
+	/* Used by the mutations of the children, they're made one at a time */
+	float *mutation_scratch;
 
+	/* Used by neat_migrate, a message of any genome and the genomes
+	 * ranked without holding the lock
+	 */
+	void *migration_message;
+	struct neat_genome_rank *migration_ranks;
+
+	/* Innovation number of the first place in the topology of the config,
+	 * the same in every population so migrants keep their genes
+	 */
 	int innovation;
+
+	/* A generator for every thread, the first one is used outside of the
+	 * parallel parts
+	 */
+	struct nn_rng *rngs;
+	size_t nrngs;
+
+	/* Held by everything that changes the genomes or species while genomes
+	 * are handed out by neat_acquire_genome
+	 */
+	omp_lock_t lock;
+	/* Set for genomes that are handed out or being replaced, these are
+	 * never picked for replacement
+	 */
+	atomic_bool *in_flight;
+	atomic_size_t next_genome;
+	atomic_bool asynchronous;
+	size_t nreports;
+
+	/* Ring of genomes that need results before they can be replaced, it's
+	 * only filled while holding the lock and emptied without it. A genome
+	 * is never in it twice so it has room for all of them
+	 */
+	size_t *young;
+	atomic_size_t young_head, young_tail;
+
+	/* File mapped by neat_load, the data of the genomes is stored in it */
+	void *image;
+	size_t image_size;
+
+#ifdef NEAT_STATS
+	struct neat_stats stats;
+	/* Counted in by neat_run, a struct for every generator */
+	struct neat_thread_stats *thread_stats;
+	size_t nthread_stats;
+#endif
 };
+
+/* Allocate a population without any genomes or species
+ * pool:	storage for the genomes, owned by the population afterwards
+ */
+struct neat_pop *neat_alloc_population(struct neat_config config,
+				       struct neat_genome_pool *pool);
+
+/* Threads used for the parallel parts of the population */
+int neat_thread_count(const struct neat_pop *p);
+
+/* Give every thread a generator that follows from rng */
+void neat_seed_rngs(struct neat_pop *p, struct nn_rng rng);
+
+struct neat_species *neat_create_new_species(struct neat_pop *p);
+
+/* Replace the worst genome that lived long enough with a packed genome, see
+ * neat_genome_pack
+ *
+ * return false when the genome doesn't fit or no genome can be replaced
+ */
+bool neat_insert_genome(struct neat_pop *p,
+			const void *packed,
+			size_t size,
+			float fitness);
@@ -2,27 +2,17 @@
 
 #include <assert.h>
 
-struct neat_species *neat_species_create(struct neat_config config,
-					 struct neat_genome *base_genome)
-{
-	assert(config.population_size > 0);
+/* Smallest room for genomes that is allocated */
+#define NEAT_SPECIES_MIN_CAPACITY 8
 
+struct neat_species *neat_species_create(void)
+{
 	struct neat_species *species = calloc(1, sizeof(struct neat_species));
 	assert(species);
 
-	/* Create all the genomes but don't use them yet */
-	species->genomes = calloc(config.population_size,
-				  sizeof(struct neat_genome*));
-	assert(species->genomes);
-
-	if(base_genome == NULL){
-		species->ngenomes = 0;
-	}else{
-		species->ngenomes = config.population_size;
-		for(size_t i = 0; i < species->ngenomes; i++){
-			species->genomes[i] = base_genome;
-		}
-	}
+	species->genomes = NULL;
+	species->ngenomes = 0;
+	species->capacity = 0;
 
 	return species;
 }
@@ -30,12 +20,35 @@ struct neat_species *neat_species_create(struct neat_config config,
 void neat_species_destroy(struct neat_species *species)
 {
 	assert(species);
-	assert(species->genomes);
 
 	free(species->genomes);
 	free(species);
 }
 
+static void neat_species_resize(struct neat_species *species, size_t capacity)
+{
+	assert(capacity >= species->ngenomes);
+
+	if(capacity == 0){
+		free(species->genomes);
+		species->genomes = NULL;
+	}else{
+		species->genomes = realloc(species->genomes,
+					   sizeof(size_t) * capacity);
+		assert(species->genomes);
+	}
+	species->capacity = capacity;
+}
+
+void neat_species_reserve(struct neat_species *species, size_t count)
+{
+	assert(species);
+
+	if(count > species->capacity){
+		neat_species_resize(species, count);
+	}
+}
+
 float neat_species_get_adjusted_fitness(struct neat_species *species,
 					float fitness)
 {
@@ -49,80 +62,150 @@ float neat_species_get_average_fitness(struct neat_species *species)
 {
 	assert(species);
 
-	float sum_fitness = 0.0f;
-	for(size_t i = 0; i < species->ngenomes; i++){
-		/* We can get the adjusted fitness for every node by dividing
-		 * them all but it's better to do one divide at the end
-		 */
-		sum_fitness += species->genomes[i]->fitness;
+	if(species->ngenomes == 0){
+		return 0.0f;
 	}
 
-	return sum_fitness / (float)(species->ngenomes * 2);
+	/* We can get the adjusted fitness for every node by dividing them all
+	 * but it's better to do one divide at the end
+	 */
+	return species->fitness_sum / (double)(species->ngenomes * 2);
 }
 
-struct neat_genome *neat_species_select_genitor(struct neat_species *species)
+void neat_species_update_fitness(struct neat_species *species,
+				 float old_fitness,
+				 float new_fitness)
+{
+	assert(species);
+
+	double delta = (double)new_fitness - (double)old_fitness;
+
+	#pragma omp atomic update
+	species->fitness_sum += delta;
+}
+
+size_t neat_species_select_genitor(struct neat_species *species,
+				   struct nn_rng *rng)
 {
 	assert(species);
 	assert(species->ngenomes > 0);
 
-	return species->genomes[rand() % species->ngenomes];
+	return species->genomes[nn_rng_index(rng, species->ngenomes)];
 }
 
-struct neat_genome *neat_species_get_representant(struct neat_species *species)
+size_t neat_species_get_representant(struct neat_species *species,
+				     struct nn_rng *rng)
 {
 	assert(species);
 	assert(species->ngenomes > 0);
 
 	//TODO track the representant, for now just return a random genome
 
-	return species->genomes[rand() % species->ngenomes];
+	return species->genomes[nn_rng_index(rng, species->ngenomes)];
 }
 
-void neat_species_add_genome(struct neat_species *species,
-			     struct neat_genome *genome)
+bool neat_species_add_genome(struct neat_species *species,
+			     size_t genome_id,
+			     const float *fitness,
+			     size_t *slots)
 {
 	assert(species);
-	assert(genome);
+	assert(fitness);
+	assert(slots);
+
+	/* Double the room so adding is amortized constant time */
+	bool resized = species->ngenomes == species->capacity;
+	if(resized){
+		size_t capacity = species->capacity * 2;
+		if(capacity < NEAT_SPECIES_MIN_CAPACITY){
+			capacity = NEAT_SPECIES_MIN_CAPACITY;
+		}
+		neat_species_resize(species, capacity);
+	}
 
-	species->genomes[species->ngenomes] = genome;
+	slots[genome_id] = species->ngenomes;
+	species->genomes[species->ngenomes] = genome_id;
 	species->ngenomes++;
+	species->active = true;
+
+	species->fitness_sum += fitness[genome_id];
+
+	return resized;
 }
 
-void neat_species_remove_genome(struct neat_species *species,
-				struct neat_genome *genome)
+bool neat_species_remove_genome(struct neat_species *species,
+				size_t genome_id,
+				const float *fitness,
+				size_t *slots)
 {
 	assert(species);
-	assert(genome);
+	assert(fitness);
+	assert(neat_species_contains_genome(species, genome_id, slots));
+
+	/* Put the last genome on this position
+	 * (this will do nothing if it already is the last one)
+	 */
+	size_t slot = slots[genome_id];
+	size_t last = species->genomes[--species->ngenomes];
+	species->genomes[slot] = last;
+	slots[last] = slot;
+
+	species->fitness_sum -= fitness[genome_id];
+
+	/* Shrink late so adding and removing a genome doesn't resize every
+	 * time
+	 */
+	if(species->ngenomes == 0){
+		species->active = false;
+		species->fitness_sum = 0.0;
+	}
 
-	for(size_t i = 0; i < species->ngenomes; i++){
-		if(species->genomes[i] != genome){
-			continue;
-		}
+	return neat_species_shrink(species);
+}
 
-		/* Put the last genome on this position
-		 * (this will do nothing if it already is the last one)
-		 */
+void neat_species_clear(struct neat_species *species)
+{
+	assert(species);
 
-		printf("%p\n", (void*)species->genomes[i]);
-		species->genomes[i] = species->genomes[--species->ngenomes];
-		species->genomes[species->ngenomes] = NULL;
-		printf("%p\n", (void*)species->genomes[i]);
+	species->active = false;
+	species->ngenomes = 0;
+	species->fitness_sum = 0.0;
+}
+
+bool neat_species_shrink(struct neat_species *species)
+{
+	assert(species);
+
+	/* A species without genomes doesn't need any room */
+	size_t capacity = species->capacity;
+	if(species->ngenomes == 0){
+		capacity = 0;
+	}
+	while(species->ngenomes > 0 &&
+	      species->ngenomes <= capacity / 4 &&
+	      capacity > NEAT_SPECIES_MIN_CAPACITY){
+		capacity /= 2;
+	}
 
-		return;
+	if(capacity == species->capacity){
+		return false;
 	}
+
+	neat_species_resize(species, capacity);
+	return capacity > 0;
 }
 
 bool neat_species_contains_genome(struct neat_species *species,
-				  struct neat_genome *genome)
+				  size_t genome_id,
+				  const size_t *slots)
 {
 	assert(species);
-	assert(genome);
+	assert(slots);
 
-	for(size_t i = 0; i < species->ngenomes; i++){
-		if(species->genomes[i] == genome){
-			return true;
-		}
-	}
+	/* A genome is only in a single species so if the slot of another
+	 * species is stored it will contain a different genome here
+	 */
+	size_t slot = slots[genome_id];
 
-	return false;
+	return slot < species->ngenomes && species->genomes[slot] == genome_id;
 }
@@ -5,28 +5,71 @@
 #include "genome.h"
 
 struct neat_species{
+	/* False after the last genome is removed, until a genome is added */
 	bool active;
 
-	struct neat_genome **genomes;
-	size_t ngenomes;
+	/* Indices of the genomes in the population, grows and shrinks with the
+	 * amount of genomes and is freed when the species dies out
+	 */
+	size_t *genomes;
+	size_t ngenomes, capacity;
+
+	/* Kept up to date when genomes are added, removed or get a new
+	 * fitness so the average doesn't need to visit the genomes
+	 */
+	double fitness_sum;
 };
 
-struct neat_species *neat_species_create(struct neat_config config,
-					 struct neat_genome *base_genome);
+/* Create an empty species, it doesn't allocate room for genomes yet */
+struct neat_species *neat_species_create(void);
 void neat_species_destroy(struct neat_species *species);
 
+/* Make room for at least count genomes */
+void neat_species_reserve(struct neat_species *species, size_t count);
+
 float neat_species_get_adjusted_fitness(struct neat_species *species,
 					float fitness);
 float neat_species_get_average_fitness(struct neat_species *species);
 
-struct neat_genome *neat_species_select_genitor(struct neat_species *species);
+/* Change the fitness of a member of the species, safe to call from multiple
+ * threads at once
+ */
+void neat_species_update_fitness(struct neat_species *species,
+				 float old_fitness,
+				 float new_fitness);
+
+size_t neat_species_select_genitor(struct neat_species *species,
+				   struct nn_rng *rng);
+
+size_t neat_species_get_representant(struct neat_species *species,
+				     struct nn_rng *rng);
 
-struct neat_genome *neat_species_get_representant(struct neat_species *species);
+/* fitness:	fitness of every genome in the population
+ * slots:	position of every genome inside of its species, updated when
+ * 		genomes are added or moved
+ *
+ * return true when the genomes were reallocated
+ */
+bool neat_species_add_genome(struct neat_species *species,
+			     size_t genome_id,
+			     const float *fitness,
+			     size_t *slots);
+bool neat_species_remove_genome(struct neat_species *species,
+				size_t genome_id,
+				const float *fitness,
+				size_t *slots);
+/* Remove every genome but keep the room for them, so the species can be
+ * filled again without allocating
+ */
+void neat_species_clear(struct neat_species *species);
+/* Give room back that isn't needed for the genomes, all of it when the
+ * species is empty
+ *
+ * return true when the genomes were reallocated, not when they're freed
+ */
+bool neat_species_shrink(struct neat_species *species);
 
-void neat_species_add_genome(struct neat_species *species,
-			     struct neat_genome *genome);
-void neat_species_remove_genome(struct neat_species *species,
-				struct neat_genome *genome);
 bool neat_species_contains_genome(struct neat_species *species,
-				  struct neat_genome *genome);
+				  size_t genome_id,
+				  const size_t *slots);
 
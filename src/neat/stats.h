@@ -0,0 +1,88 @@
+#pragma once
+
+#include <neat.h>
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <omp.h>
+
+/* The counters of struct neat_stats are only kept when built with
+ * NEAT_STATS, otherwise all of these compile to nothing
+ */
+#ifdef NEAT_STATS
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+static inline uint64_t neat_stats_cycles(void)
+{
+	return __rdtsc();
+}
+#else
+#include <time.h>
+
+/* Count nanoseconds when there is no cycle counter */
+static inline uint64_t neat_stats_cycles(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+#endif
+
+/* Start a timer in a local variable */
+#define NEAT_STATS_START(timer) \
+	uint64_t neat_stats_##timer = neat_stats_cycles()
+
+/* Add the cycles since the timer started to a field of the stats */
+#define NEAT_STATS_STOP(p, field, timer) \
+	(p)->stats.field += neat_stats_cycles() - neat_stats_##timer
+
+/* Safe to use from multiple threads */
+#define NEAT_STATS_ADD(p, field, amount) \
+	do{ \
+		_Pragma("omp atomic") \
+		(p)->stats.field += (amount); \
+	}while(0)
+
+#define NEAT_STATS_LINE 64
+
+/* Counters of neat_run kept for every thread, each on a cache line of its
+ * own so threads running genomes at the same time don't share one. They're
+ * moved to the stats after every evaluation and when the stats are read
+ */
+struct neat_thread_stats{
+	_Alignas(NEAT_STATS_LINE) _Atomic uint64_t nruns;
+	_Atomic uint64_t nflops;
+};
+
+/* Threads outside of the ones the population made counters for share the
+ * first one, the adds are atomic so that's still safe
+ */
+static inline struct neat_thread_stats *
+neat_stats_thread(struct neat_thread_stats *stats, size_t nstats)
+{
+	size_t thread = omp_get_thread_num();
+	if(thread >= nstats){
+		thread = 0;
+	}
+
+	return stats + thread;
+}
+
+#define NEAT_STATS_ADD_THREAD(p, field, amount) \
+	atomic_fetch_add_explicit( \
+		&neat_stats_thread((p)->thread_stats, \
+				   (p)->nthread_stats)->field, \
+		(amount), \
+		memory_order_relaxed)
+
+#else
+
+#define NEAT_STATS_START(timer) ((void)0)
+#define NEAT_STATS_STOP(p, field, timer) ((void)0)
+#define NEAT_STATS_ADD(p, field, amount) ((void)0)
+#define NEAT_STATS_ADD_THREAD(p, field, amount) ((void)0)
+
+#endif
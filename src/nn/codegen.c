@@ -0,0 +1,242 @@
+#include <nn.h>
+
+#include "kernel.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+/* The weight a dense instruction actually uses, whatever it's stored as */
+static float nn_codegen_weight(const struct nn_program *program,
+			       const struct nn_instruction *instruction,
+			       size_t index)
+{
+	switch(program->precision){
+		case NN_PRECISION_BF16:
+			return nn_bf16_to_float(program->weight_bf16[index]);
+		case NN_PRECISION_INT8:
+			return program->weight_int8[index] * instruction->scale;
+		default:
+			return program->weight[index];
+	}
+}
+
+static void nn_codegen_sizes(FILE *file,
+			     const char *name,
+			     const char *array,
+			     const size_t *values,
+			     size_t count)
+{
+	fprintf(file, "static const size_t %s_%s[%zu] = {", name, array, count);
+	for(size_t i = 0; i < count; i++){
+		fprintf(file, "%s%s%zu",
+			i > 0 ? "," : "",
+			i % 8 == 0 ? "\n\t" : " ",
+			values[i]);
+	}
+	fprintf(file, "\n};\n\n");
+}
+
+static void nn_codegen_floats_start(FILE *file,
+				    const char *name,
+				    const char *array,
+				    size_t count)
+{
+	fprintf(file, "static const float %s_%s[%zu] = {", name, array, count);
+}
+
+static void nn_codegen_float(FILE *file, size_t i, float value)
+{
+	fprintf(file, "%s%s", i > 0 ? "," : "", i % 4 == 0 ? "\n\t" : " ");
+
+	/* There are no literals for these, the generated code includes
+	 * math.h for the macros
+	 */
+	if(isnan(value)){
+		fprintf(file, "NAN");
+	}else if(isinf(value)){
+		fprintf(file, value < 0.0f ? "-INFINITY" : "INFINITY");
+	}else{
+		/* Nine digits are enough to get the exact same float back */
+		fprintf(file, "%.9ef", value);
+	}
+}
+
+static void nn_codegen_activation(FILE *file,
+				  const struct nn_instruction *instruction)
+{
+	const char *value = "values[%zu + i]";
+
+	fprintf(file,
+		"\tfor(size_t i = 0; i < %zu; i++){\n\t\t",
+		instruction->count);
+	fprintf(file, value, instruction->first);
+	fprintf(file, " = ");
+
+	switch(instruction->activation){
+		case NN_ACTIVATION_SIGMOID:
+			fprintf(file, "1.0f / (1.0f + expf(-");
+			fprintf(file, value, instruction->first);
+			fprintf(file, "));\n");
+			break;
+		case NN_ACTIVATION_FAST_SIGMOID:
+			fprintf(file, value, instruction->first);
+			fprintf(file, " / (1.0f + fabsf(");
+			fprintf(file, value, instruction->first);
+			fprintf(file, "));\n");
+			break;
+		case NN_ACTIVATION_RELU:
+			fprintf(file, "fmaxf(");
+			fprintf(file, value, instruction->first);
+			fprintf(file, ", 0.0f);\n");
+			break;
+	}
+
+	fprintf(file, "\t}\n");
+}
+
+bool nn_program_write_c(const struct nn_program *program,
+			FILE *file,
+			const char *name)
+{
+	assert(program);
+	assert(file);
+	assert(name);
+
+	fprintf(file,
+		"/* Generated by nn_program_write_c, don't edit */\n"
+		"#include <stddef.h>\n"
+		"#include <string.h>\n"
+		"#include <math.h>\n\n");
+
+	/* The weights of all dense instructions are stored as floats so the
+	 * code doesn't depend on the precision
+	 */
+	if(program->nweights > 0){
+		nn_codegen_floats_start(file, name, "weight",
+					program->nweights);
+		for(size_t i = 0; i < program->ninstructions; i++){
+			const struct nn_instruction *instruction =
+				program->instruction + i;
+			if(instruction->opcode != NN_OPCODE_DENSE){
+				continue;
+			}
+
+			size_t count = (instruction->nsources + 1) *
+				       instruction->count;
+			/* The bias is folded into the first weight of
+			 * every row, the values start with a 1 for it
+			 */
+			size_t row = instruction->nsources + 1;
+			for(size_t j = 0; j < count; j++){
+				size_t index = instruction->weight + j;
+				float weight = nn_codegen_weight(program,
+								 instruction,
+								 index);
+				if(j % row == 0){
+					weight *= program->bias;
+				}
+				nn_codegen_float(file, index, weight);
+			}
+		}
+		fprintf(file, "\n};\n\n");
+	}
+
+	if(program->nnodes > 0){
+		nn_codegen_sizes(file, name, "edge_start", program->edge_start,
+				 program->nnodes + 1);
+	}
+	if(program->nedges > 0){
+		nn_codegen_sizes(file, name, "edge_source",
+				 program->edge_source, program->nedges);
+
+		nn_codegen_floats_start(file, name, "edge_weight",
+					program->nedges);
+		for(size_t i = 0; i < program->nedges; i++){
+			nn_codegen_float(file, i, program->edge_weight[i]);
+		}
+		fprintf(file, "\n};\n\n");
+	}
+
+	fprintf(file,
+		"void %s(const float *inputs, float *outputs)\n"
+		"{\n"
+		"\tfloat values[%zu];\n"
+		"\tmemcpy(values, inputs, sizeof(float) * %zu);\n"
+		"\tvalues[%zu] = 1.0f;\n\n",
+		name,
+		program->nvalues,
+		program->ninputs,
+		program->ninputs);
+
+	for(size_t i = 0; i < program->ninstructions; i++){
+		const struct nn_instruction *instruction =
+			program->instruction + i;
+
+		switch(instruction->opcode){
+			case NN_OPCODE_DENSE:
+				fprintf(file,
+					"\tfor(size_t i = 0; i < %zu; i++){\n"
+					"\t\tconst float *row = "
+					"%s_weight + %zu + i * %zu;\n"
+					"\t\tfloat sum = row[0];\n"
+					"\t\tfor(size_t j = 0; j < %zu; j++){\n"
+					"\t\t\tsum += row[j + 1] * "
+					"values[%zu + j];\n"
+					"\t\t}\n"
+					"\t\tvalues[%zu + i] = sum;\n"
+					"\t}\n",
+					instruction->count,
+					name,
+					instruction->weight,
+					instruction->nsources + 1,
+					instruction->nsources,
+					instruction->source,
+					instruction->first);
+				break;
+			case NN_OPCODE_SPARSE:
+				if(program->nedges == 0){
+					fprintf(file,
+						"\tmemset(values + %zu, 0, "
+						"sizeof(float) * %zu);\n",
+						instruction->first,
+						instruction->count);
+					break;
+				}
+
+				fprintf(file,
+					"\tfor(size_t i = 0; i < %zu; i++){\n"
+					"\t\tsize_t first = "
+					"%s_edge_start[%zu + i];\n"
+					"\t\tsize_t last = "
+					"%s_edge_start[%zu + i + 1];\n"
+					"\t\tfloat sum = 0.0f;\n"
+					"\t\tfor(size_t j = first; j < last; "
+					"j++){\n"
+					"\t\t\tsum += %s_edge_weight[j] *\n"
+					"\t\t\t       "
+					"values[%s_edge_source[j]];\n"
+					"\t\t}\n"
+					"\t\tvalues[%zu + i] = sum;\n"
+					"\t}\n",
+					instruction->count,
+					name, instruction->weight,
+					name, instruction->weight,
+					name,
+					name,
+					instruction->first);
+				break;
+			case NN_OPCODE_ACTIVATE:
+				nn_codegen_activation(file, instruction);
+				break;
+		}
+	}
+
+	fprintf(file,
+		"\n\tmemcpy(outputs, values + %zu, sizeof(float) * %zu);\n"
+		"}\n",
+		program->output,
+		program->noutputs);
+
+	return !ferror(file);
+}
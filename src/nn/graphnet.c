@@ -0,0 +1,368 @@
+#include <nn.h>
+
+#include "kernel.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+
+static void nn_graphnet_set_pointers(struct nn_graphnet *net)
+{
+	assert(net);
+
+	/* The data behind the struct looks like this:
+	 * [ **struct**, level_end.., edge_start.., edge_source..,
+	 *   edge_weight.., output.. ]
+	 */
+	size_t ncomputed = net->nhiddens + net->noutputs;
+
+	net->level_end = (size_t*)(net + 1);
+	net->edge_start = net->level_end + net->nlevels;
+	net->edge_source = net->edge_start + ncomputed + 1;
+	net->edge_weight = (float*)(net->edge_source + net->nedges);
+	net->output = net->edge_weight + net->nedges;
+}
+
+struct nn_graphnet *nn_graphnet_create(size_t input_count,
+				       size_t hidden_count,
+				       size_t output_count,
+				       const struct nn_graphnet_edge *edges,
+				       size_t edge_count)
+{
+	assert(input_count > 0);
+	assert(output_count > 0);
+	assert(edges || edge_count == 0);
+
+	size_t first_output = input_count + 1;
+	size_t first_hidden = first_output + output_count;
+	size_t nnodes = first_hidden + hidden_count;
+
+	/* Temporary data to sort the nodes, the outgoing edges of every node
+	 * are needed for that
+	 */
+	size_t *level = calloc(nnodes, sizeof(size_t));
+	size_t *nincoming = calloc(nnodes, sizeof(size_t));
+	size_t *out_start = calloc(nnodes + 1, sizeof(size_t));
+	size_t *out_edges = malloc(sizeof(size_t) * (edge_count + 1));
+	size_t *queue = malloc(sizeof(size_t) * nnodes);
+	size_t *position = malloc(sizeof(size_t) * nnodes);
+	assert(level && nincoming && out_start && out_edges && queue);
+	assert(position);
+
+	for(size_t i = 0; i < edge_count; i++){
+		size_t from = edges[i].from, to = edges[i].to;
+		assert(from < nnodes);
+		assert(to < nnodes);
+		assert(to >= first_output);
+		assert(from < first_output || from >= first_hidden);
+
+		nincoming[to]++;
+		out_start[from + 1]++;
+	}
+	for(size_t i = 0; i < nnodes; i++){
+		out_start[i + 1] += out_start[i];
+	}
+	for(size_t i = 0; i < edge_count; i++){
+		/* Use the start as fill count and restore it afterwards */
+		out_edges[out_start[edges[i].from]++] = i;
+	}
+	for(size_t i = nnodes; i > 0; i--){
+		out_start[i] = out_start[i - 1];
+	}
+	out_start[0] = 0;
+
+	/* Kahn's algorithm, every computed node is at least on level 1 and
+	 * one level after all the nodes it depends on
+	 */
+	size_t nqueued = 0;
+	for(size_t i = 0; i < nnodes; i++){
+		if(i >= first_output){
+			level[i] = 1;
+		}
+		if(nincoming[i] == 0){
+			queue[nqueued++] = i;
+		}
+	}
+
+	for(size_t i = 0; i < nqueued; i++){
+		size_t node = queue[i];
+		for(size_t j = out_start[node]; j < out_start[node + 1]; j++){
+			size_t to = edges[out_edges[j]].to;
+			if(level[to] < level[node] + 1){
+				level[to] = level[node] + 1;
+			}
+
+			if(--nincoming[to] == 0){
+				queue[nqueued++] = to;
+			}
+		}
+	}
+	/* If not every node could be queued the edges contain a cycle */
+	assert(nqueued == nnodes);
+
+	/* Sort the hidden nodes by level, the outputs come after them */
+	size_t nlevels = 0;
+	for(size_t i = first_hidden; i < nnodes; i++){
+		if(level[i] > nlevels){
+			nlevels = level[i];
+		}
+	}
+
+	size_t ncomputed = hidden_count + output_count;
+	size_t bytes = sizeof(struct nn_graphnet) +
+		       sizeof(size_t) * (nlevels + ncomputed + 1 + edge_count) +
+		       sizeof(float) * (edge_count + nnodes);
+	struct nn_graphnet *net = calloc(1, bytes);
+	assert(net);
+
+	net->ninputs = input_count;
+	net->nhiddens = hidden_count;
+	net->noutputs = output_count;
+	net->nedges = edge_count;
+	net->nlevels = nlevels;
+
+	nn_graphnet_set_pointers(net);
+
+	for(size_t i = first_hidden; i < nnodes; i++){
+		net->level_end[level[i] - 1]++;
+	}
+	size_t next = first_output;
+	for(size_t i = 0; i < nlevels; i++){
+		size_t count = net->level_end[i];
+		/* Temporarily the start of the level */
+		net->level_end[i] = next;
+		next += count;
+	}
+
+	for(size_t i = 0; i < first_output; i++){
+		position[i] = i;
+	}
+	for(size_t i = first_hidden; i < nnodes; i++){
+		position[i] = net->level_end[level[i] - 1]++;
+	}
+	for(size_t i = first_output; i < first_hidden; i++){
+		position[i] = first_output + hidden_count + (i - first_output);
+	}
+
+	/* Store the incoming edges of every computed node together */
+	for(size_t i = 0; i < edge_count; i++){
+		net->edge_start[position[edges[i].to] - first_output + 1]++;
+	}
+	for(size_t i = 0; i < ncomputed; i++){
+		net->edge_start[i + 1] += net->edge_start[i];
+	}
+	for(size_t i = 0; i < edge_count; i++){
+		size_t computed = position[edges[i].to] - first_output;
+		size_t edge = net->edge_start[computed]++;
+
+		net->edge_source[edge] = position[edges[i].from];
+		net->edge_weight[edge] = edges[i].weight;
+	}
+	for(size_t i = ncomputed; i > 0; i--){
+		net->edge_start[i] = net->edge_start[i - 1];
+	}
+	net->edge_start[0] = 0;
+
+	/* Read the node values in memory order */
+	for(size_t i = 0; i < ncomputed; i++){
+		for(size_t j = net->edge_start[i] + 1;
+		    j < net->edge_start[i + 1];
+		    j++){
+			size_t source = net->edge_source[j];
+			float weight = net->edge_weight[j];
+
+			size_t k = j;
+			while(k > net->edge_start[i] &&
+			      net->edge_source[k - 1] > source){
+				net->edge_source[k] = net->edge_source[k - 1];
+				net->edge_weight[k] = net->edge_weight[k - 1];
+				k--;
+			}
+			net->edge_source[k] = source;
+			net->edge_weight[k] = weight;
+		}
+	}
+
+	free(level);
+	free(nincoming);
+	free(out_start);
+	free(out_edges);
+	free(queue);
+	free(position);
+
+	/* Default values */
+	nn_graphnet_set_activations(net,
+				    NN_ACTIVATION_SIGMOID,
+				    NN_ACTIVATION_SIGMOID);
+
+	net->bias = -1.0;
+
+	return net;
+}
+
+struct nn_graphnet *nn_graphnet_from_ffnet(const struct nn_ffnet *net,
+					   float treshold)
+{
+	assert(net);
+
+	size_t ninputs = net->ninputs;
+	size_t nhiddens = net->nhiddens;
+	size_t first_output = ninputs + 1;
+	size_t first_hidden = first_output + net->noutputs;
+
+	struct nn_graphnet_edge *edges =
+		malloc(sizeof(struct nn_graphnet_edge) * net->nweights);
+	assert(edges);
+
+	/* Walk the weights in the same order as nn_ffnet_run, every layer reads
+	 * from the inputs or the previous hidden layer
+	 */
+	const float *weight = net->weight;
+	size_t nedges = 0;
+	size_t nlayers = net->nhidden_layers + 1;
+	for(size_t i = 0; i < nlayers; i++){
+		size_t nsources = i == 0 ? ninputs : nhiddens;
+		size_t first_source = 0;
+		if(i > 0){
+			first_source = first_hidden + (i - 1) * nhiddens;
+		}
+
+		bool output_layer = i == nlayers - 1;
+		size_t ntargets = output_layer ? net->noutputs : nhiddens;
+		size_t first_target = first_hidden + i * nhiddens;
+		if(output_layer){
+			first_target = first_output;
+		}
+
+		for(size_t j = 0; j < ntargets; j++){
+			for(size_t k = 0; k <= nsources; k++){
+				float w = *weight++;
+				if(fabsf(w) <= treshold){
+					continue;
+				}
+
+				/* The first weight belongs to the bias */
+				size_t from = ninputs;
+				if(k > 0){
+					from = first_source + k - 1;
+				}
+
+				edges[nedges].from = from;
+				edges[nedges].to = first_target + j;
+				edges[nedges].weight = w;
+				nedges++;
+			}
+		}
+	}
+	assert(weight - net->weight == net->nweights);
+
+	struct nn_graphnet *graph =
+		nn_graphnet_create(ninputs,
+				   nhiddens * net->nhidden_layers,
+				   net->noutputs,
+				   edges,
+				   nedges);
+	free(edges);
+
+	nn_graphnet_set_activations(graph,
+				    net->hidden_activation,
+				    net->output_activation);
+	nn_graphnet_set_bias(graph, net->bias);
+
+	return graph;
+}
+
+void nn_graphnet_destroy(struct nn_graphnet *net)
+{
+	assert(net);
+
+	free(net);
+}
+
+void nn_graphnet_set_activations(struct nn_graphnet *net,
+				 enum nn_activation hidden,
+				 enum nn_activation output)
+{
+	assert(net);
+
+	/* Exits when they don't exist */
+	nn_get_activation(hidden);
+	nn_get_activation(output);
+
+	net->hidden_activation = hidden;
+	net->output_activation = output;
+}
+
+void nn_graphnet_set_bias(struct nn_graphnet *net, float bias)
+{
+	assert(net);
+
+	net->bias = bias;
+}
+
+float *nn_graphnet_run(struct nn_graphnet *net, const float *inputs)
+{
+	assert(net);
+
+	return nn_graphnet_run_ex(net, inputs, net->output);
+}
+
+size_t nn_graphnet_scratch_size(const struct nn_graphnet *net)
+{
+	assert(net);
+
+	return net->ninputs + 1 + net->nhiddens + net->noutputs;
+}
+
+float *nn_graphnet_run_ex(const struct nn_graphnet *net,
+			  const float *inputs,
+			  float *scratch)
+{
+	assert(net);
+	assert(inputs);
+	assert(scratch);
+
+	nn_activation_fn hidden_activation =
+		nn_get_activation(net->hidden_activation);
+	nn_activation_fn output_activation =
+		nn_get_activation(net->output_activation);
+
+	/* The values of all nodes look like this:
+	 * [ input.., bias, hidden.., output.. ]
+	 */
+	float *values = scratch;
+	memcpy(values, inputs, sizeof(float) * net->ninputs);
+	values[net->ninputs] = net->bias;
+
+	/* Every level only depends on the ones before it so the activation
+	 * can be applied on the whole level at once
+	 */
+	size_t first_computed = net->ninputs + 1;
+	size_t start = first_computed;
+	for(size_t i = 0; i < net->nlevels; i++){
+		size_t end = net->level_end[i];
+
+		nn_sparse(net->edge_start + (start - first_computed),
+			  net->edge_source,
+			  net->edge_weight,
+			  values,
+			  end - start,
+			  values + start);
+		hidden_activation(values + start, end - start);
+
+		start = end;
+	}
+
+	float *output = values + start;
+	nn_sparse(net->edge_start + (start - first_computed),
+		  net->edge_source,
+		  net->edge_weight,
+		  values,
+		  net->noutputs,
+		  output);
+	output_activation(output, net->noutputs);
+
+	return output;
+}
@@ -0,0 +1,345 @@
+#include "kernel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+/* Clone the kernels for the vector extensions that matter, the best one the
+ * CPU supports is picked at load time
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__ELF__)
+#define NN_KERNEL __attribute__((target_clones("avx512f", \
+						"arch=haswell", \
+						"default")))
+#else
+#define NN_KERNEL
+#endif
+
+NN_KERNEL
+void nn_dense(const float *restrict weight,
+	      const float *restrict input,
+	      size_t ninputs,
+	      size_t noutputs,
+	      float bias,
+	      float *restrict output)
+{
+	size_t stride = ninputs + 1;
+	for(size_t i = 0; i < noutputs; i++){
+		const float *row = weight + i * stride + 1;
+
+		float sum = 0.0f;
+		#pragma omp simd reduction(+:sum)
+		for(size_t j = 0; j < ninputs; j++){
+			sum += row[j] * input[j];
+		}
+
+		output[i] = row[-1] * bias + sum;
+	}
+}
+
+NN_KERNEL
+void nn_dense_bf16(const uint16_t *restrict weight,
+		   const float *restrict input,
+		   size_t ninputs,
+		   size_t noutputs,
+		   float bias,
+		   float *restrict output)
+{
+	size_t stride = ninputs + 1;
+	for(size_t i = 0; i < noutputs; i++){
+		const uint16_t *row = weight + i * stride + 1;
+
+		float sum = 0.0f;
+		#pragma omp simd reduction(+:sum)
+		for(size_t j = 0; j < ninputs; j++){
+			sum += nn_bf16_to_float(row[j]) * input[j];
+		}
+
+		output[i] = nn_bf16_to_float(row[-1]) * bias + sum;
+	}
+}
+
+NN_KERNEL
+void nn_dense_int8(const int8_t *restrict weight,
+		   const float *restrict input,
+		   size_t ninputs,
+		   size_t noutputs,
+		   float scale,
+		   float bias,
+		   float *restrict output)
+{
+	size_t stride = ninputs + 1;
+	for(size_t i = 0; i < noutputs; i++){
+		const int8_t *row = weight + i * stride + 1;
+
+		float sum = 0.0f;
+		#pragma omp simd reduction(+:sum)
+		for(size_t j = 0; j < ninputs; j++){
+			sum += (float)row[j] * input[j];
+		}
+
+		/* The scale is the same for the whole layer */
+		output[i] = ((float)row[-1] * bias + sum) * scale;
+	}
+}
+
+NN_KERNEL
+void nn_dense_batch(const float *restrict weight,
+		    const float *restrict input,
+		    size_t ninputs,
+		    size_t noutputs,
+		    size_t nsamples,
+		    float bias,
+		    float *restrict output)
+{
+	size_t stride = ninputs + 1;
+	for(size_t i = 0; i < noutputs; i++){
+		const float *row = weight + i * stride;
+		float *sums = output + i * nsamples;
+
+		#pragma omp simd
+		for(size_t k = 0; k < nsamples; k++){
+			sums[k] = 0.0f;
+		}
+
+		/* Every weight is loaded once for all the samples */
+		for(size_t j = 0; j < ninputs; j++){
+			float w = row[j + 1];
+			const float *values = input + j * nsamples;
+
+			#pragma omp simd
+			for(size_t k = 0; k < nsamples; k++){
+				sums[k] += w * values[k];
+			}
+		}
+
+		/* The bias is added last like nn_dense does */
+		float bias_weight = row[0] * bias;
+		#pragma omp simd
+		for(size_t k = 0; k < nsamples; k++){
+			sums[k] = bias_weight + sums[k];
+		}
+	}
+}
+
+NN_KERNEL
+void nn_dense_batch_bf16(const uint16_t *restrict weight,
+			 const float *restrict input,
+			 size_t ninputs,
+			 size_t noutputs,
+			 size_t nsamples,
+			 float bias,
+			 float *restrict output)
+{
+	size_t stride = ninputs + 1;
+	for(size_t i = 0; i < noutputs; i++){
+		const uint16_t *row = weight + i * stride;
+		float *sums = output + i * nsamples;
+
+		#pragma omp simd
+		for(size_t k = 0; k < nsamples; k++){
+			sums[k] = 0.0f;
+		}
+
+		/* Every weight is converted once for all the samples */
+		for(size_t j = 0; j < ninputs; j++){
+			float w = nn_bf16_to_float(row[j + 1]);
+			const float *values = input + j * nsamples;
+
+			#pragma omp simd
+			for(size_t k = 0; k < nsamples; k++){
+				sums[k] += w * values[k];
+			}
+		}
+
+		float bias_weight = nn_bf16_to_float(row[0]) * bias;
+		#pragma omp simd
+		for(size_t k = 0; k < nsamples; k++){
+			sums[k] = bias_weight + sums[k];
+		}
+	}
+}
+
+NN_KERNEL
+void nn_dense_batch_int8(const int8_t *restrict weight,
+			 const float *restrict input,
+			 size_t ninputs,
+			 size_t noutputs,
+			 size_t nsamples,
+			 float scale,
+			 float bias,
+			 float *restrict output)
+{
+	size_t stride = ninputs + 1;
+	for(size_t i = 0; i < noutputs; i++){
+		const int8_t *row = weight + i * stride;
+		float *sums = output + i * nsamples;
+
+		#pragma omp simd
+		for(size_t k = 0; k < nsamples; k++){
+			sums[k] = 0.0f;
+		}
+
+		for(size_t j = 0; j < ninputs; j++){
+			float w = (float)row[j + 1];
+			const float *values = input + j * nsamples;
+
+			#pragma omp simd
+			for(size_t k = 0; k < nsamples; k++){
+				sums[k] += w * values[k];
+			}
+		}
+
+		/* Scaled once at the end like nn_dense_int8 does */
+		float bias_weight = (float)row[0] * bias;
+		#pragma omp simd
+		for(size_t k = 0; k < nsamples; k++){
+			sums[k] = (bias_weight + sums[k]) * scale;
+		}
+	}
+}
+
+NN_KERNEL
+void nn_sparse(const size_t *edge_start,
+	       const size_t *edge_source,
+	       const float *edge_weight,
+	       const float *values,
+	       size_t noutputs,
+	       float *output)
+{
+	for(size_t i = 0; i < noutputs; i++){
+		size_t first_edge = edge_start[i];
+		size_t last_edge = edge_start[i + 1];
+
+		float sum = 0.0f;
+		#pragma omp simd reduction(+:sum)
+		for(size_t j = first_edge; j < last_edge; j++){
+			sum += edge_weight[j] * values[edge_source[j]];
+		}
+
+		output[i] = sum;
+	}
+}
+
+NN_KERNEL
+void nn_sparse_batch(const size_t *edge_start,
+		     const size_t *edge_source,
+		     const float *edge_weight,
+		     const float *values,
+		     size_t noutputs,
+		     size_t nsamples,
+		     float *output)
+{
+	for(size_t i = 0; i < noutputs; i++){
+		float *sums = output + i * nsamples;
+
+		#pragma omp simd
+		for(size_t k = 0; k < nsamples; k++){
+			sums[k] = 0.0f;
+		}
+
+		/* An output never reads itself, so the sums don't overlap the
+		 * values of the edges
+		 */
+		for(size_t j = edge_start[i]; j < edge_start[i + 1]; j++){
+			float w = edge_weight[j];
+			const float *source = values +
+					      edge_source[j] * nsamples;
+
+			#pragma omp simd
+			for(size_t k = 0; k < nsamples; k++){
+				sums[k] += w * source[k];
+			}
+		}
+	}
+}
+
+/* Single precision exp that the compiler can vectorize, the input is split
+ * in a power of two and a remainder which is approximated by a polynomial,
+ * only valid for inputs between -87 and 88
+ */
+static inline float nn_expf(float input)
+{
+	/* Adding 1.5 * 2^23 rounds to the nearest integer and leaves it in
+	 * the lowest bits of the mantissa */
+	float shifted = input * 1.44269504f + 12582912.0f;
+	float n = shifted - 12582912.0f;
+	float r = input - n * 0.693359375f + n * 2.12194440e-4f;
+
+	float poly = 1.9875691500e-4f;
+	poly = poly * r + 1.3981999507e-3f;
+	poly = poly * r + 8.3334519073e-3f;
+	poly = poly * r + 4.1665795894e-2f;
+	poly = poly * r + 1.6666665459e-1f;
+	poly = poly * r + 5.0000001201e-1f;
+	poly = poly * r * r + r + 1.0f;
+
+	int32_t bits;
+	memcpy(&bits, &shifted, sizeof(float));
+	bits = (bits - 0x4b400000 + 127) << 23;
+
+	float scale;
+	memcpy(&scale, &bits, sizeof(float));
+
+	return poly * scale;
+}
+
+NN_KERNEL
+void nn_sigmoid(float *values, size_t count)
+{
+	/* Calculate it on the magnitude and mirror it for negative values,
+	 * the comparisons are done on the bits because positive floats sort
+	 * the same as integers and it keeps the loop free of branches
+	 */
+	const int32_t max_magnitude = 0x42340000; /* 45.0f */
+
+	#pragma omp simd
+	for(size_t i = 0; i < count; i++){
+		float magnitude = fabsf(values[i]);
+
+		int32_t bits;
+		memcpy(&bits, &magnitude, sizeof(float));
+		bits = bits > max_magnitude ? max_magnitude : bits;
+		memcpy(&magnitude, &bits, sizeof(float));
+
+		float output = 1.0f / (1.0f + nn_expf(-magnitude));
+		values[i] = 0.5f + copysignf(output - 0.5f, values[i]);
+	}
+}
+
+NN_KERNEL
+void nn_fast_sigmoid(float *values, size_t count)
+{
+	#pragma omp simd
+	for(size_t i = 0; i < count; i++){
+		values[i] = values[i] / (1.0f + fabsf(values[i]));
+	}
+}
+
+NN_KERNEL
+void nn_relu(float *values, size_t count)
+{
+	#pragma omp simd
+	for(size_t i = 0; i < count; i++){
+		values[i] = values[i] < 0.0f ? 0.0f : values[i];
+	}
+}
+
+nn_activation_fn nn_get_activation(enum nn_activation activation)
+{
+	switch(activation){
+		case NN_ACTIVATION_SIGMOID:
+			return nn_sigmoid;
+		case NN_ACTIVATION_FAST_SIGMOID:
+			return nn_fast_sigmoid;
+		case NN_ACTIVATION_RELU:
+			return nn_relu;
+		default:
+			fprintf(stderr,
+				"Activation function \"%d\" not found\n",
+				activation);
+			exit(-1);
+	}
+}
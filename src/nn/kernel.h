@@ -0,0 +1,100 @@
+#pragma once
+
+#include <nn.h>
+
+/* Apply an activation function on count values in place */
+typedef void (*nn_activation_fn)(float *values, size_t count);
+
+/* Calculate the weighted sums of a fully connected layer, every row of weights
+ * starts with the weight of the bias node followed by one weight per input
+ */
+void nn_dense(const float *restrict weight,
+	      const float *restrict input,
+	      size_t ninputs,
+	      size_t noutputs,
+	      float bias,
+	      float *restrict output);
+
+/* Same as nn_dense with the weights stored in bfloat16 */
+void nn_dense_bf16(const uint16_t *restrict weight,
+		   const float *restrict input,
+		   size_t ninputs,
+		   size_t noutputs,
+		   float bias,
+		   float *restrict output);
+
+/* Same as nn_dense with the weights stored in int8, every weight is multiplied
+ * by scale
+ */
+void nn_dense_int8(const int8_t *restrict weight,
+		   const float *restrict input,
+		   size_t ninputs,
+		   size_t noutputs,
+		   float scale,
+		   float bias,
+		   float *restrict output);
+
+/* Calculate the weighted sums of a fully connected layer for multiple samples
+ * at once, both the input and output are stored per node with the value of
+ * every sample next to each other: [ node0 sample0, node0 sample1.. ]. The
+ * products are added one input after the other while nn_dense adds them in
+ * vector lanes, so the sums only match nn_dense up to rounding
+ */
+void nn_dense_batch(const float *restrict weight,
+		    const float *restrict input,
+		    size_t ninputs,
+		    size_t noutputs,
+		    size_t nsamples,
+		    float bias,
+		    float *restrict output);
+
+/* Same as nn_dense_batch with the weights stored in bfloat16 */
+void nn_dense_batch_bf16(const uint16_t *restrict weight,
+			 const float *restrict input,
+			 size_t ninputs,
+			 size_t noutputs,
+			 size_t nsamples,
+			 float bias,
+			 float *restrict output);
+
+/* Same as nn_dense_batch with the weights stored in int8, every weight is
+ * multiplied by scale
+ */
+void nn_dense_batch_int8(const int8_t *restrict weight,
+			 const float *restrict input,
+			 size_t ninputs,
+			 size_t noutputs,
+			 size_t nsamples,
+			 float scale,
+			 float bias,
+			 float *restrict output);
+
+/* Calculate the weighted sums of nodes with their own incoming edges, the
+ * edges of output i are edge_start[i] until edge_start[i + 1] and read from
+ * values, the output may be inside of values as long as an output doesn't
+ * read itself
+ */
+void nn_sparse(const size_t *edge_start,
+	       const size_t *edge_source,
+	       const float *edge_weight,
+	       const float *values,
+	       size_t noutputs,
+	       float *output);
+
+/* Same as nn_sparse for multiple samples at once, the values and outputs are
+ * stored per node like nn_dense_batch does
+ */
+void nn_sparse_batch(const size_t *edge_start,
+		     const size_t *edge_source,
+		     const float *edge_weight,
+		     const float *values,
+		     size_t noutputs,
+		     size_t nsamples,
+		     float *output);
+
+void nn_sigmoid(float *values, size_t count);
+void nn_fast_sigmoid(float *values, size_t count);
+void nn_relu(float *values, size_t count);
+
+/* Exits the program when the activation function doesn't exist */
+nn_activation_fn nn_get_activation(enum nn_activation activation);
@@ -1,75 +1,148 @@
 #include <nn.h>
 
+#include "kernel.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #include <assert.h>
 
-static inline float nn_sigmoid(float input)
+/* Amount of samples run at the same time by nn_ffnet_run_batch, small enough
+ * to keep the activations of a layer in the cache
+ */
+#define NN_FFNET_BATCH_SAMPLES 64
+
+/* Run all layers, this is always inlined in the specialized versions below
+ * so the activation functions are known at compile time
+ */
+static inline __attribute__((always_inline))
+float *nn_ffnet_run_layers(const struct nn_ffnet *net,
+			   const float *inputs,
+			   float *scratch,
+			   nn_activation_fn hidden_activation,
+			   nn_activation_fn output_activation)
 {
-	if(input < -45.0){
-		return 0;
-	}else if(input > 45.0){
-		return 1;
-	}
+	/* Copy the inputs to the scratch memory space so we don't have to
+	 * make a special case for the input layer, it will look like this:
+	 * [ input.., output.. ]
+	 */
+	float *input = scratch;
+	memcpy(input, inputs, sizeof(float) * net->ninputs);
 
-	return 1.0 / (1 + exp(-input));
-}
+	/* Calculate hidden layers */
+	const float *weight = net->weight;
+	float *output = scratch + net->ninputs;
+	for(size_t i = 0; i < net->nhidden_layers; i++){
+		/* First get all the inputs, then get all the hidden layers */
+		size_t nweights = net->nhiddens;
+		if(i == 0){
+			nweights = net->ninputs;
+		}
 
-static inline float nn_fast_sigmoid(float input)
-{
-	return input / (1 + fabs(input)); 
-}
+		nn_dense(weight,
+			 input,
+			 nweights,
+			 net->nhiddens,
+			 net->bias,
+			 output);
+		hidden_activation(output, net->nhiddens);
 
-static inline float nn_relu(float input)
-{
-	if(input < 0){
-		return 0.0;
+		weight += (nweights + 1) * net->nhiddens;
+		output += net->nhiddens;
+		input += nweights;
 	}
 
-	return input;
-}
+	/* The return value must be saved because the output pointer is going
+	 * to be changed by the output layer calculation */
+	float *ret = output;
 
-static inline float nn_rand(float start, float end)
-{
-	assert(start < end);
+	size_t nweights = net->nhiddens;
+	/* Get the input layer if there are no hidden layers */
+	if(net->nhidden_layers == 0){
+		nweights = net->ninputs;
+	}
 
-	float range = end - start;
+	/* Calculate output layer */
+	nn_dense(weight, input, nweights, net->noutputs, net->bias, output);
+	output_activation(output, net->noutputs);
 
-	return (float)rand() / (float)(RAND_MAX / range) + start;
+	weight += (nweights + 1) * net->noutputs;
+	output += net->noutputs;
+
+	assert(weight - net->weight == net->nweights);
+	assert(output - scratch == net->nneurons);
+
+	return ret;
 }
 
-static inline float nn_activate(enum nn_activation activation, float input)
-{
-	switch(activation){
-		case NN_ACTIVATION_SIGMOID:
-			return nn_sigmoid(input);
-		case NN_ACTIVATION_FAST_SIGMOID:
-			return nn_fast_sigmoid(input);
-		case NN_ACTIVATION_RELU:
-			return nn_relu(input);
-		default:
-			fprintf(stderr,
-				"Activation function \"%d\" not found\n",
-				activation);
-			exit(-1);
+/* One run function for every combination of activation functions */
+#define NN_FFNET_RUN(hidden, output) \
+	static float *nn_ffnet_run_##hidden##_##output( \
+		const struct nn_ffnet *net, \
+		const float *inputs, \
+		float *scratch) \
+	{ \
+		return nn_ffnet_run_layers(net, inputs, scratch, \
+					   nn_##hidden, nn_##output); \
 	}
-}
+
+NN_FFNET_RUN(sigmoid, sigmoid)
+NN_FFNET_RUN(sigmoid, fast_sigmoid)
+NN_FFNET_RUN(sigmoid, relu)
+NN_FFNET_RUN(fast_sigmoid, sigmoid)
+NN_FFNET_RUN(fast_sigmoid, fast_sigmoid)
+NN_FFNET_RUN(fast_sigmoid, relu)
+NN_FFNET_RUN(relu, sigmoid)
+NN_FFNET_RUN(relu, fast_sigmoid)
+NN_FFNET_RUN(relu, relu)
+
+/* Indexed by the hidden and then the output activation */
+static const nn_ffnet_run_fn nn_ffnet_runs[3][3] = {
+	[NN_ACTIVATION_SIGMOID] = {
+		[NN_ACTIVATION_SIGMOID] = nn_ffnet_run_sigmoid_sigmoid,
+		[NN_ACTIVATION_FAST_SIGMOID] =
+			nn_ffnet_run_sigmoid_fast_sigmoid,
+		[NN_ACTIVATION_RELU] = nn_ffnet_run_sigmoid_relu
+	},
+	[NN_ACTIVATION_FAST_SIGMOID] = {
+		[NN_ACTIVATION_SIGMOID] = nn_ffnet_run_fast_sigmoid_sigmoid,
+		[NN_ACTIVATION_FAST_SIGMOID] =
+			nn_ffnet_run_fast_sigmoid_fast_sigmoid,
+		[NN_ACTIVATION_RELU] = nn_ffnet_run_fast_sigmoid_relu
+	},
+	[NN_ACTIVATION_RELU] = {
+		[NN_ACTIVATION_SIGMOID] = nn_ffnet_run_relu_sigmoid,
+		[NN_ACTIVATION_FAST_SIGMOID] = nn_ffnet_run_relu_fast_sigmoid,
+		[NN_ACTIVATION_RELU] = nn_ffnet_run_relu_relu
+	}
+};
 
 static void nn_ffnet_set_pointers(struct nn_ffnet *net)
 {
 	assert(net);
 
-	net->weight = (float*)((char*)net + sizeof(struct nn_ffnet));
-	net->output = net->weight + net->nweights;
+	/* External weights are left where the caller put them */
+	if(net->external_weights){
+		net->output = (float*)((char*)net + sizeof(struct nn_ffnet));
+	}else{
+		net->weight = (float*)((char*)net + sizeof(struct nn_ffnet));
+		net->output = net->weight + net->nweights;
+	}
 }
 
+static size_t nn_ffnet_count_neurons(size_t input_count,
+				     size_t hidden_count,
+				     size_t output_count,
+				     size_t hidden_layer_count)
+{
+	return input_count + hidden_count * hidden_layer_count + output_count;
+}
 
-struct nn_ffnet *nn_ffnet_create(size_t input_count,
-				 size_t hidden_count,
-				 size_t output_count,
-				 size_t hidden_layer_count)
+size_t nn_ffnet_weight_count(size_t input_count,
+			     size_t hidden_count,
+			     size_t output_count,
+			     size_t hidden_layer_count)
 {
 	assert(input_count > 0);
 	assert(output_count > 0);
@@ -92,58 +165,187 @@ struct nn_ffnet *nn_ffnet_create(size_t input_count,
 	}
 	output_weights *= output_count;
 
-	size_t total_weights = hidden_weights + output_weights;
-	size_t total_neurons = input_count +
-			       hidden_count * hidden_layer_count +
-			       output_count;
+	return hidden_weights + output_weights;
+}
 
-	size_t total_items = total_weights + total_neurons;
+size_t nn_ffnet_size(size_t input_count,
+		     size_t hidden_count,
+		     size_t output_count,
+		     size_t hidden_layer_count)
+{
+	size_t total_weights = nn_ffnet_weight_count(input_count,
+						     hidden_count,
+						     output_count,
+						     hidden_layer_count);
+	size_t total_neurons = nn_ffnet_count_neurons(input_count,
+						      hidden_count,
+						      output_count,
+						      hidden_layer_count);
+
+	/* The struct with extra bytes behind it for the data */
+	return sizeof(struct nn_ffnet) +
+	       sizeof(float) * (total_weights + total_neurons);
+}
 
-	/* Allocate the struct with extra bytes behind it for the data */
-	size_t items_bytes = sizeof(float) * total_items;
-	struct nn_ffnet *net = malloc(sizeof(struct nn_ffnet) + items_bytes);
-	assert(net);
+size_t nn_ffnet_size_external(size_t input_count,
+			      size_t hidden_count,
+			      size_t output_count,
+			      size_t hidden_layer_count)
+{
+	size_t total_weights = nn_ffnet_weight_count(input_count,
+						     hidden_count,
+						     output_count,
+						     hidden_layer_count);
+
+	return nn_ffnet_size(input_count,
+			     hidden_count,
+			     output_count,
+			     hidden_layer_count) -
+	       sizeof(float) * total_weights;
+}
 
-	/* Set the extra data to 0 */
-	memset(net + 1, 0, items_bytes);
+static struct nn_ffnet *nn_ffnet_init_weights(void *memory,
+					      bool external,
+					      float *weight,
+					      size_t input_count,
+					      size_t hidden_count,
+					      size_t output_count,
+					      size_t hidden_layer_count)
+{
+	assert(memory);
+
+	struct nn_ffnet *net = memory;
 
 	net->ninputs = input_count;
 	net->nhiddens = hidden_count;
 	net->noutputs = output_count;
 	net->nhidden_layers = hidden_layer_count;
 
-	net->nweights = total_weights;
-	net->nneurons = total_neurons;
+	net->nweights = nn_ffnet_weight_count(input_count,
+					      hidden_count,
+					      output_count,
+					      hidden_layer_count);
+	net->nneurons = nn_ffnet_count_neurons(input_count,
+					       hidden_count,
+					       output_count,
+					       hidden_layer_count);
+
+	net->external_weights = external;
+	net->weight = weight;
+
+	/* Set the extra data to 0 */
+	nn_ffnet_set_pointers(net);
+	if(net->weight != NULL){
+		memset(net->weight, 0, sizeof(float) * net->nweights);
+	}
+	memset(net->output, 0, sizeof(float) * net->nneurons);
 
 	/* Default values */
-	net->hidden_activation = NN_ACTIVATION_SIGMOID;
-	net->output_activation = NN_ACTIVATION_SIGMOID;
+	nn_ffnet_set_activations(net,
+				 NN_ACTIVATION_SIGMOID,
+				 NN_ACTIVATION_SIGMOID);
 
 	net->bias = -1.0;
 
-	nn_ffnet_set_pointers(net);
-
 	return net;
 }
 
-struct nn_ffnet *nn_ffnet_copy(struct nn_ffnet *net)
+struct nn_ffnet *nn_ffnet_init(void *memory,
+			       size_t input_count,
+			       size_t hidden_count,
+			       size_t output_count,
+			       size_t hidden_layer_count)
+{
+	return nn_ffnet_init_weights(memory,
+				     false,
+				     NULL,
+				     input_count,
+				     hidden_count,
+				     output_count,
+				     hidden_layer_count);
+}
+
+struct nn_ffnet *nn_ffnet_init_external(void *memory,
+					float *weight,
+					size_t input_count,
+					size_t hidden_count,
+					size_t output_count,
+					size_t hidden_layer_count)
 {
+	return nn_ffnet_init_weights(memory,
+				     true,
+				     weight,
+				     input_count,
+				     hidden_count,
+				     output_count,
+				     hidden_layer_count);
+}
+
+struct nn_ffnet *nn_ffnet_create(size_t input_count,
+				 size_t hidden_count,
+				 size_t output_count,
+				 size_t hidden_layer_count)
+{
+	struct nn_ffnet *net = malloc(nn_ffnet_size(input_count,
+						    hidden_count,
+						    output_count,
+						    hidden_layer_count));
 	assert(net);
 
-	size_t extra = net->nweights + net->nneurons;
-	size_t bytes = sizeof(struct nn_ffnet) + sizeof(float) * extra;
-	assert(bytes > sizeof(struct nn_ffnet));
+	return nn_ffnet_init(net,
+			     input_count,
+			     hidden_count,
+			     output_count,
+			     hidden_layer_count);
+}
 
-	struct nn_ffnet *new = malloc(bytes);
-	assert(new);
+size_t nn_ffnet_bytes(const struct nn_ffnet *net)
+{
+	assert(net);
+
+	size_t nfloats = net->nneurons;
+	if(!net->external_weights){
+		nfloats += net->nweights;
+	}
 
-	memcpy(new, net, bytes);
+	return sizeof(struct nn_ffnet) + sizeof(float) * nfloats;
+}
+
+struct nn_ffnet *nn_ffnet_copy_into(void *memory, const struct nn_ffnet *net)
+{
+	assert(memory);
+	assert(net);
+
+	struct nn_ffnet *new = memory;
+	memcpy(new, net, nn_ffnet_bytes(net));
 
 	nn_ffnet_set_pointers(new);
 
 	return new;
 }
 
+struct nn_ffnet *nn_ffnet_copy(struct nn_ffnet *net)
+{
+	assert(net);
+
+	struct nn_ffnet *new = malloc(nn_ffnet_bytes(net));
+	assert(new);
+
+	return nn_ffnet_copy_into(new, net);
+}
+
+void nn_ffnet_relocate(struct nn_ffnet *net)
+{
+	assert(net);
+
+	nn_ffnet_set_pointers(net);
+
+	/* The run function lives at another address in another process */
+	nn_ffnet_set_activations(net,
+				 net->hidden_activation,
+				 net->output_activation);
+}
+
 void nn_ffnet_destroy(struct nn_ffnet *net)
 {
 	assert(net);
@@ -155,9 +357,19 @@ void nn_ffnet_randomize(struct nn_ffnet *net)
 {
 	assert(net);
 
-	for(int i = 0; i < net->nweights; i++){
-		net->weight[i] = nn_rand(-0.5, 0.5);
-	}
+	/* Seed it from rand() so srand can still be used to repeat it */
+	struct nn_rng rng;
+	nn_rng_seed(&rng, rand());
+
+	nn_ffnet_randomize_ex(net, &rng);
+}
+
+void nn_ffnet_randomize_ex(struct nn_ffnet *net, struct nn_rng *rng)
+{
+	assert(net);
+	assert(rng);
+
+	nn_rng_fill(rng, net->weight, net->nweights, -0.5, 0.5);
 }
 
 void nn_ffnet_set_activations(struct nn_ffnet *net,
@@ -166,8 +378,18 @@ void nn_ffnet_set_activations(struct nn_ffnet *net,
 {
 	assert(net);
 
+	if(hidden > NN_ACTIVATION_RELU || output > NN_ACTIVATION_RELU){
+		fprintf(stderr,
+			"Activation function \"%d\" not found\n",
+			hidden > NN_ACTIVATION_RELU ? hidden : output);
+		exit(-1);
+	}
+
 	net->hidden_activation = hidden;
 	net->output_activation = output;
+
+	/* Pick the run function once instead of checking it every neuron */
+	net->run = nn_ffnet_runs[hidden][output];
 }
 
 void nn_ffnet_set_bias(struct nn_ffnet *net, float bias)
@@ -181,63 +403,123 @@ float *nn_ffnet_run(struct nn_ffnet *net, const float *inputs)
 {
 	assert(net);
 
-	/* Copy the inputs to the extra output memory space so we don't have
-	 * to make a special case for the input layer, it will look like this:
-	 * [ **struct**, weight.. , input.., output.., **delta** ]
-	 */
-	float *input = net->output;
-	memcpy(input, inputs, sizeof(float) * net->ninputs);
+	return nn_ffnet_run_ex(net, inputs, net->output);
+}
 
-	/* Calculate hidden layers */
-	float *weight = net->weight;
-	float *output = net->output + net->ninputs;
-	for(size_t i = 0; i < net->nhidden_layers; i++){
-		/* First get all the inputs, then get all the hidden layers */
-		size_t nweights = net->nhiddens;
-		if(i == 0){
-			nweights = net->ninputs;
-		}
+size_t nn_ffnet_scratch_size(const struct nn_ffnet *net)
+{
+	assert(net);
 
-		for(size_t j = 0; j < net->nhiddens; j++){
-			/* Start with the bias */
-			float sum = *weight++ * net->bias;
+	return net->nneurons;
+}
 
-			/* Sum the rest of the weights */
-			for(size_t k = 0; k < nweights; k++){
-				sum += *weight++ * input[k];
-			}
+float *nn_ffnet_run_ex(const struct nn_ffnet *net,
+		       const float *inputs,
+		       float *scratch)
+{
+	assert(net);
+	assert(inputs);
+	assert(scratch);
 
-			*output++ = nn_activate(net->hidden_activation, sum);
-		}
+	return net->run(net, inputs, scratch);
+}
 
-		input += nweights;
+float *nn_ffnet_run_block(const struct nn_ffnet *net,
+			  const float *inputs,
+			  size_t nsamples,
+			  float *scratch)
+{
+	assert(net);
+	assert(inputs);
+	assert(scratch);
+
+	nn_activation_fn hidden_activation =
+		nn_get_activation(net->hidden_activation);
+	nn_activation_fn output_activation =
+		nn_get_activation(net->output_activation);
+
+	/* Same as nn_ffnet_run_layers with every value widened to nsamples */
+	const float *weight = net->weight;
+	const float *input = inputs;
+	float *output = scratch;
+	size_t nweights = net->ninputs;
+	for(size_t i = 0; i < net->nhidden_layers; i++){
+		nn_dense_batch(weight,
+			       input,
+			       nweights,
+			       net->nhiddens,
+			       nsamples,
+			       net->bias,
+			       output);
+		hidden_activation(output, net->nhiddens * nsamples);
+
+		weight += (nweights + 1) * net->nhiddens;
+		input = output;
+		output += net->nhiddens * nsamples;
+		nweights = net->nhiddens;
 	}
 
-	/* The return value must be saved because the output pointer is going
-	 * to be changed by the output layer calculation */
-	float *ret = output;
+	nn_dense_batch(weight,
+		       input,
+		       nweights,
+		       net->noutputs,
+		       nsamples,
+		       net->bias,
+		       output);
+	output_activation(output, net->noutputs * nsamples);
 
-	size_t nweights = net->nhiddens;
-	/* Get the input layer if there are no hidden layers */
-	if(net->nhidden_layers == 0){
-		nweights = net->ninputs;
-	}
+	return output;
+}
 
-	/* Calculate output layer */
-	for(size_t i = 0; i < net->noutputs; i++){
-		/* Start with the bias */
-		float sum = *weight++ * net->bias;
+size_t nn_ffnet_batch_scratch_size(const struct nn_ffnet *net)
+{
+	assert(net);
 
-		/* Sum the rest of the weights */
-		for(size_t j = 0; j < nweights; j++){
-			sum += *weight++ * input[j];
+	return net->nneurons * NN_FFNET_BATCH_SAMPLES;
+}
+
+void nn_ffnet_run_batch(const struct nn_ffnet *net,
+			const float *inputs,
+			size_t nsamples,
+			float *outputs,
+			float *scratch)
+{
+	assert(net);
+	assert(inputs);
+	assert(outputs);
+	assert(scratch);
+
+	size_t ninputs = net->ninputs;
+	size_t noutputs = net->noutputs;
+	for(size_t first = 0;
+	    first < nsamples;
+	    first += NN_FFNET_BATCH_SAMPLES){
+		size_t block = nsamples - first;
+		if(block > NN_FFNET_BATCH_SAMPLES){
+			block = NN_FFNET_BATCH_SAMPLES;
 		}
 
-		*output++ = nn_activate(net->output_activation, sum);
-	}
+		/* Store the values per node instead of per sample so every
+		 * weight can be applied to the whole block at once
+		 */
+		const float *input = inputs + first * ninputs;
+		for(size_t i = 0; i < block; i++){
+			for(size_t j = 0; j < ninputs; j++){
+				scratch[j * block + i] = input[i * ninputs + j];
+			}
+		}
 
-	assert(weight - net->weight == net->nweights);
-	assert(output - net->output == net->nneurons);
+		float *result = nn_ffnet_run_block(net,
+						   scratch,
+						   block,
+						   scratch + ninputs * block);
 
-	return ret;
+		float *output = outputs + first * noutputs;
+		for(size_t i = 0; i < block; i++){
+			for(size_t j = 0; j < noutputs; j++){
+				output[i * noutputs + j] =
+					result[j * block + i];
+			}
+		}
+	}
 }
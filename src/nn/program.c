@@ -0,0 +1,670 @@
+#include <nn.h>
+
+#include "kernel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+size_t nn_precision_size(enum nn_precision precision)
+{
+	switch(precision){
+		case NN_PRECISION_FLOAT:
+			return sizeof(float);
+		case NN_PRECISION_BF16:
+			return sizeof(uint16_t);
+		case NN_PRECISION_INT8:
+			return sizeof(int8_t);
+	}
+
+	fprintf(stderr, "Precision \"%d\" not found\n", precision);
+	exit(-1);
+}
+
+float nn_precision_store(enum nn_precision precision,
+			 const float *weight,
+			 size_t count,
+			 void *output)
+{
+	assert(weight);
+	assert(output);
+
+	float scale = 1.0f;
+
+	switch(precision){
+		case NN_PRECISION_FLOAT:
+			memcpy(output, weight, sizeof(float) * count);
+			break;
+		case NN_PRECISION_BF16:
+			for(size_t i = 0; i < count; i++){
+				((uint16_t*)output)[i] =
+					nn_float_to_bf16(weight[i]);
+			}
+			break;
+		case NN_PRECISION_INT8:
+			scale = 0.0f;
+			for(size_t i = 0; i < count; i++){
+				if(fabsf(weight[i]) > scale){
+					scale = fabsf(weight[i]);
+				}
+			}
+			scale /= 127.0f;
+			if(scale == 0.0f){
+				scale = 1.0f;
+			}
+
+			for(size_t i = 0; i < count; i++){
+				((int8_t*)output)[i] =
+					(int8_t)lrintf(weight[i] / scale);
+			}
+			break;
+		default:
+			fprintf(stderr,
+				"Precision \"%d\" not found\n",
+				precision);
+			exit(-1);
+	}
+
+	return scale;
+}
+
+void nn_precision_load(enum nn_precision precision,
+		       const void *weight,
+		       size_t count,
+		       float scale,
+		       float *output)
+{
+	assert(weight);
+	assert(output);
+
+	switch(precision){
+		case NN_PRECISION_FLOAT:
+			memcpy(output, weight, sizeof(float) * count);
+			break;
+		case NN_PRECISION_BF16:
+			for(size_t i = 0; i < count; i++){
+				output[i] = nn_bf16_to_float(
+					((const uint16_t*)weight)[i]);
+			}
+			break;
+		case NN_PRECISION_INT8:
+			for(size_t i = 0; i < count; i++){
+				output[i] = ((const int8_t*)weight)[i] * scale;
+			}
+			break;
+		default:
+			fprintf(stderr,
+				"Precision \"%d\" not found\n",
+				precision);
+			exit(-1);
+	}
+}
+
+static size_t nn_program_bytes(size_t ninstructions,
+			       size_t nweights,
+			       size_t nnodes,
+			       size_t nedges,
+			       size_t nvalues,
+			       enum nn_precision precision)
+{
+	return sizeof(struct nn_program) +
+	       sizeof(struct nn_instruction) * ninstructions +
+	       sizeof(size_t) * (nnodes + 1 + nedges) +
+	       sizeof(float) * (nedges + nvalues) +
+	       nn_precision_size(precision) * nweights;
+}
+
+static void nn_program_set_weights(struct nn_program *program, void *weight)
+{
+	switch(program->precision){
+		case NN_PRECISION_FLOAT:
+			program->weight = weight;
+			break;
+		case NN_PRECISION_BF16:
+			program->weight_bf16 = weight;
+			break;
+		case NN_PRECISION_INT8:
+			program->weight_int8 = weight;
+			break;
+	}
+}
+
+static void *nn_program_weights(const struct nn_program *program)
+{
+	switch(program->precision){
+		case NN_PRECISION_BF16:
+			return program->weight_bf16;
+		case NN_PRECISION_INT8:
+			return program->weight_int8;
+		default:
+			return program->weight;
+	}
+}
+
+static struct nn_program *nn_program_create(size_t ninputs,
+					    size_t noutputs,
+					    size_t ninstructions,
+					    size_t nweights,
+					    size_t nnodes,
+					    size_t nedges,
+					    size_t nvalues,
+					    enum nn_precision precision)
+{
+	struct nn_program *program = calloc(1, nn_program_bytes(ninstructions,
+								nweights,
+								nnodes,
+								nedges,
+								nvalues,
+								precision));
+	assert(program);
+
+	program->ninputs = ninputs;
+	program->noutputs = noutputs;
+	program->nvalues = nvalues;
+	program->ninstructions = ninstructions;
+	program->nweights = nweights;
+	program->nnodes = nnodes;
+	program->nedges = nedges;
+	program->precision = precision;
+	program->bias = 1.0f;
+
+	/* The data behind the struct looks like this, the weights are last so
+	 * their size doesn't matter for the alignment of the rest:
+	 * [ **struct**, instruction.., edge_start.., edge_source..,
+	 *   edge_weight.., value.., weight.. ]
+	 */
+	program->instruction = (struct nn_instruction*)(program + 1);
+	program->edge_start = (size_t*)(program->instruction + ninstructions);
+	program->edge_source = program->edge_start + nnodes + 1;
+	program->edge_weight = (float*)(program->edge_source + nedges);
+	program->value = program->edge_weight + nedges;
+
+	nn_program_set_weights(program, program->value + nvalues);
+
+	return program;
+}
+
+/* Weight i of a layer of rows with row weights each, the first weight of a
+ * row belongs to the bias node which is always 1 in a program so the bias
+ * of the network is folded into it
+ */
+static inline float nn_program_folded_weight(const float *weight,
+					     size_t i,
+					     size_t row,
+					     float bias)
+{
+	return i % row == 0 ? weight[i] * bias : weight[i];
+}
+
+/* Store a layer of weights of the network in the precision of the program
+ * and fold the bias in while converting them
+ */
+static float nn_program_store_weights(struct nn_program *program,
+				      const float *weight,
+				      size_t first,
+				      size_t count,
+				      size_t row,
+				      float bias)
+{
+	float scale = 1.0f;
+
+	switch(program->precision){
+		case NN_PRECISION_FLOAT:
+			for(size_t i = 0; i < count; i++){
+				program->weight[first + i] =
+					nn_program_folded_weight(weight,
+								 i,
+								 row,
+								 bias);
+			}
+			break;
+		case NN_PRECISION_BF16:
+			for(size_t i = 0; i < count; i++){
+				float w = nn_program_folded_weight(weight,
+								   i,
+								   row,
+								   bias);
+				program->weight_bf16[first + i] =
+					nn_float_to_bf16(w);
+			}
+			break;
+		case NN_PRECISION_INT8:
+			/* Use the whole range for the biggest weight of the
+			 * layer
+			 */
+			scale = 0.0f;
+			for(size_t i = 0; i < count; i++){
+				float w = nn_program_folded_weight(weight,
+								   i,
+								   row,
+								   bias);
+				if(fabsf(w) > scale){
+					scale = fabsf(w);
+				}
+			}
+			scale /= 127.0f;
+			if(scale == 0.0f){
+				scale = 1.0f;
+			}
+
+			for(size_t i = 0; i < count; i++){
+				float w = nn_program_folded_weight(weight,
+								   i,
+								   row,
+								   bias);
+				program->weight_int8[first + i] =
+					(int8_t)lrintf(w / scale);
+			}
+			break;
+	}
+
+	return scale;
+}
+
+struct nn_program *nn_program_from_ffnet(const struct nn_ffnet *net)
+{
+	return nn_program_from_ffnet_precision(net, NN_PRECISION_FLOAT);
+}
+
+/* Without weight_storage the program gets its own copy of the weights with
+ * the bias folded in, otherwise it runs on the ones given
+ */
+static struct nn_program *nn_program_compile(const struct nn_ffnet *net,
+					     enum nn_precision precision,
+					     void *weight_storage,
+					     float weight_scale)
+{
+	assert(net);
+
+	size_t nlayers = net->nhidden_layers + 1;
+	size_t nvalues = net->ninputs + 1 +
+			 net->nhiddens * net->nhidden_layers +
+			 net->noutputs;
+
+	bool external = weight_storage != NULL;
+	size_t nstored = external ? 0 : net->nweights;
+
+	/* A dense and an activate instruction for every layer */
+	struct nn_program *program = nn_program_create(net->ninputs,
+						       net->noutputs,
+						       nlayers * 2,
+						       nstored,
+						       0,
+						       0,
+						       nvalues,
+						       precision);
+	if(external){
+		program->nweights = net->nweights;
+		program->bias = net->bias;
+		nn_program_set_weights(program, weight_storage);
+	}
+
+	struct nn_instruction *instruction = program->instruction;
+	size_t weight = 0;
+	size_t source = 0;
+	size_t nsources = net->ninputs;
+	size_t first = net->ninputs + 1;
+	for(size_t i = 0; i < nlayers; i++){
+		bool output_layer = i == nlayers - 1;
+		size_t count = output_layer ? net->noutputs : net->nhiddens;
+		enum nn_activation activation = net->hidden_activation;
+		if(output_layer){
+			activation = net->output_activation;
+		}
+
+		size_t nlayer_weights = (nsources + 1) * count;
+		float scale = weight_scale;
+		if(!external){
+			scale = nn_program_store_weights(program,
+							 net->weight + weight,
+							 weight,
+							 nlayer_weights,
+							 nsources + 1,
+							 net->bias);
+		}
+
+		*instruction++ = (struct nn_instruction){
+			.opcode = NN_OPCODE_DENSE,
+			.first = first,
+			.count = count,
+			.source = source,
+			.nsources = nsources,
+			.weight = weight,
+			.scale = scale
+		};
+		*instruction++ = (struct nn_instruction){
+			.opcode = NN_OPCODE_ACTIVATE,
+			.activation = activation,
+			.first = first,
+			.count = count
+		};
+
+		weight += nlayer_weights;
+		source = first;
+		nsources = count;
+		first += count;
+	}
+	assert(weight == net->nweights);
+	assert(first == nvalues);
+
+	program->output = source;
+
+	return program;
+}
+
+struct nn_program *nn_program_from_ffnet_precision(const struct nn_ffnet *net,
+						   enum nn_precision precision)
+{
+	return nn_program_compile(net, precision, NULL, 1.0f);
+}
+
+struct nn_program *nn_program_from_ffnet_weights(const struct nn_ffnet *net,
+						 enum nn_precision precision,
+						 void *weight,
+						 float scale)
+{
+	assert(weight);
+
+	return nn_program_compile(net, precision, weight, scale);
+}
+
+struct nn_program *nn_program_from_graphnet(const struct nn_graphnet *net)
+{
+	assert(net);
+
+	size_t first_computed = net->ninputs + 1;
+	size_t nnodes = net->nhiddens + net->noutputs;
+
+	/* A sparse and an activate instruction for every level and the
+	 * outputs
+	 */
+	struct nn_program *program = nn_program_create(net->ninputs,
+						       net->noutputs,
+						       (net->nlevels + 1) * 2,
+						       0,
+						       nnodes,
+						       net->nedges,
+						       first_computed + nnodes,
+						       NN_PRECISION_FLOAT);
+
+	/* Both store the nodes in the same order */
+	memcpy(program->edge_start,
+	       net->edge_start,
+	       sizeof(size_t) * (nnodes + 1));
+	memcpy(program->edge_source,
+	       net->edge_source,
+	       sizeof(size_t) * net->nedges);
+
+	for(size_t i = 0; i < net->nedges; i++){
+		float weight = net->edge_weight[i];
+		if(net->edge_source[i] == net->ninputs){
+			weight *= net->bias;
+		}
+
+		program->edge_weight[i] = weight;
+	}
+
+	struct nn_instruction *instruction = program->instruction;
+	size_t start = first_computed;
+	for(size_t i = 0; i <= net->nlevels; i++){
+		size_t end = start + net->noutputs;
+		enum nn_activation activation = net->output_activation;
+		if(i < net->nlevels){
+			end = net->level_end[i];
+			activation = net->hidden_activation;
+		}
+
+		*instruction++ = (struct nn_instruction){
+			.opcode = NN_OPCODE_SPARSE,
+			.first = start,
+			.count = end - start,
+			.weight = start - first_computed
+		};
+		*instruction++ = (struct nn_instruction){
+			.opcode = NN_OPCODE_ACTIVATE,
+			.activation = activation,
+			.first = start,
+			.count = end - start
+		};
+
+		if(i < net->nlevels){
+			start = end;
+		}
+	}
+
+	program->output = start;
+
+	return program;
+}
+
+struct nn_program *nn_program_copy(const struct nn_program *program)
+{
+	assert(program);
+
+	struct nn_program *copy = nn_program_create(program->ninputs,
+						    program->noutputs,
+						    program->ninstructions,
+						    program->nweights,
+						    program->nnodes,
+						    program->nedges,
+						    program->nvalues,
+						    program->precision);
+	copy->output = program->output;
+	copy->bias = program->bias;
+
+	memcpy(copy->instruction,
+	       program->instruction,
+	       sizeof(struct nn_instruction) * program->ninstructions);
+	memcpy(copy->edge_start,
+	       program->edge_start,
+	       sizeof(size_t) * (program->nnodes + 1));
+	memcpy(copy->edge_source,
+	       program->edge_source,
+	       sizeof(size_t) * program->nedges);
+	memcpy(copy->edge_weight,
+	       program->edge_weight,
+	       sizeof(float) * program->nedges);
+	if(program->nweights > 0){
+		memcpy(nn_program_weights(copy),
+		       nn_program_weights(program),
+		       nn_precision_size(program->precision) *
+		       program->nweights);
+	}
+
+	return copy;
+}
+
+void nn_program_destroy(struct nn_program *program)
+{
+	assert(program);
+
+	free(program);
+}
+
+float *nn_program_run(struct nn_program *program, const float *inputs)
+{
+	assert(program);
+
+	return nn_program_run_ex(program, inputs, program->value);
+}
+
+size_t nn_program_scratch_size(const struct nn_program *program)
+{
+	assert(program);
+
+	return program->nvalues;
+}
+
+static inline void nn_program_dense(const struct nn_program *program,
+				    const struct nn_instruction *instruction,
+				    const float *values,
+				    float *output)
+{
+	const float *input = values + instruction->source;
+	size_t weight = instruction->weight;
+
+	switch(program->precision){
+		case NN_PRECISION_FLOAT:
+			nn_dense(program->weight + weight,
+				 input,
+				 instruction->nsources,
+				 instruction->count,
+				 program->bias,
+				 output);
+			break;
+		case NN_PRECISION_BF16:
+			nn_dense_bf16(program->weight_bf16 + weight,
+				      input,
+				      instruction->nsources,
+				      instruction->count,
+				      program->bias,
+				      output);
+			break;
+		case NN_PRECISION_INT8:
+			nn_dense_int8(program->weight_int8 + weight,
+				      input,
+				      instruction->nsources,
+				      instruction->count,
+				      instruction->scale,
+				      program->bias,
+				      output);
+			break;
+	}
+}
+
+float *nn_program_run_ex(const struct nn_program *program,
+			 const float *inputs,
+			 float *scratch)
+{
+	assert(program);
+	assert(inputs);
+	assert(scratch);
+
+	float *values = scratch;
+	memcpy(values, inputs, sizeof(float) * program->ninputs);
+	values[program->ninputs] = program->bias;
+
+	for(size_t i = 0; i < program->ninstructions; i++){
+		const struct nn_instruction *instruction =
+			program->instruction + i;
+		float *output = values + instruction->first;
+
+		switch(instruction->opcode){
+			case NN_OPCODE_DENSE:
+				nn_program_dense(program,
+						 instruction,
+						 values,
+						 output);
+				break;
+			case NN_OPCODE_SPARSE:
+				nn_sparse(program->edge_start +
+					  instruction->weight,
+					  program->edge_source,
+					  program->edge_weight,
+					  values,
+					  instruction->count,
+					  output);
+				break;
+			case NN_OPCODE_ACTIVATE:
+				nn_get_activation(instruction->activation)
+					(output, instruction->count);
+				break;
+		}
+	}
+
+	return values + program->output;
+}
+
+static void nn_program_dense_batch(const struct nn_program *program,
+				   const struct nn_instruction *instruction,
+				   const float *values,
+				   size_t nsamples,
+				   float *output)
+{
+	const float *input = values + instruction->source * nsamples;
+	size_t weight = instruction->weight;
+
+	switch(program->precision){
+		case NN_PRECISION_FLOAT:
+			nn_dense_batch(program->weight + weight,
+				       input,
+				       instruction->nsources,
+				       instruction->count,
+				       nsamples,
+				       program->bias,
+				       output);
+			break;
+		case NN_PRECISION_BF16:
+			nn_dense_batch_bf16(program->weight_bf16 + weight,
+					    input,
+					    instruction->nsources,
+					    instruction->count,
+					    nsamples,
+					    program->bias,
+					    output);
+			break;
+		case NN_PRECISION_INT8:
+			nn_dense_batch_int8(program->weight_int8 + weight,
+					    input,
+					    instruction->nsources,
+					    instruction->count,
+					    nsamples,
+					    instruction->scale,
+					    program->bias,
+					    output);
+			break;
+	}
+}
+
+float *nn_program_run_block(const struct nn_program *program,
+			    const float *inputs,
+			    size_t nsamples,
+			    float *scratch)
+{
+	assert(program);
+	assert(inputs);
+	assert(scratch);
+
+	/* Same as nn_program_run_ex with every value widened to nsamples */
+	float *values = scratch;
+	memcpy(values, inputs, sizeof(float) * program->ninputs * nsamples);
+	float *bias = values + program->ninputs * nsamples;
+	for(size_t i = 0; i < nsamples; i++){
+		bias[i] = program->bias;
+	}
+
+	for(size_t i = 0; i < program->ninstructions; i++){
+		const struct nn_instruction *instruction =
+			program->instruction + i;
+		float *output = values + instruction->first * nsamples;
+
+		switch(instruction->opcode){
+			case NN_OPCODE_DENSE:
+				nn_program_dense_batch(program,
+						       instruction,
+						       values,
+						       nsamples,
+						       output);
+				break;
+			case NN_OPCODE_SPARSE:
+				nn_sparse_batch(program->edge_start +
+						instruction->weight,
+						program->edge_source,
+						program->edge_weight,
+						values,
+						instruction->count,
+						nsamples,
+						output);
+				break;
+			case NN_OPCODE_ACTIVATE:
+				nn_get_activation(instruction->activation)
+					(output, instruction->count * nsamples);
+				break;
+		}
+	}
+
+	return values + program->output * nsamples;
+}
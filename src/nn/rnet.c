@@ -0,0 +1,257 @@
+#include <nn.h>
+
+#include "kernel.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+/* A state looks like this:
+ * [ input.., hidden.., output.., next.. ]
+ * A layer reads the values of the previous layer of this step and its own of
+ * the last step, which are next to each other. The new values go to next
+ * until the whole layer is computed
+ */
+static size_t nn_rnet_value_count(const struct nn_rnet *net)
+{
+	return net->ninputs +
+	       net->nhiddens * net->nhidden_layers +
+	       net->noutputs;
+}
+
+static size_t nn_rnet_largest_layer(const struct nn_rnet *net)
+{
+	if(net->nhidden_layers > 0 && net->nhiddens > net->noutputs){
+		return net->nhiddens;
+	}
+
+	return net->noutputs;
+}
+
+size_t nn_rnet_weight_count(size_t input_count,
+			    size_t hidden_count,
+			    size_t output_count,
+			    size_t hidden_layer_count)
+{
+	assert((hidden_count > 0) == (hidden_layer_count > 0));
+
+	size_t count = 0;
+	size_t nsources = input_count;
+	for(size_t i = 0; i < hidden_layer_count; i++){
+		count += hidden_count * (1 + nsources + hidden_count);
+		nsources = hidden_count;
+	}
+
+	return count + output_count * (1 + nsources + output_count);
+}
+
+struct nn_rnet *nn_rnet_create(size_t input_count,
+			       size_t hidden_count,
+			       size_t output_count,
+			       size_t hidden_layer_count)
+{
+	assert(input_count > 0);
+	assert(output_count > 0);
+
+	size_t nweights = nn_rnet_weight_count(input_count,
+					       hidden_count,
+					       output_count,
+					       hidden_layer_count);
+	struct nn_rnet *net = calloc(1, sizeof(struct nn_rnet) +
+					sizeof(float) * nweights);
+	assert(net);
+
+	net->ninputs = input_count;
+	net->nhiddens = hidden_count;
+	net->noutputs = output_count;
+	net->nhidden_layers = hidden_layer_count;
+	net->nweights = nweights;
+	net->weight = (float*)(net + 1);
+
+	/* Default values */
+	nn_rnet_set_activations(net,
+				NN_ACTIVATION_SIGMOID,
+				NN_ACTIVATION_SIGMOID);
+
+	net->bias = -1.0;
+
+	return net;
+}
+
+struct nn_rnet *nn_rnet_from_ffnet(const struct nn_ffnet *net)
+{
+	assert(net);
+
+	struct nn_rnet *rnet = nn_rnet_create(net->ninputs,
+					      net->nhiddens,
+					      net->noutputs,
+					      net->nhidden_layers);
+
+	/* Every row gets the recurrent weights appended */
+	const float *weight = net->weight;
+	float *rweight = rnet->weight;
+	size_t nsources = net->ninputs;
+	size_t nlayers = rnet->nhidden_layers + 1;
+	for(size_t i = 0; i < nlayers; i++){
+		size_t count = i == nlayers - 1 ? net->noutputs : net->nhiddens;
+
+		for(size_t j = 0; j < count; j++){
+			memcpy(rweight, weight, sizeof(float) * (nsources + 1));
+			weight += nsources + 1;
+			rweight += nsources + 1 + count;
+		}
+
+		nsources = count;
+	}
+	assert(weight - net->weight == net->nweights);
+	assert(rweight - rnet->weight == rnet->nweights);
+
+	nn_rnet_set_activations(rnet,
+				net->hidden_activation,
+				net->output_activation);
+	nn_rnet_set_bias(rnet, net->bias);
+
+	return rnet;
+}
+
+void nn_rnet_destroy(struct nn_rnet *net)
+{
+	assert(net);
+
+	free(net);
+}
+
+void nn_rnet_set_activations(struct nn_rnet *net,
+			     enum nn_activation hidden,
+			     enum nn_activation output)
+{
+	assert(net);
+
+	/* Exits when they don't exist */
+	nn_get_activation(hidden);
+	nn_get_activation(output);
+
+	net->hidden_activation = hidden;
+	net->output_activation = output;
+}
+
+void nn_rnet_set_bias(struct nn_rnet *net, float bias)
+{
+	assert(net);
+
+	net->bias = bias;
+}
+
+void nn_rnet_randomize_ex(struct nn_rnet *net, struct nn_rng *rng)
+{
+	assert(net);
+	assert(rng);
+
+	nn_rng_fill(rng, net->weight, net->nweights, -0.5, 0.5);
+}
+
+size_t nn_rnet_state_size(const struct nn_rnet *net)
+{
+	assert(net);
+
+	return nn_rnet_value_count(net) + nn_rnet_largest_layer(net);
+}
+
+float *nn_rnet_step(const struct nn_rnet *net,
+		    float *state,
+		    const float *inputs)
+{
+	assert(net);
+	assert(state);
+	assert(inputs);
+
+	memcpy(state, inputs, sizeof(float) * net->ninputs);
+
+	float *next = state + nn_rnet_value_count(net);
+	const float *weight = net->weight;
+	float *source = state;
+	size_t nsources = net->ninputs;
+	size_t nlayers = net->nhidden_layers + 1;
+	for(size_t i = 0; i < nlayers; i++){
+		bool output_layer = i == nlayers - 1;
+		size_t count = output_layer ? net->noutputs : net->nhiddens;
+		enum nn_activation activation = output_layer ?
+						net->output_activation :
+						net->hidden_activation;
+		float *layer = source + nsources;
+
+		/* The sources and the last values of the layer are read as a
+		 * single input
+		 */
+		nn_dense(weight,
+			 source,
+			 nsources + count,
+			 count,
+			 net->bias,
+			 next);
+		nn_get_activation(activation)(next, count);
+		memcpy(layer, next, sizeof(float) * count);
+
+		weight += count * (1 + nsources + count);
+		source = layer;
+		nsources = count;
+	}
+
+	return source;
+}
+
+void nn_rnet_step_batch(const struct nn_rnet *net,
+			float *states,
+			size_t nepisodes,
+			const float *inputs,
+			float *outputs)
+{
+	assert(net);
+	assert(states);
+	assert(inputs);
+	assert(outputs);
+
+	size_t ninputs = net->ninputs;
+	for(size_t i = 0; i < nepisodes; i++){
+		for(size_t j = 0; j < ninputs; j++){
+			states[j * nepisodes + i] = inputs[i * ninputs + j];
+		}
+	}
+
+	/* Same as nn_rnet_step with every value widened to nepisodes */
+	float *next = states + nn_rnet_value_count(net) * nepisodes;
+	const float *weight = net->weight;
+	float *source = states;
+	size_t nsources = ninputs;
+	size_t nlayers = net->nhidden_layers + 1;
+	for(size_t i = 0; i < nlayers; i++){
+		bool output_layer = i == nlayers - 1;
+		size_t count = output_layer ? net->noutputs : net->nhiddens;
+		enum nn_activation activation = output_layer ?
+						net->output_activation :
+						net->hidden_activation;
+		float *layer = source + nsources * nepisodes;
+
+		nn_dense_batch(weight,
+			       source,
+			       nsources + count,
+			       count,
+			       nepisodes,
+			       net->bias,
+			       next);
+		nn_get_activation(activation)(next, count * nepisodes);
+		memcpy(layer, next, sizeof(float) * count * nepisodes);
+
+		weight += count * (1 + nsources + count);
+		source = layer;
+		nsources = count;
+	}
+
+	size_t noutputs = net->noutputs;
+	for(size_t i = 0; i < nepisodes; i++){
+		for(size_t j = 0; j < noutputs; j++){
+			outputs[i * noutputs + j] = source[j * nepisodes + i];
+		}
+	}
+}
@@ -0,0 +1,149 @@
+#include <nn.h>
+
+#include <assert.h>
+
+/* Amount of streams generating numbers at the same time in nn_rng_fill */
+#define NN_RNG_LANES 16
+
+static inline uint64_t nn_rotl64(uint64_t value, int shift)
+{
+	return (value << shift) | (value >> (64 - shift));
+}
+
+static inline uint32_t nn_rotl32(uint32_t value, int shift)
+{
+	return (value << shift) | (value >> (32 - shift));
+}
+
+/* Turn the upper 24 bits into a float from 0 up to but not including 1 */
+static inline float nn_rng_unit(uint32_t bits)
+{
+	return (float)(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+void nn_rng_seed(struct nn_rng *rng, uint64_t seed)
+{
+	assert(rng);
+
+	/* Spread the seed with splitmix64 so the state is never all zero */
+	for(int i = 0; i < 4; i++){
+		uint64_t z = (seed += 0x9e3779b97f4a7c15);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		rng->state[i] = z ^ (z >> 31);
+	}
+}
+
+uint64_t nn_rng_next(struct nn_rng *rng)
+{
+	assert(rng);
+
+	uint64_t *s = rng->state;
+	uint64_t result = nn_rotl64(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = nn_rotl64(s[3], 45);
+
+	return result;
+}
+
+void nn_rng_jump(struct nn_rng *rng)
+{
+	assert(rng);
+
+	static const uint64_t jump[4] = {
+		0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+		0xa9582618e03fc9aa, 0x39abdc4529b1661c
+	};
+
+	uint64_t state[4] = {0, 0, 0, 0};
+	for(int i = 0; i < 4; i++){
+		for(int j = 0; j < 64; j++){
+			if(jump[i] & (uint64_t)1 << j){
+				for(int k = 0; k < 4; k++){
+					state[k] ^= rng->state[k];
+				}
+			}
+			nn_rng_next(rng);
+		}
+	}
+
+	for(int i = 0; i < 4; i++){
+		rng->state[i] = state[i];
+	}
+}
+
+float nn_rng_float(struct nn_rng *rng, float start, float end)
+{
+	assert(start < end);
+
+	float random = nn_rng_unit(nn_rng_next(rng) >> 32);
+
+	return start + random * (end - start);
+}
+
+size_t nn_rng_index(struct nn_rng *rng, size_t count)
+{
+	assert(count > 0);
+	assert(count <= UINT32_MAX);
+
+	/* Scale the upper bits instead of taking the lower ones */
+	uint64_t random = nn_rng_next(rng) >> 32;
+
+	return (random * count) >> 32;
+}
+
+void nn_rng_fill(struct nn_rng *rng,
+		 float *values,
+		 size_t count,
+		 float start,
+		 float end)
+{
+	assert(rng);
+	assert(values || count == 0);
+	assert(start < end);
+
+	/* Every lane is a xoshiro128+ stream, stored per state word so the
+	 * lanes can be stepped together with vector instructions
+	 */
+	uint32_t s0[NN_RNG_LANES], s1[NN_RNG_LANES];
+	uint32_t s2[NN_RNG_LANES], s3[NN_RNG_LANES];
+	for(size_t i = 0; i < NN_RNG_LANES; i++){
+		uint64_t a = nn_rng_next(rng), b = nn_rng_next(rng);
+		s0[i] = a;
+		s1[i] = a >> 32;
+		s2[i] = b;
+		/* Can't be all zero when the lowest bit is set */
+		s3[i] = (b >> 32) | 1;
+	}
+
+	float range = end - start;
+	for(size_t i = 0; i < count; i += NN_RNG_LANES){
+		float random[NN_RNG_LANES];
+
+		#pragma omp simd
+		for(size_t j = 0; j < NN_RNG_LANES; j++){
+			uint32_t result = s0[j] + s3[j];
+			uint32_t t = s1[j] << 9;
+
+			s2[j] ^= s0[j];
+			s3[j] ^= s1[j];
+			s1[j] ^= s2[j];
+			s0[j] ^= s3[j];
+			s2[j] ^= t;
+			s3[j] = nn_rotl32(s3[j], 11);
+
+			random[j] = start + nn_rng_unit(result) * range;
+		}
+
+		size_t n = count - i < NN_RNG_LANES ? count - i : NN_RNG_LANES;
+		for(size_t j = 0; j < n; j++){
+			values[i + j] = random[j];
+		}
+	}
+}
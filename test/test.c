@@ -2,6 +2,9 @@
 #include <neat.h>
 
 #include <float.h>
+#include <math.h>
+#include <string.h>
+#include <omp.h>
 
 #include "greatest.h"
 
@@ -27,6 +30,1098 @@ TEST neat_create_and_destroy()
 	PASS();
 }
 
+static float xor_fitness(neat_t neat, size_t genome_id, void *userdata)
+{
+	float error = 0.0f;
+	for(int i = 0; i < 4; i++){
+		const float *results = neat_run(neat, genome_id, xor_inputs[i]);
+
+		error += fabs(results[0] - xor_outputs[i]);
+	}
+
+	return 4.0 - error;
+}
+
+TEST neat_run_batch_matches_run()
+{
+	const enum neat_backend backends[] = {
+		NEAT_BACKEND_CPU,
+		NEAT_BACKEND_PACKED
+	};
+
+	for(int i = 0; i < 2; i++){
+		struct neat_config config = {
+			.network_inputs = 2,
+			.network_outputs = 1,
+			.network_hidden_nodes = 8,
+			.network_hidden_layers = 2,
+			.population_size = 16,
+			.backend = backends[i]
+		};
+		neat_t neat = neat_create(config);
+		ASSERT(neat);
+
+		/* Zero weights give the same result in any order */
+		for(int j = 0; j < 50; j++){
+			neat_evaluate(neat, xor_fitness, NULL);
+			neat_epoch(neat);
+		}
+
+		float outputs[16 * 4];
+		neat_run_batch(neat, xor_inputs[0], 4, outputs);
+
+		/* The sums are at most a few units here */
+		bool mutated = false;
+		for(int j = 0; j < config.population_size; j++){
+			for(int k = 0; k < 4; k++){
+				const float *results =
+					neat_run(neat, j, xor_inputs[k]);
+				ASSERT(results);
+
+				float output = outputs[j * 4 + k];
+				ASSERT_IN_RANGE(results[0], output, 1e-5);
+				mutated |= output != 0.5f;
+			}
+		}
+		ASSERT(mutated);
+
+		neat_destroy(neat);
+	}
+
+	PASS();
+}
+
+TEST neat_run_batch_reduced_precision()
+{
+	const enum nn_precision precisions[] = {
+		NN_PRECISION_BF16,
+		NN_PRECISION_INT8
+	};
+	const enum neat_backend backends[] = {
+		NEAT_BACKEND_CPU,
+		NEAT_BACKEND_PACKED
+	};
+
+	for(int i = 0; i < 2; i++){
+		for(int j = 0; j < 2; j++){
+			struct neat_config config = {
+				.network_inputs = 2,
+				.network_outputs = 1,
+				.network_hidden_nodes = 8,
+				.network_hidden_layers = 2,
+				.population_size = 4,
+				.network_precision = precisions[i],
+				.backend = backends[j]
+			};
+			neat_t neat = neat_create(config);
+			ASSERT(neat);
+
+			/* Mutated weights that can't be stored exactly */
+			for(int k = 0; k < 10; k++){
+				neat_evaluate(neat, xor_fitness, NULL);
+				neat_epoch(neat);
+			}
+
+			/* The same rounded weights as a single run, added
+			 * in another order
+			 */
+			float outputs[4 * 4];
+			neat_run_batch(neat, xor_inputs[0], 4, outputs);
+			for(int k = 0; k < config.population_size; k++){
+				for(int l = 0; l < 4; l++){
+					const float *results =
+						neat_run(neat,
+							 k,
+							 xor_inputs[l]);
+					ASSERT_IN_RANGE(results[0],
+							outputs[k * 4 + l],
+							1e-5);
+				}
+			}
+
+			neat_destroy(neat);
+		}
+	}
+
+	PASS();
+}
+
+TEST neat_packed_backend()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 3,
+		.population_size = 20,
+		.backend = NEAT_BACKEND_PACKED
+	};
+	neat_t neat = neat_create(config);
+	ASSERT(neat);
+
+	/* More than a single block */
+	const size_t nsamples = 150;
+	float *inputs = malloc(sizeof(float) * nsamples * 2);
+	float *outputs = malloc(sizeof(float) * config.population_size *
+				nsamples * 3);
+	ASSERT(inputs && outputs);
+	for(size_t i = 0; i < nsamples * 2; i++){
+		inputs[i] = (float)(i % 13) / 6.0 - 1.0;
+	}
+
+	for(int epoch = 0; epoch < 2; epoch++){
+		neat_run_batch(neat, inputs, nsamples, outputs);
+
+		for(size_t i = 0; i < config.population_size; i++){
+			for(size_t j = 0; j < nsamples; j++){
+				const float *results =
+					neat_run(neat, i, inputs + j * 2);
+				for(size_t k = 0; k < 3; k++){
+					size_t sample = i * nsamples + j;
+					float output = outputs[sample * 3 + k];
+					ASSERT_IN_RANGE(results[k],
+							output,
+							1e-5);
+				}
+			}
+		}
+
+		neat_evaluate(neat, xor_fitness, NULL);
+		neat_epoch(neat);
+	}
+
+	/* Only the first run copies every genome */
+	struct neat_stats stats;
+	if(neat_get_stats(neat, &stats)){
+		ASSERT(stats.nuploads < 2 * config.population_size);
+	}
+
+	free(inputs);
+	free(outputs);
+	neat_destroy(neat);
+	PASS();
+}
+
+TEST neat_evaluate_xor()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.population_size = 16,
+		.evaluation_threads = 4
+	};
+	neat_t neat = neat_create(config);
+	ASSERT(neat);
+
+	/* Different genomes so every one has its own fitness */
+	for(int i = 0; i < 50; i++){
+		neat_evaluate(neat, xor_fitness, NULL);
+		neat_epoch(neat);
+	}
+	neat_evaluate(neat, xor_fitness, NULL);
+
+	/* The stored fitness is the same as a sequential evaluation */
+	bool different = false;
+	for(int i = 0; i < config.population_size; i++){
+		float expected = xor_fitness(neat, i, NULL);
+		ASSERT_EQ_FMT(expected, neat_get_fitness(neat, i), "%g");
+
+		different |= expected != neat_get_fitness(neat, 0);
+	}
+	ASSERT(different);
+
+	size_t best = neat_get_best_genome(neat);
+	for(int i = 0; i < config.population_size; i++){
+		ASSERT(neat_get_fitness(neat, i) <=
+		       neat_get_fitness(neat, best));
+	}
+
+	neat_destroy(neat);
+	PASS();
+}
+
+TEST neat_generational_epochs()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.population_size = 50,
+
+		.epoch_replacement_fraction = 0.5,
+		.genome_minimum_ticks_alive = 2
+	};
+	neat_t neat = neat_create(config);
+	ASSERT(neat);
+
+	size_t nreplaced = 0;
+	for(int i = 0; i < 100; i++){
+		neat_evaluate(neat, xor_fitness, NULL);
+
+		float fitness[50];
+		for(size_t j = 0; j < config.population_size; j++){
+			fitness[j] = neat_get_fitness(neat, j);
+		}
+
+		neat_epoch(neat);
+
+		/* At most half of them are replaced by children, which start
+		 * with the fitness of their parent
+		 */
+		size_t nchanged = 0;
+		for(size_t j = 0; j < config.population_size; j++){
+			bool inherited = false;
+			for(size_t k = 0; k < config.population_size; k++){
+				inherited |= neat_get_fitness(neat, j) ==
+					     fitness[k];
+			}
+			ASSERT(inherited);
+			nchanged += neat_get_fitness(neat, j) != fitness[j];
+
+			ASSERT(neat_get_species(neat, j) <
+			       config.population_size);
+		}
+		ASSERT(nchanged <= config.population_size / 2);
+		nreplaced += nchanged;
+	}
+	ASSERT(nreplaced > 0);
+
+	neat_destroy(neat);
+	PASS();
+}
+
+TEST neat_genomes_grow()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.network_hidden_nodes = 3,
+		.network_hidden_layers = 2,
+		.population_size = 50,
+
+		.epoch_replacement_fraction = 0.5,
+		.species_crossover_probability = 0.5,
+		.genome_minimum_ticks_alive = 2,
+		.genome_compatibility_treshold = 0.5
+	};
+	neat_t neat = neat_create(config);
+	config.random_seed = 1;
+	neat_t other = neat_create(config);
+	ASSERT(neat && other);
+
+	for(int i = 0; i < 200; i++){
+		neat_evaluate(neat, xor_fitness, NULL);
+		neat_epoch(neat);
+	}
+	for(int i = 0; i < 3; i++){
+		neat_evaluate(other, xor_fitness, NULL);
+	}
+
+	/* Some children got hidden nodes, but never more than allowed */
+	size_t grown = config.population_size;
+	size_t max_weights = (2 + 1) * 3 + (3 + 1) * 3 * 1 + (3 + 1);
+	for(size_t i = 0; i < config.population_size; i++){
+		struct nn_program *program = neat_export(neat, i);
+		ASSERT(program);
+		ASSERT(program->nweights <= max_weights);
+		if(program->ninstructions > 2){
+			grown = i;
+		}
+		nn_program_destroy(program);
+	}
+	ASSERT(grown < config.population_size);
+
+	/* Grown genomes keep their sorted innovations so they still migrate */
+	size_t message_size = neat_genome_message_size(neat);
+	char *message = malloc(message_size);
+	ASSERT(message);
+
+	neat_set_fitness(neat, grown, 100.0f);
+	size_t size = neat_write_genome(neat, grown, message, message_size);
+	ASSERT(neat_read_genome(other, message, size));
+	size_t immigrant = neat_get_best_genome(other);
+	for(int i = 0; i < 4; i++){
+		ASSERT_EQ_FMT(neat_run(neat, grown, xor_inputs[i])[0],
+			      neat_run(other, immigrant, xor_inputs[i])[0],
+			      "%g");
+	}
+	free(message);
+
+	neat_destroy(other);
+	neat_destroy(neat);
+	PASS();
+}
+
+TEST neat_save_load()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.population_size = 30,
+		.random_seed = 7,
+
+		.epoch_replacement_fraction = 0.3,
+		.genome_minimum_ticks_alive = 1
+	};
+	neat_t neat = neat_create(config);
+	ASSERT(neat);
+
+	for(int i = 0; i < 10; i++){
+		neat_evaluate(neat, xor_fitness, NULL);
+		neat_epoch(neat);
+	}
+
+	const char *path = "neat-test-save.bin";
+	ASSERT(neat_save(neat, path));
+	neat_t loaded = neat_load(path);
+	ASSERT(loaded);
+	remove(path);
+
+	/* Both continue the same way from the same state */
+	for(int i = 0; i < 10; i++){
+		neat_evaluate(neat, xor_fitness, NULL);
+		neat_epoch(neat);
+		neat_evaluate(loaded, xor_fitness, NULL);
+		neat_epoch(loaded);
+	}
+
+	for(int i = 0; i < config.population_size; i++){
+		for(int j = 0; j < 4; j++){
+			float expected = neat_run(neat, i, xor_inputs[j])[0];
+			float result = neat_run(loaded, i, xor_inputs[j])[0];
+			ASSERT_EQ_FMT(expected, result, "%g");
+		}
+	}
+
+	ASSERT_EQ(NULL, neat_load("neat-test-missing.bin"));
+
+	neat_destroy(loaded);
+	neat_destroy(neat);
+	PASS();
+}
+
+TEST neat_reduced_weights()
+{
+	const enum nn_precision precisions[] = {
+		NN_PRECISION_BF16,
+		NN_PRECISION_INT8
+	};
+
+	for(int i = 0; i < 2; i++){
+		struct neat_config config = {
+			.network_inputs = 2,
+			.network_outputs = 1,
+			.network_hidden_nodes = 4,
+			.network_hidden_layers = 2,
+			.population_size = 20,
+			.random_seed = 3,
+			.network_precision = precisions[i],
+
+			.epoch_replacement_fraction = 0.3,
+			.genome_minimum_ticks_alive = 1
+		};
+		neat_t neat = neat_create(config);
+		ASSERT(neat);
+
+		for(int j = 0; j < 20; j++){
+			neat_evaluate(neat, xor_fitness, NULL);
+			neat_epoch(neat);
+		}
+
+		/* The rows are saved in the precision they're stored in */
+		const char *path = "neat-test-reduced.bin";
+		ASSERT(neat_save(neat, path));
+		neat_t loaded = neat_load(path);
+		ASSERT(loaded);
+		remove(path);
+
+		for(int j = 0; j < 20; j++){
+			neat_evaluate(neat, xor_fitness, NULL);
+			neat_epoch(neat);
+			neat_evaluate(loaded, xor_fitness, NULL);
+			neat_epoch(loaded);
+		}
+
+		size_t best = neat_get_best_genome(neat);
+		struct nn_program *program = neat_export(neat, best);
+		ASSERT(program);
+
+		float expected[4];
+		for(int j = 0; j < 4; j++){
+			expected[j] = neat_run(neat, best, xor_inputs[j])[0];
+			float result = neat_run(loaded, best, xor_inputs[j])[0];
+			ASSERT_EQ_FMT(expected[j], result, "%g");
+		}
+
+		/* Messages carry the weights as floats */
+		size_t size = neat_genome_message_size(neat);
+		void *message = malloc(size);
+		ASSERT(message);
+		size_t written = neat_write_genome(neat, best, message, size);
+		ASSERT(written > 0);
+		ASSERT(neat_read_genome(loaded, message, written));
+		free(message);
+
+		/* The export has its own weights instead of the row */
+		neat_destroy(loaded);
+		neat_destroy(neat);
+		for(int j = 0; j < 4; j++){
+			float *results = nn_program_run(program, xor_inputs[j]);
+			ASSERT_EQ_FMT(expected[j], results[0], "%g");
+		}
+
+		nn_program_destroy(program);
+	}
+
+	PASS();
+}
+
+/* Writes a population with every byte of the file changed once and loads it */
+static enum greatest_test_res neat_load_corrupted_image(bool packed_weights)
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.network_hidden_nodes = 2,
+		.network_hidden_layers = 1,
+		.population_size = 6,
+		.packed_weights = packed_weights,
+
+		.epoch_replacement_fraction = 0.5,
+		.genome_minimum_ticks_alive = 1
+	};
+	neat_t neat = neat_create(config);
+	ASSERT(neat);
+
+	for(int i = 0; i < 5; i++){
+		neat_evaluate(neat, xor_fitness, NULL);
+		neat_epoch(neat);
+	}
+
+	const char *path = "neat-test-corrupted.bin";
+	ASSERT(neat_save(neat, path));
+	neat_destroy(neat);
+
+	FILE *file = fopen(path, "rb");
+	ASSERT(file);
+	ASSERT_EQ(0, fseek(file, 0, SEEK_END));
+	long size = ftell(file);
+	ASSERT(size > 0);
+	rewind(file);
+	unsigned char *image = malloc(size);
+	ASSERT(image);
+	ASSERT_EQ(1, fread(image, size, 1, file));
+	fclose(file);
+
+	/* A file with any byte changed is either refused or can be used */
+	for(long i = 0; i < size; i++){
+		image[i] ^= 0xff;
+
+		file = fopen(path, "wb");
+		ASSERT(file);
+		ASSERT_EQ(1, fwrite(image, size, 1, file));
+		fclose(file);
+
+		neat_t loaded = neat_load(path);
+		if(loaded != NULL){
+			neat_evaluate(loaded, xor_fitness, NULL);
+			neat_epoch(loaded);
+			neat_destroy(loaded);
+		}
+
+		image[i] ^= 0xff;
+	}
+
+	/* Cut off */
+	file = fopen(path, "wb");
+	ASSERT(file);
+	ASSERT_EQ(1, fwrite(image, size - 1, 1, file));
+	fclose(file);
+	ASSERT_EQ(NULL, neat_load(path));
+
+	remove(path);
+	free(image);
+	PASS();
+}
+
+TEST neat_load_corrupted()
+{
+	CHECK_CALL(neat_load_corrupted_image(false));
+	CHECK_CALL(neat_load_corrupted_image(true));
+	PASS();
+}
+
+TEST neat_packed_weights()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.network_hidden_nodes = 4,
+		.network_hidden_layers = 1,
+		.population_size = 30,
+		.random_seed = 3,
+
+		.epoch_replacement_fraction = 0.3,
+		.genome_minimum_ticks_alive = 1
+	};
+	neat_t neat = neat_create(config);
+	config.packed_weights = true;
+	neat_t packed = neat_create(config);
+	ASSERT(neat && packed);
+
+	/* Where the weights are kept doesn't change the evolution */
+	for(int i = 0; i < 10; i++){
+		neat_evaluate(neat, xor_fitness, NULL);
+		neat_epoch(neat);
+		neat_evaluate(packed, xor_fitness, NULL);
+		neat_epoch(packed);
+	}
+
+	const char *path = "neat-test-packed.bin";
+	ASSERT(neat_save(packed, path));
+	neat_t loaded = neat_load(path);
+	ASSERT(loaded);
+	remove(path);
+
+	for(int i = 0; i < config.population_size; i++){
+		for(int j = 0; j < 4; j++){
+			float expected = neat_run(neat, i, xor_inputs[j])[0];
+			ASSERT_EQ_FMT(expected,
+				      neat_run(packed, i, xor_inputs[j])[0],
+				      "%g");
+			ASSERT_EQ_FMT(expected,
+				      neat_run(loaded, i, xor_inputs[j])[0],
+				      "%g");
+		}
+	}
+
+	/* Messages don't depend on the layout of the sender */
+	size_t message_size = neat_genome_message_size(packed);
+	ASSERT_EQ(neat_genome_message_size(neat), message_size);
+	char *message = malloc(message_size);
+	ASSERT(message);
+
+	neat_set_fitness(packed, 5, 100.0f);
+	size_t size = neat_write_genome(packed, 5, message, message_size);
+	ASSERT(size > 0);
+	ASSERT(neat_read_genome(neat, message, size));
+	size_t immigrant = neat_get_best_genome(neat);
+
+	neat_set_fitness(neat, immigrant, 200.0f);
+	size = neat_write_genome(neat, immigrant, message, message_size);
+	ASSERT(neat_read_genome(loaded, message, size));
+	for(int i = 0; i < 4; i++){
+		float expected = neat_run(packed, 5, xor_inputs[i])[0];
+		ASSERT_EQ_FMT(expected,
+			      neat_run(neat, immigrant, xor_inputs[i])[0],
+			      "%g");
+		ASSERT_EQ_FMT(expected,
+			      neat_run(loaded,
+				       neat_get_best_genome(loaded),
+				       xor_inputs[i])[0],
+			      "%g");
+	}
+	free(message);
+
+	neat_destroy(loaded);
+	neat_destroy(packed);
+	neat_destroy(neat);
+	PASS();
+}
+
+TEST neat_export_best()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.population_size = 8
+	};
+	neat_t neat = neat_create(config);
+	ASSERT(neat);
+
+	neat_evaluate(neat, xor_fitness, NULL);
+	size_t best = neat_get_best_genome(neat);
+	ASSERT(best < config.population_size);
+
+	struct nn_program *program = neat_export(neat, best);
+	ASSERT(program);
+
+	float expected[4];
+	for(int i = 0; i < 4; i++){
+		expected[i] = neat_run(neat, best, xor_inputs[i])[0];
+	}
+
+	/* The program is still usable without the population */
+	neat_destroy(neat);
+	for(int i = 0; i < 4; i++){
+		float *results = nn_program_run(program, xor_inputs[i]);
+		ASSERT_EQ_FMT(expected[i], results[0], "%g");
+	}
+
+	FILE *file = tmpfile();
+	ASSERT(file);
+	ASSERT(nn_program_write_c(program, file, "xor_champion"));
+	ASSERT(ftell(file) > 0);
+	fclose(file);
+
+	nn_program_destroy(program);
+	PASS();
+}
+
+TEST neat_export_sparse()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.network_hidden_nodes = 8,
+		.network_hidden_layers = 2,
+		.population_size = 16
+	};
+	neat_t neat = neat_create(config);
+	ASSERT(neat);
+
+	/* The weights start at zero so there is nothing to compute */
+	struct nn_program *program = neat_export(neat, 0);
+	ASSERT(program);
+	ASSERT_EQ(NN_OPCODE_SPARSE, program->instruction[0].opcode);
+	ASSERT_EQ(0, program->nedges);
+	nn_program_destroy(program);
+
+	for(int i = 0; i < 50; i++){
+		neat_evaluate(neat, xor_fitness, NULL);
+		neat_epoch(neat);
+	}
+
+	/* Sparse or not, the exported program is the one neat_run uses */
+	for(size_t i = 0; i < config.population_size; i++){
+		program = neat_export(neat, i);
+		ASSERT(program);
+
+		for(int j = 0; j < 4; j++){
+			ASSERT_EQ_FMT(neat_run(neat, i, xor_inputs[j])[0],
+				      nn_program_run(program, xor_inputs[j])[0],
+				      "%g");
+		}
+		nn_program_destroy(program);
+	}
+
+	neat_destroy(neat);
+	PASS();
+}
+
+TEST neat_migrate_genomes()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.population_size = 8
+	};
+	neat_t a = neat_create(config);
+	config.random_seed = 1;
+	neat_t b = neat_create(config);
+	ASSERT(a && b);
+
+	neat_evaluate(a, xor_fitness, NULL);
+	neat_evaluate(b, xor_fitness, NULL);
+
+	/* A message restores the genome and its fitness */
+	size_t message_size = neat_genome_message_size(a);
+	char *message = malloc(message_size);
+	ASSERT(message);
+
+	neat_set_fitness(a, 3, 100.0f);
+	size_t size = neat_write_genome(a, 3, message, message_size);
+	ASSERT(size > 0);
+	ASSERT_EQ(0, neat_write_genome(a, 3, message, size - 1));
+
+	ASSERT_FALSE(neat_read_genome(b, message, size - 1));
+	ASSERT(neat_read_genome(b, message, size));
+	size_t immigrant = neat_get_best_genome(b);
+	for(int i = 0; i < 4; i++){
+		ASSERT_EQ_FMT(neat_run(a, 3, xor_inputs[i])[0],
+			      neat_run(b, immigrant, xor_inputs[i])[0],
+			      "%g");
+	}
+
+	message[0] = 'X';
+	ASSERT_FALSE(neat_read_genome(b, message, size));
+	free(message);
+
+	/* Connect both through queues in a ring */
+	struct neat_queue *queue_a = neat_queue_create(4, message_size);
+	struct neat_queue *queue_b = neat_queue_create(4, message_size);
+	struct neat_transport transport_a = {
+		.send = neat_queue_send,
+		.receive = neat_queue_receive,
+		.destination = queue_b,
+		.source = queue_a
+	};
+	struct neat_transport transport_b = transport_a;
+	transport_b.destination = queue_a;
+	transport_b.source = queue_b;
+
+	ASSERT_EQ(0, neat_migrate(a, &transport_a, 2));
+	ASSERT_EQ(2, neat_migrate(b, &transport_b, 2));
+	ASSERT_EQ(2, neat_migrate(a, &transport_a, 0));
+	ASSERT_EQ(0, neat_migrate(b, &transport_b, 0));
+
+	/* The queue only has room for 4, the others are dropped */
+	neat_reset_stats(a);
+	ASSERT_EQ(0, neat_migrate(a, &transport_a, 6));
+	struct neat_stats stats;
+	if(neat_get_stats(a, &stats)){
+		ASSERT_EQ(6, stats.nmigrants);
+		ASSERT_EQ(2, stats.ndropped_migrants);
+	}
+	ASSERT(neat_migrate(b, &transport_b, 0) <= 4);
+
+	neat_evaluate(a, xor_fitness, NULL);
+	neat_epoch(a);
+
+	neat_queue_destroy(queue_a);
+	neat_queue_destroy(queue_b);
+	neat_destroy(a);
+	neat_destroy(b);
+	PASS();
+}
+
+TEST neat_async_evaluation()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.population_size = 16,
+		.epoch_reports = 4,
+		.genome_minimum_ticks_alive = 1
+	};
+	neat_t neat = neat_create(config);
+	ASSERT(neat);
+
+	/* A genome is only handed out once at a time */
+	size_t acquired[16];
+	bool seen[16] = {false};
+	for(size_t i = 0; i < config.population_size; i++){
+		acquired[i] = neat_acquire_genome(neat);
+		ASSERT(acquired[i] < config.population_size);
+		ASSERT_FALSE(seen[acquired[i]]);
+		seen[acquired[i]] = true;
+	}
+	ASSERT_EQ(NEAT_NO_GENOME, neat_acquire_genome(neat));
+
+	/* Out of order */
+	for(size_t i = config.population_size; i > 0; i--){
+		size_t genome = acquired[i - 1];
+		neat_report_fitness(neat,
+				    genome,
+				    xor_fitness(neat, genome, NULL));
+	}
+
+	/* More workers than genomes that can be replaced */
+	int nreported = 0;
+	#pragma omp parallel for num_threads(4) reduction(+:nreported)
+	for(int i = 0; i < 400; i++){
+		size_t genome = neat_acquire_genome(neat);
+		if(genome == NEAT_NO_GENOME){
+			continue;
+		}
+
+		neat_report_fitness(neat,
+				    genome,
+				    xor_fitness(neat, genome, NULL));
+		nreported++;
+	}
+	ASSERT(nreported > 0);
+
+	ASSERT(neat_get_best_genome(neat) < config.population_size);
+
+	neat_destroy(neat);
+	PASS();
+}
+
+TEST neat_migrate_during_async_evaluation()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.population_size = 16,
+		.epoch_reports = 4,
+		.genome_minimum_ticks_alive = 1
+	};
+	neat_t a = neat_create(config);
+	config.random_seed = 1;
+	neat_t b = neat_create(config);
+	ASSERT(a && b);
+
+	size_t message_size = neat_genome_message_size(a);
+	struct neat_queue *queue_a = neat_queue_create(4, message_size);
+	struct neat_queue *queue_b = neat_queue_create(4, message_size);
+	struct neat_transport transport_a = {
+		.send = neat_queue_send,
+		.receive = neat_queue_receive,
+		.destination = queue_b,
+		.source = queue_a
+	};
+	struct neat_transport transport_b = transport_a;
+	transport_b.destination = queue_a;
+	transport_b.source = queue_b;
+
+	/* Old enough to be replaced by the immigrants */
+	for(int i = 0; i < 3; i++){
+		neat_evaluate(b, xor_fitness, NULL);
+	}
+
+	/* The epochs of the workers replace genomes while they're migrating */
+	size_t nreceived = 0;
+	#pragma omp parallel num_threads(4) reduction(+:nreceived)
+	{
+		if(omp_get_thread_num() == 0){
+			for(int i = 0; i < 100; i++){
+				neat_migrate(a, &transport_a, 2);
+				nreceived += neat_migrate(b, &transport_b, 0);
+			}
+		}else{
+			for(int i = 0; i < 400; i++){
+				size_t genome = neat_acquire_genome(a);
+				if(genome == NEAT_NO_GENOME){
+					continue;
+				}
+
+				float fitness = xor_fitness(a, genome, NULL);
+				neat_report_fitness(a, genome, fitness);
+			}
+		}
+	}
+	ASSERT(nreceived > 0);
+
+	neat_queue_destroy(queue_a);
+	neat_queue_destroy(queue_b);
+	neat_destroy(a);
+	neat_destroy(b);
+	PASS();
+}
+
+TEST neat_speciate_deterministic()
+{
+	const size_t ngenomes = 300;
+	const float tresholds[] = {-1.0f, 0.5f};
+	const size_t thread_counts[] = {1, 4};
+
+	size_t species[2][300];
+	for(int i = 0; i < 2; i++){
+		for(int j = 0; j < 2; j++){
+			struct neat_config config = {
+				.network_inputs = 2,
+				.network_outputs = 1,
+				.population_size = ngenomes,
+				.evaluation_threads = thread_counts[j],
+				.genome_compatibility_treshold = tresholds[i]
+			};
+			neat_t neat = neat_create(config);
+			ASSERT(neat);
+
+			/* The second time there are enough species to compare
+			 * with to run in parallel
+			 */
+			neat_speciate(neat);
+			neat_speciate(neat);
+
+			for(size_t k = 0; k < ngenomes; k++){
+				species[j][k] = neat_get_species(neat, k);
+			}
+			neat_destroy(neat);
+		}
+
+		for(size_t k = 0; k < ngenomes; k++){
+			ASSERT_EQ(species[0][k], species[1][k]);
+		}
+
+		/* The genomes are all the same at the start */
+		if(tresholds[i] < 0.0f){
+			ASSERT(species[0][0] != species[0][1]);
+		}else{
+			ASSERT_EQ(species[0][0], species[0][ngenomes - 1]);
+		}
+	}
+
+	PASS();
+}
+
+TEST neat_remove_extinct_species()
+{
+	for(int reset = 0; reset < 2; reset++){
+		struct neat_config config = {
+			.network_inputs = 2,
+			.network_outputs = 1,
+			.population_size = 16,
+			.reset_on_extinction = reset,
+			.genome_compatibility_treshold = -1.0f
+		};
+		neat_t neat = neat_create(config);
+		ASSERT(neat);
+
+		/* Every genome gets a new species both times so all the
+		 * species of the first time die out
+		 */
+		neat_speciate(neat);
+		neat_speciate(neat);
+
+		size_t largest = 0;
+		for(size_t i = 0; i < config.population_size; i++){
+			size_t species = neat_get_species(neat, i);
+			if(species > largest){
+				largest = species;
+			}
+		}
+
+		/* Either way the species that died out don't pile up */
+		ASSERT_EQ(config.population_size - 1, largest);
+
+		/* The population still works with the species removed */
+		neat_evaluate(neat, xor_fitness, NULL);
+		neat_epoch(neat);
+		ASSERT(neat_save(neat, "neat-test-species.bin"));
+		neat_t loaded = neat_load("neat-test-species.bin");
+		ASSERT(loaded);
+		remove("neat-test-species.bin");
+		neat_epoch(loaded);
+
+		neat_destroy(loaded);
+		neat_destroy(neat);
+	}
+
+	PASS();
+}
+
+TEST neat_species_stay_bounded()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.network_hidden_nodes = 4,
+		.network_hidden_layers = 2,
+		.population_size = 50,
+
+		.genome_compatibility_treshold = 0.2
+	};
+	neat_t neat = neat_create(config);
+	ASSERT(neat);
+
+	/* Species keep dying out and getting created, there is never one
+	 * more than there are genomes. Speciating again now and then empties
+	 * species as well
+	 */
+	for(int i = 0; i < 5000; i++){
+		neat_evaluate(neat, xor_fitness, NULL);
+		neat_epoch(neat);
+		if(i % 500 == 499){
+			neat_speciate(neat);
+		}
+
+		for(size_t j = 0; j < config.population_size; j++){
+			ASSERT(neat_get_species(neat, j) <
+			       config.population_size);
+		}
+	}
+
+	neat_destroy(neat);
+	PASS();
+}
+
+static float counting_fitness(neat_t neat, size_t genome_id, void *userdata)
+{
+	size_t *ncalls = userdata;
+
+	#pragma omp atomic
+	(*ncalls)++;
+
+	return xor_fitness(neat, genome_id, NULL);
+}
+
+TEST neat_evaluate_cached_genomes()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.population_size = 8
+	};
+	neat_t neat = neat_create(config);
+	ASSERT(neat);
+
+	size_t ncalls = 0;
+	neat_evaluate_cached(neat, counting_fitness, &ncalls, 1);
+	ASSERT_EQ(config.population_size, ncalls);
+
+	size_t best = neat_get_best_genome(neat);
+	float best_fitness = xor_fitness(neat, best, NULL);
+
+	/* Nothing changed */
+	ncalls = 0;
+	neat_evaluate_cached(neat, counting_fitness, &ncalls, 1);
+	ASSERT_EQ(0, ncalls);
+	ASSERT_EQ(best, neat_get_best_genome(neat));
+
+	/* Only the child of the epoch can have been mutated */
+	neat_epoch(neat);
+	neat_evaluate_cached(neat, counting_fitness, &ncalls, 1);
+	ASSERT(ncalls <= 1);
+
+	/* Another input set evaluates everything again */
+	ncalls = 0;
+	neat_evaluate_cached(neat, counting_fitness, &ncalls, 2);
+	ASSERT_EQ(config.population_size, ncalls);
+	ASSERT(xor_fitness(neat, neat_get_best_genome(neat), NULL) >=
+	       best_fitness);
+
+	neat_destroy(neat);
+	PASS();
+}
+
+TEST neat_stats()
+{
+	struct neat_config config = {
+		.network_inputs = 2,
+		.network_outputs = 1,
+		.population_size = 8
+	};
+	neat_t neat = neat_create(config);
+	ASSERT(neat);
+
+	neat_evaluate(neat, xor_fitness, NULL);
+	neat_epoch(neat);
+	neat_epoch(neat);
+
+	struct neat_stats stats;
+	if(!neat_get_stats(neat, &stats)){
+		neat_destroy(neat);
+		SKIPm("built without NEAT_STATS");
+	}
+
+	ASSERT_EQ(2, stats.nepochs);
+	ASSERT_EQ(config.population_size, stats.nevaluations);
+	ASSERT(stats.nruns >= stats.nevaluations);
+	ASSERT(stats.nflops > 0);
+	ASSERT(stats.ncompilations > 0);
+	ASSERT(stats.evaluations_per_second > 0.0);
+	ASSERT(stats.nspecies > 0);
+	ASSERT(stats.smallest_species <= stats.largest_species);
+	ASSERT(stats.largest_species <= config.population_size);
+
+	neat_reset_stats(neat);
+	ASSERT(neat_get_stats(neat, &stats));
+	ASSERT_EQ(0, stats.nepochs);
+	ASSERT_EQ(0, stats.nruns);
+
+	/* Runs outside of an evaluation are counted when the stats are read */
+	#pragma omp parallel for num_threads(4)
+	for(int i = 0; i < 4; i++){
+		neat_run(neat, i, xor_inputs[i]);
+	}
+	ASSERT(neat_get_stats(neat, &stats));
+	ASSERT_EQ(4, stats.nruns);
+	ASSERT(stats.nflops > 0);
+	ASSERT_EQ(0, stats.nallocations);
+
+	neat_destroy(neat);
+	PASS();
+}
+
 TEST neat_xor()
 {
 	struct neat_config config = {
@@ -87,41 +1182,153 @@ TEST neat_xor()
 
 TEST nn_create_and_destroy()
 {
-	struct nn_ffnet *net = nn_ffnet_create(2, 1, 2, 1);
+	struct nn_ffnet *net = nn_ffnet_create(2, 1, 2, 1);
+	ASSERT(net);
+
+	nn_ffnet_destroy(net);
+	PASS();
+}
+
+TEST nn_randomize()
+{
+	struct nn_ffnet *net = nn_ffnet_create(2, 1, 2, 1);
+	ASSERT(net);
+
+	nn_ffnet_randomize(net);
+
+	ASSERT(net->weight[0] != 0.0);
+
+	nn_ffnet_destroy(net);
+	PASS();
+}
+
+TEST nn_rng_repeatable()
+{
+	struct nn_rng rng, same, jumped;
+	nn_rng_seed(&rng, 42);
+	nn_rng_seed(&same, 42);
+	jumped = rng;
+	nn_rng_jump(&jumped);
+
+	for(int i = 0; i < 100; i++){
+		uint64_t random = nn_rng_next(&rng);
+		ASSERT_EQ(random, nn_rng_next(&same));
+		ASSERT(random != nn_rng_next(&jumped));
+	}
+
+	for(int i = 0; i < 100; i++){
+		float value = nn_rng_float(&rng, -2.0, 3.0);
+		ASSERT(value >= -2.0 && value < 3.0);
+		ASSERT(nn_rng_index(&rng, 7) < 7);
+	}
+
+	/* Check the range and spread of the bulk numbers */
+	float values[1001];
+	nn_rng_fill(&rng, values, 1001, -0.5, 0.5);
+	float sum = 0.0;
+	for(int i = 0; i < 1001; i++){
+		ASSERT(values[i] >= -0.5 && values[i] < 0.5);
+		sum += values[i];
+	}
+	ASSERT_IN_RANGE(0.0, sum / 1001, 0.05);
+
+	PASS();
+}
+
+TEST nn_copy()
+{
+	struct nn_ffnet *net = nn_ffnet_create(1, 0, 1, 0);
 	ASSERT(net);
 
+	nn_ffnet_randomize(net);
+
+	struct nn_ffnet *copy = nn_ffnet_copy(net);
+	ASSERT(copy);
+
+	for(int i = 0; i < net->nweights; i++){
+		ASSERT_EQ_FMT(net->weight[i], copy->weight[i], "%g");
+	}
+
+	nn_ffnet_destroy(copy);
 	nn_ffnet_destroy(net);
 	PASS();
 }
 
-TEST nn_randomize()
+TEST nn_copy_into()
 {
-	struct nn_ffnet *net = nn_ffnet_create(2, 1, 2, 1);
+	struct nn_ffnet *net = nn_ffnet_create(3, 4, 2, 2);
 	ASSERT(net);
 
 	nn_ffnet_randomize(net);
 
-	ASSERT(net->weight[0] != 0.0);
+	size_t bytes = nn_ffnet_size(3, 4, 2, 2);
+	ASSERT_EQ(bytes, nn_ffnet_bytes(net));
+	ASSERT_EQ(nn_ffnet_weight_count(3, 4, 2, 2), net->nweights);
+
+	void *memory = malloc(bytes);
+	ASSERT(memory);
 
+	struct nn_ffnet *copy = nn_ffnet_copy_into(memory, net);
+	ASSERT_EQ(memory, copy);
+
+	const float inputs[3] = {0.1f, 0.2f, 0.3f};
+	float *results = nn_ffnet_run(net, inputs);
+	float *copy_results = nn_ffnet_run(copy, inputs);
+	for(int i = 0; i < 2; i++){
+		ASSERT_EQ_FMT(results[i], copy_results[i], "%g");
+	}
+
+	/* Reinitialize the same memory as an empty network */
+	struct nn_ffnet *empty = nn_ffnet_init(memory, 3, 4, 2, 2);
+	for(int i = 0; i < empty->nweights; i++){
+		ASSERT_EQ_FMT(0.0f, empty->weight[i], "%g");
+	}
+
+	free(memory);
 	nn_ffnet_destroy(net);
 	PASS();
 }
 
-TEST nn_copy()
+TEST nn_init_external()
 {
-	struct nn_ffnet *net = nn_ffnet_create(1, 0, 1, 0);
+	struct nn_ffnet *net = nn_ffnet_create(3, 4, 2, 2);
 	ASSERT(net);
-
 	nn_ffnet_randomize(net);
 
-	struct nn_ffnet *copy = nn_ffnet_copy(net);
-	ASSERT(copy);
+	/* Only the weights live outside of the memory */
+	size_t bytes = nn_ffnet_size_external(3, 4, 2, 2);
+	ASSERT_EQ(nn_ffnet_size(3, 4, 2, 2) - sizeof(float) * net->nweights,
+		  bytes);
+
+	void *memory = malloc(bytes);
+	float *weights = malloc(sizeof(float) * net->nweights);
+	ASSERT(memory && weights);
+
+	struct nn_ffnet *external = nn_ffnet_init_external(memory,
+							   weights,
+							   3, 4, 2, 2);
+	ASSERT_EQ(weights, external->weight);
+	ASSERT_EQ(bytes, nn_ffnet_bytes(external));
+	for(int i = 0; i < external->nweights; i++){
+		ASSERT_EQ_FMT(0.0f, weights[i], "%g");
+	}
 
-	for(int i = 0; i < net->nweights; i++){
-		ASSERT_EQ_FMT(net->weight[i], copy->weight[i], "%g");
+	memcpy(weights, net->weight, sizeof(float) * net->nweights);
+	const float inputs[3] = {0.1f, 0.2f, 0.3f};
+	float *results = nn_ffnet_run(net, inputs);
+	float *external_results = nn_ffnet_run(external, inputs);
+	for(int i = 0; i < 2; i++){
+		ASSERT_EQ_FMT(results[i], external_results[i], "%g");
 	}
 
+	/* A copy shares the weights */
+	struct nn_ffnet *copy = nn_ffnet_copy(external);
+	ASSERT_EQ(weights, copy->weight);
+	ASSERT(copy->output != external->output);
+
 	nn_ffnet_destroy(copy);
+	free(memory);
+	free(weights);
 	nn_ffnet_destroy(net);
 	PASS();
 }
@@ -185,6 +1392,45 @@ TEST nn_run_relu()
 	PASS();
 }
 
+TEST nn_run_activations()
+{
+	struct nn_ffnet *net = nn_ffnet_create(1, 1, 1, 1);
+	ASSERT(net);
+
+	/* Pass the input straight through the hidden node */
+	nn_ffnet_set_bias(net, 0.0);
+	for(int i = 0; i < net->nweights; i++){
+		net->weight[i] = 1.0;
+	}
+
+	for(float input = -60.0f; input < 60.0f; input += 0.25f){
+		nn_ffnet_set_activations(net,
+					 NN_ACTIVATION_RELU,
+					 NN_ACTIVATION_SIGMOID);
+		float *results = nn_ffnet_run(net, &input);
+		float relu = input > 0.0f ? input : 0.0f;
+		ASSERT_IN_RANGE(1.0 / (1.0 + exp(-relu)), results[0], 1e-6);
+
+		nn_ffnet_set_activations(net,
+					 NN_ACTIVATION_FAST_SIGMOID,
+					 NN_ACTIVATION_RELU);
+		results = nn_ffnet_run(net, &input);
+		float fast_sigmoid = input / (1.0 + fabs(input));
+		fast_sigmoid = fast_sigmoid > 0.0f ? fast_sigmoid : 0.0f;
+		ASSERT_IN_RANGE(fast_sigmoid, results[0], 1e-6);
+
+		nn_ffnet_set_activations(net,
+					 NN_ACTIVATION_SIGMOID,
+					 NN_ACTIVATION_FAST_SIGMOID);
+		results = nn_ffnet_run(net, &input);
+		float sigmoid = 1.0 / (1.0 + exp(-input));
+		ASSERT_IN_RANGE(sigmoid / (1.0 + sigmoid), results[0], 1e-6);
+	}
+
+	nn_ffnet_destroy(net);
+	PASS();
+}
+
 TEST nn_run_xor()
 {
 	struct nn_ffnet *net = nn_ffnet_create(2, 2, 1, 1);
@@ -212,6 +1458,519 @@ TEST nn_run_xor()
 	PASS();
 }
 
+TEST nn_run_ex_shared()
+{
+	struct nn_ffnet *net = nn_ffnet_create(2, 4, 3, 2);
+	ASSERT(net);
+
+	nn_ffnet_randomize(net);
+
+	size_t nscratch = nn_ffnet_scratch_size(net);
+	ASSERT(nscratch > 0);
+	float *scratch = malloc(sizeof(float) * nscratch);
+	ASSERT(scratch);
+
+	for(int i = 0; i < 4; i++){
+		float *results_ex = nn_ffnet_run_ex(net,
+						    xor_inputs[i],
+						    scratch);
+		ASSERT(results_ex);
+
+		float *results = nn_ffnet_run(net, xor_inputs[i]);
+		ASSERT(results);
+
+		for(int j = 0; j < 3; j++){
+			ASSERT_EQ_FMT(results[j], results_ex[j], "%g");
+		}
+	}
+
+	free(scratch);
+	nn_ffnet_destroy(net);
+	PASS();
+}
+
+TEST nn_run_dense_odd_sizes()
+{
+	/* Sizes that are not a multiple of any vector width */
+	const size_t ninputs = 37, noutputs = 19;
+
+	struct nn_ffnet *net = nn_ffnet_create(ninputs, 0, noutputs, 0);
+	ASSERT(net);
+
+	nn_ffnet_set_activations(net,
+				 NN_ACTIVATION_RELU,
+				 NN_ACTIVATION_RELU);
+	nn_ffnet_randomize(net);
+
+	float inputs[37];
+	for(size_t i = 0; i < ninputs; i++){
+		inputs[i] = (float)i / (float)ninputs;
+	}
+
+	float *results = nn_ffnet_run(net, inputs);
+	ASSERT(results);
+
+	const float *weight = net->weight;
+	for(size_t i = 0; i < noutputs; i++){
+		float sum = *weight++ * net->bias;
+		for(size_t j = 0; j < ninputs; j++){
+			sum += *weight++ * inputs[j];
+		}
+
+		float expected = sum > 0.0f ? sum : 0.0f;
+		ASSERT_IN_RANGE(expected, results[i], 1e-5);
+	}
+
+	nn_ffnet_destroy(net);
+	PASS();
+}
+
+TEST nn_run_batch_matches_run()
+{
+	struct nn_ffnet *net = nn_ffnet_create(3, 5, 2, 2);
+	ASSERT(net);
+
+	nn_ffnet_set_activations(net,
+				 NN_ACTIVATION_FAST_SIGMOID,
+				 NN_ACTIVATION_SIGMOID);
+	nn_ffnet_randomize(net);
+
+	/* Not a multiple of the block size so the last block is partial */
+	const size_t nsamples = 150;
+	float *inputs = malloc(sizeof(float) * nsamples * 3);
+	float *outputs = malloc(sizeof(float) * nsamples * 2);
+	float *scratch = malloc(sizeof(float) *
+				nn_ffnet_batch_scratch_size(net));
+	ASSERT(inputs && outputs && scratch);
+	for(size_t i = 0; i < nsamples * 3; i++){
+		inputs[i] = (float)(i % 17) / 8.0 - 1.0;
+	}
+
+	nn_ffnet_run_batch(net, inputs, nsamples, outputs, scratch);
+
+	for(size_t i = 0; i < nsamples; i++){
+		float *expected = nn_ffnet_run(net, inputs + i * 3);
+		for(size_t j = 0; j < 2; j++){
+			ASSERT_IN_RANGE(expected[j], outputs[i * 2 + j], 1e-5);
+		}
+	}
+
+	free(inputs);
+	free(outputs);
+	free(scratch);
+	nn_ffnet_destroy(net);
+	PASS();
+}
+
+TEST nn_rnet_matches_ffnet()
+{
+	struct nn_ffnet *net = nn_ffnet_create(3, 5, 2, 2);
+	ASSERT(net);
+	nn_ffnet_randomize(net);
+
+	struct nn_rnet *rnet = nn_rnet_from_ffnet(net);
+	ASSERT(rnet);
+
+	/* Without recurrent weights the state doesn't matter */
+	float *state = calloc(nn_rnet_state_size(rnet), sizeof(float));
+	ASSERT(state);
+	for(int i = 0; i < 10; i++){
+		const float inputs[3] = {i * 0.1f, 1.0f - i * 0.2f, 0.5f};
+
+		float *expected = nn_ffnet_run(net, inputs);
+		float *outputs = nn_rnet_step(rnet, state, inputs);
+		for(int j = 0; j < 2; j++){
+			ASSERT_IN_RANGE(expected[j], outputs[j], 1e-5);
+		}
+	}
+
+	free(state);
+	nn_rnet_destroy(rnet);
+	nn_ffnet_destroy(net);
+	PASS();
+}
+
+TEST nn_rnet_step_batch_matches_step()
+{
+	struct nn_rnet *net = nn_rnet_create(2, 4, 3, 2);
+	ASSERT(net);
+
+	struct nn_rng rng;
+	nn_rng_seed(&rng, 1);
+	nn_rnet_randomize_ex(net, &rng);
+
+	const size_t nepisodes = 37;
+	size_t state_size = nn_rnet_state_size(net);
+	float *states = calloc(state_size * nepisodes, sizeof(float));
+	float *batch_states = calloc(state_size * nepisodes, sizeof(float));
+	float *inputs = malloc(sizeof(float) * 2 * nepisodes);
+	float *outputs = malloc(sizeof(float) * 3 * nepisodes);
+	ASSERT(states && batch_states && inputs && outputs);
+
+	/* Every episode sees the same input every step so only the state
+	 * changes the outputs
+	 */
+	nn_rng_fill(&rng, inputs, 2 * nepisodes, -1.0, 1.0);
+
+	float first = 0.0f;
+	for(int i = 0; i < 5; i++){
+		nn_rnet_step_batch(net,
+				   batch_states,
+				   nepisodes,
+				   inputs,
+				   outputs);
+
+		for(size_t j = 0; j < nepisodes; j++){
+			float *expected = nn_rnet_step(net,
+						       states + j * state_size,
+						       inputs + j * 2);
+			for(int k = 0; k < 3; k++){
+				ASSERT_IN_RANGE(expected[k],
+						outputs[j * 3 + k],
+						1e-5);
+			}
+		}
+
+		if(i == 0){
+			first = outputs[0];
+		}
+	}
+	ASSERT(outputs[0] != first);
+
+	free(states);
+	free(batch_states);
+	free(inputs);
+	free(outputs);
+	nn_rnet_destroy(net);
+	PASS();
+}
+
+TEST nn_graphnet_xor()
+{
+	/* Nodes: 0 & 1 inputs, 2 bias, 3 output, 4 & 5 hidden */
+	const struct nn_graphnet_edge edges[] = {
+		{0, 4, -1.0}, {1, 4, 1.0},
+		{0, 5, 1.0}, {1, 5, -1.0},
+		{4, 3, 1.0}, {5, 3, 1.0}
+	};
+	struct nn_graphnet *net = nn_graphnet_create(2, 2, 1, edges, 6);
+	ASSERT(net);
+	ASSERT_EQ(1, net->nlevels);
+
+	nn_graphnet_set_activations(net,
+				    NN_ACTIVATION_RELU,
+				    NN_ACTIVATION_RELU);
+
+	for(int i = 0; i < 4; i++){
+		float *results = nn_graphnet_run(net, xor_inputs[i]);
+		ASSERT(results);
+
+		ASSERT_EQ_FMT(xor_outputs[i], results[0], "%g");
+	}
+
+	nn_graphnet_destroy(net);
+	PASS();
+}
+
+TEST nn_graphnet_matches_ffnet()
+{
+	struct nn_ffnet *net = nn_ffnet_create(5, 7, 3, 3);
+	ASSERT(net);
+
+	nn_ffnet_set_activations(net,
+				 NN_ACTIVATION_FAST_SIGMOID,
+				 NN_ACTIVATION_SIGMOID);
+	nn_ffnet_randomize(net);
+
+	/* Prune about half of the weights */
+	for(int i = 0; i < net->nweights; i++){
+		if(fabs(net->weight[i]) < 0.25){
+			net->weight[i] = 0.0;
+		}
+	}
+
+	struct nn_graphnet *graph = nn_graphnet_from_ffnet(net, 0.0);
+	ASSERT(graph);
+	ASSERT(graph->nedges < net->nweights);
+	ASSERT_EQ(3, graph->nlevels);
+
+	float *scratch = malloc(sizeof(float) *
+				nn_graphnet_scratch_size(graph));
+	ASSERT(scratch);
+
+	const float inputs[5] = {0.5, -1.0, 0.25, 2.0, -0.75};
+	float *expected = nn_ffnet_run(net, inputs);
+	float *results = nn_graphnet_run_ex(graph, inputs, scratch);
+	for(int i = 0; i < 3; i++){
+		ASSERT_IN_RANGE(expected[i], results[i], 1e-5);
+	}
+
+	free(scratch);
+	nn_graphnet_destroy(graph);
+	nn_ffnet_destroy(net);
+	PASS();
+}
+
+TEST nn_program_matches_ffnet()
+{
+	struct nn_ffnet *net = nn_ffnet_create(6, 5, 3, 2);
+	ASSERT(net);
+
+	nn_ffnet_set_activations(net,
+				 NN_ACTIVATION_RELU,
+				 NN_ACTIVATION_FAST_SIGMOID);
+	nn_ffnet_set_bias(net, 0.5);
+	nn_ffnet_randomize(net);
+
+	struct nn_program *program = nn_program_from_ffnet(net);
+	ASSERT(program);
+	ASSERT_EQ(6, program->ninstructions);
+
+	const float inputs[6] = {0.5, -1.0, 0.25, 2.0, -0.75, 1.0};
+	float *expected = nn_ffnet_run(net, inputs);
+	float *results = nn_program_run(program, inputs);
+	for(int i = 0; i < 3; i++){
+		ASSERT_IN_RANGE(expected[i], results[i], 1e-5);
+	}
+
+	/* The program keeps its own copy of the weights */
+	nn_ffnet_destroy(net);
+	ASSERT_EQ(results, nn_program_run(program, inputs));
+
+	nn_program_destroy(program);
+	PASS();
+}
+
+TEST nn_program_precision()
+{
+	struct nn_ffnet *net = nn_ffnet_create(8, 6, 2, 1);
+	ASSERT(net);
+
+	nn_ffnet_set_activations(net,
+				 NN_ACTIVATION_SIGMOID,
+				 NN_ACTIVATION_SIGMOID);
+	nn_ffnet_randomize(net);
+
+	struct nn_program *bf16 =
+		nn_program_from_ffnet_precision(net, NN_PRECISION_BF16);
+	struct nn_program *int8 =
+		nn_program_from_ffnet_precision(net, NN_PRECISION_INT8);
+	ASSERT(bf16 && int8);
+	ASSERT(bf16->weight_bf16 && !bf16->weight);
+	ASSERT(int8->weight_int8 && !int8->weight);
+
+	const float inputs[8] = {0.5, -1.0, 0.25, 1.0, -0.75, 0.0, 0.5, 1.0};
+	float *expected = nn_ffnet_run(net, inputs);
+	float *bf16_results = nn_program_run(bf16, inputs);
+	float *int8_results = nn_program_run(int8, inputs);
+	for(int i = 0; i < 2; i++){
+		ASSERT_IN_RANGE(expected[i], bf16_results[i], 0.01);
+		ASSERT_IN_RANGE(expected[i], int8_results[i], 0.01);
+	}
+
+	nn_program_destroy(bf16);
+	nn_program_destroy(int8);
+	nn_ffnet_destroy(net);
+	PASS();
+}
+
+TEST nn_program_matches_graphnet()
+{
+	struct nn_ffnet *net = nn_ffnet_create(4, 3, 2, 2);
+	ASSERT(net);
+
+	nn_ffnet_randomize(net);
+	for(int i = 0; i < net->nweights; i += 2){
+		net->weight[i] = 0.0;
+	}
+
+	struct nn_graphnet *graph = nn_graphnet_from_ffnet(net, 0.0);
+	ASSERT(graph);
+	nn_ffnet_destroy(net);
+
+	struct nn_program *program = nn_program_from_graphnet(graph);
+	ASSERT(program);
+	ASSERT_EQ(graph->nedges, program->nedges);
+
+	float *scratch = malloc(sizeof(float) *
+				nn_program_scratch_size(program));
+	ASSERT(scratch);
+
+	const float inputs[4] = {1.0, 0.0, -0.5, 0.75};
+	float *expected = nn_graphnet_run(graph, inputs);
+	float *results = nn_program_run_ex(program, inputs, scratch);
+	for(int i = 0; i < 2; i++){
+		ASSERT_IN_RANGE(expected[i], results[i], 1e-5);
+	}
+
+	free(scratch);
+	nn_program_destroy(program);
+	nn_graphnet_destroy(graph);
+	PASS();
+}
+
+TEST nn_program_external_weights()
+{
+	struct nn_ffnet *net = nn_ffnet_create(8, 6, 2, 1);
+	ASSERT(net);
+
+	nn_ffnet_set_activations(net,
+				 NN_ACTIVATION_SIGMOID,
+				 NN_ACTIVATION_SIGMOID);
+	nn_ffnet_randomize(net);
+
+	const enum nn_precision precisions[] = {
+		NN_PRECISION_FLOAT,
+		NN_PRECISION_BF16,
+		NN_PRECISION_INT8
+	};
+	const float inputs[8] = {0.5, -1.0, 0.25, 1.0, -0.75, 0.0, 0.5, 1.0};
+	float *expected = nn_ffnet_run(net, inputs);
+	for(int i = 0; i < 3; i++){
+		void *weights = malloc(nn_precision_size(precisions[i]) *
+				       net->nweights);
+		ASSERT(weights);
+		float scale = nn_precision_store(precisions[i],
+						 net->weight,
+						 net->nweights,
+						 weights);
+
+		struct nn_program *program =
+			nn_program_from_ffnet_weights(net,
+						      precisions[i],
+						      weights,
+						      scale);
+		ASSERT(program);
+
+		float results[2];
+		memcpy(results,
+		       nn_program_run(program, inputs),
+		       sizeof(results));
+		for(int j = 0; j < 2; j++){
+			ASSERT_IN_RANGE(expected[j], results[j], 0.05);
+		}
+
+		/* The copy doesn't need the weights it was compiled on */
+		struct nn_program *copy = nn_program_copy(program);
+		ASSERT(copy);
+		nn_program_destroy(program);
+		free(weights);
+
+		float *copy_results = nn_program_run(copy, inputs);
+		for(int j = 0; j < 2; j++){
+			ASSERT_EQ_FMT(results[j], copy_results[j], "%g");
+		}
+		nn_program_destroy(copy);
+	}
+
+	nn_ffnet_destroy(net);
+	PASS();
+}
+
+TEST nn_program_run_block_matches_run()
+{
+	struct nn_ffnet *net = nn_ffnet_create(3, 5, 2, 2);
+	ASSERT(net);
+
+	nn_ffnet_set_activations(net,
+				 NN_ACTIVATION_FAST_SIGMOID,
+				 NN_ACTIVATION_SIGMOID);
+	nn_ffnet_randomize(net);
+
+	struct nn_program *programs[4];
+	programs[0] = nn_program_from_ffnet(net);
+	programs[1] = nn_program_from_ffnet_precision(net, NN_PRECISION_BF16);
+	programs[2] = nn_program_from_ffnet_precision(net, NN_PRECISION_INT8);
+
+	for(int i = 0; i < net->nweights; i += 2){
+		net->weight[i] = 0.0;
+	}
+	struct nn_graphnet *graph = nn_graphnet_from_ffnet(net, 0.0);
+	ASSERT(graph);
+	programs[3] = nn_program_from_graphnet(graph);
+	nn_graphnet_destroy(graph);
+	nn_ffnet_destroy(net);
+
+	/* Stored per input like nn_ffnet_run_block wants them */
+	const size_t nsamples = 37;
+	float inputs[37 * 3];
+	for(size_t i = 0; i < nsamples * 3; i++){
+		inputs[i] = (float)(i % 17) / 8.0 - 1.0;
+	}
+
+	for(int i = 0; i < 4; i++){
+		struct nn_program *program = programs[i];
+		ASSERT(program);
+
+		size_t size = nn_program_scratch_size(program);
+		float *scratch = malloc(sizeof(float) * size * (nsamples + 1));
+		ASSERT(scratch);
+		float *values = scratch + size * nsamples;
+
+		float *outputs = nn_program_run_block(program,
+						      inputs,
+						      nsamples,
+						      scratch);
+		for(size_t j = 0; j < nsamples; j++){
+			float sample[3];
+			for(size_t k = 0; k < 3; k++){
+				sample[k] = inputs[k * nsamples + j];
+			}
+
+			float *expected = nn_program_run_ex(program,
+							    sample,
+							    values);
+			for(size_t k = 0; k < 2; k++){
+				ASSERT_IN_RANGE(expected[k],
+						outputs[k * nsamples + j],
+						1e-5);
+			}
+		}
+
+		free(scratch);
+		nn_program_destroy(program);
+	}
+
+	PASS();
+}
+
+TEST nn_program_write_c_non_finite()
+{
+	struct nn_ffnet *net = nn_ffnet_create(2, 2, 1, 1);
+	ASSERT(net);
+
+	nn_ffnet_randomize(net);
+	net->weight[1] = INFINITY;
+	net->weight[2] = -INFINITY;
+	net->weight[3] = NAN;
+
+	struct nn_program *program = nn_program_from_ffnet(net);
+	ASSERT(program);
+	nn_ffnet_destroy(net);
+
+	FILE *file = tmpfile();
+	ASSERT(file);
+	ASSERT(nn_program_write_c(program, file, "non_finite"));
+
+	/* The values are written with the macros of math.h, printf would
+	 * write inff and nanf which aren't valid C
+	 */
+	char code[8192];
+	rewind(file);
+	size_t size = fread(code, 1, sizeof(code) - 1, file);
+	code[size] = '\0';
+	fclose(file);
+
+	ASSERT(strstr(code, " INFINITY,"));
+	ASSERT(strstr(code, "-INFINITY,"));
+	ASSERT(strstr(code, "NAN,"));
+	ASSERT_FALSE(strstr(code, "inf"));
+	ASSERT_FALSE(strstr(code, "nan"));
+
+	nn_program_destroy(program);
+	PASS();
+}
+
 TEST nn_time_big()
 {
 	struct nn_ffnet *net = nn_ffnet_create(1024, 256, 64, 4);
@@ -235,10 +1994,27 @@ SUITE(nn)
 {
 	RUN_TEST(nn_create_and_destroy);
 	RUN_TEST(nn_randomize);
+	RUN_TEST(nn_rng_repeatable);
 	RUN_TEST(nn_copy);
+	RUN_TEST(nn_copy_into);
+	RUN_TEST(nn_init_external);
 	RUN_TEST(nn_run);
 	RUN_TEST(nn_run_relu);
+	RUN_TEST(nn_run_activations);
 	RUN_TEST(nn_run_xor);
+	RUN_TEST(nn_run_ex_shared);
+	RUN_TEST(nn_run_dense_odd_sizes);
+	RUN_TEST(nn_run_batch_matches_run);
+	RUN_TEST(nn_rnet_matches_ffnet);
+	RUN_TEST(nn_rnet_step_batch_matches_step);
+	RUN_TEST(nn_graphnet_xor);
+	RUN_TEST(nn_graphnet_matches_ffnet);
+	RUN_TEST(nn_program_matches_ffnet);
+	RUN_TEST(nn_program_precision);
+	RUN_TEST(nn_program_matches_graphnet);
+	RUN_TEST(nn_program_external_weights);
+	RUN_TEST(nn_program_run_block_matches_run);
+	RUN_TEST(nn_program_write_c_non_finite);
 }
 
 SUITE(nn_time)
@@ -249,6 +2025,26 @@ SUITE(nn_time)
 SUITE(neat)
 {
 	RUN_TEST(neat_create_and_destroy);
+	RUN_TEST(neat_run_batch_matches_run);
+	RUN_TEST(neat_run_batch_reduced_precision);
+	RUN_TEST(neat_packed_backend);
+	RUN_TEST(neat_evaluate_xor);
+	RUN_TEST(neat_generational_epochs);
+	RUN_TEST(neat_genomes_grow);
+	RUN_TEST(neat_save_load);
+	RUN_TEST(neat_reduced_weights);
+	RUN_TEST(neat_load_corrupted);
+	RUN_TEST(neat_packed_weights);
+	RUN_TEST(neat_export_best);
+	RUN_TEST(neat_export_sparse);
+	RUN_TEST(neat_migrate_genomes);
+	RUN_TEST(neat_async_evaluation);
+	RUN_TEST(neat_migrate_during_async_evaluation);
+	RUN_TEST(neat_speciate_deterministic);
+	RUN_TEST(neat_remove_extinct_species);
+	RUN_TEST(neat_species_stay_bounded);
+	RUN_TEST(neat_evaluate_cached_genomes);
+	RUN_TEST(neat_stats);
 	RUN_TEST(neat_xor);
 }
 